@@ -38,12 +38,20 @@ bool CCallbackMgr::isServer(class CCallbackBase *pCallback)
 
 
 Steam_Call_Result::Steam_Call_Result(SteamAPICall_t a, int icb, void *r, unsigned int s, double r_in, bool run_cc_cb)
+{
+    reset(a, icb, r, s, r_in, run_cc_cb);
+}
+
+void Steam_Call_Result::reset(SteamAPICall_t a, int icb, void *r, unsigned int s, double r_in, bool run_cc_cb)
 {
     api_call = a;
+    callbacks.clear();
     result.resize(s);
     if (s > 0 && r != NULL) {
         memcpy(&(result[0]), r, s);
     }
+    to_delete = false;
+    reserved = false;
     run_in = r_in;
     run_call_completed_cb = run_cc_cb;
     iCallback = icb;
@@ -77,6 +85,108 @@ bool Steam_Call_Result::has_cb() const
 
 
 
+long long Call_Result_Timers::tick_of(std::chrono::high_resolution_clock::time_point time) const
+{
+    double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(time - origin).count();
+    if (seconds < 0) return 0;
+
+    return static_cast<long long>(seconds / SLOT_SECONDS);
+}
+
+void Call_Result_Timers::schedule(SteamAPICall_t api_call, Kinds kind, std::chrono::high_resolution_clock::time_point when)
+{
+    // never schedule in a slot which was already visited, it would wait for a whole round
+    long long tick = std::max(tick_of(when), last_tick + 1);
+    slots[tick % SLOTS_COUNT].push_back({ api_call, kind, when });
+}
+
+void Call_Result_Timers::expire(std::chrono::high_resolution_clock::time_point now, std::vector<Timer> &fired)
+{
+    long long now_tick = tick_of(now);
+    if (now_tick <= last_tick) return;
+
+    // after a long pause visiting each slot once is enough
+    long long first_tick = std::max(last_tick + 1, now_tick - (long long)SLOTS_COUNT + 1);
+    for (long long tick = first_tick; tick <= now_tick; ++tick) {
+        auto &slot = slots[tick % SLOTS_COUNT];
+        auto remaining = std::partition(slot.begin(), slot.end(), [now](const Timer &timer) { return timer.when > now; });
+        std::move(remaining, slot.end(), std::back_inserter(fired));
+        slot.erase(remaining, slot.end());
+    }
+
+    // the current slot stays open, timers due later in it or scheduled into it must not wait for the next round
+    last_tick = now_tick - 1;
+}
+
+
+
+struct Steam_Call_Result *SteamCallResults::find(SteamAPICall_t api_call)
+{
+    auto it = callresults_index.find(api_call);
+    if (it == callresults_index.end()) return nullptr;
+
+    return &(*it->second);
+}
+
+const struct Steam_Call_Result *SteamCallResults::find(SteamAPICall_t api_call) const
+{
+    auto it = callresults_index.find(api_call);
+    if (it == callresults_index.end()) return nullptr;
+
+    return &(*it->second);
+}
+
+SteamAPICall_t SteamCallResults::store(SteamAPICall_t api_call, int iCallback, void *result, unsigned int size, double timeout, bool run_call_completed_cb, bool reserved)
+{
+    if (free_callresults.empty()) {
+        callresults.emplace_back(api_call, iCallback, result, size, timeout, run_call_completed_cb);
+    } else {
+        callresults.splice(callresults.end(), free_callresults, free_callresults.begin());
+        callresults.back().reset(api_call, iCallback, result, size, timeout, run_call_completed_cb);
+    }
+
+    struct Steam_Call_Result &stored = callresults.back();
+    stored.reserved = reserved;
+    if (free_index_nodes.empty()) {
+        callresults_index[api_call] = std::prev(callresults.end());
+    } else {
+        Callresults_Index::node_type node = std::move(free_index_nodes.back());
+        free_index_nodes.pop_back();
+        node.key() = api_call;
+        node.mapped() = std::prev(callresults.end());
+        callresults_index.insert(std::move(node));
+    }
+
+    // callbacks are erased as soon as they ran or were cancelled, only call results wait for the game to fetch them
+    if (run_call_completed_cb) {
+        timers.schedule(api_call, Call_Result_Timers::EXPIRED, stored.created + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<double>(STEAM_CALLRESULT_TIMEOUT)));
+    }
+    schedule_due(stored);
+    return api_call;
+}
+
+void SteamCallResults::erase(Callresults_Index::iterator it)
+{
+    if (free_callresults.size() < MAX_FREE_CALLRESULTS) {
+        free_callresults.splice(free_callresults.end(), callresults, it->second);
+        free_index_nodes.push_back(callresults_index.extract(it));
+    } else {
+        callresults.erase(it->second);
+        callresults_index.erase(it);
+    }
+}
+
+void SteamCallResults::schedule_due(const struct Steam_Call_Result &res)
+{
+    if (res.reserved) return; // scheduled once the actual result is added
+
+    if (res.call_completed()) {
+        pending.push_back(res.api_call);
+    } else {
+        timers.schedule(res.api_call, Call_Result_Timers::DUE, res.created + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<double>(res.run_in)));
+    }
+}
+
 void SteamCallResults::addCallCompleted(class CCallbackBase *cb)
 {
     if (std::find(completed_callbacks.begin(), completed_callbacks.end(), cb) == completed_callbacks.end()) {
@@ -96,8 +206,8 @@ void SteamCallResults::rmCallCompleted(class CCallbackBase *cb)
 
 void SteamCallResults::addCallBack(SteamAPICall_t api_call, class CCallbackBase *cb)
 {
-    auto cb_result = std::find_if(callresults.begin(), callresults.end(), [api_call](struct Steam_Call_Result const& item) { return item.api_call == api_call; });
-    if (cb_result != callresults.end()) {
+    auto cb_result = find(api_call);
+    if (cb_result) {
         cb_result->callbacks.push_back(cb);
         CCallbackMgr::SetRegister(cb, cb->GetICallback());
         PRINT_DEBUG("new cb for call result [api id=%llu, result k_iCallback=%i] %p", api_call, cb ? (cb->GetICallback()) : -1, cb);
@@ -106,20 +216,16 @@ void SteamCallResults::addCallBack(SteamAPICall_t api_call, class CCallbackBase
 
 bool SteamCallResults::exists(SteamAPICall_t api_call) const
 {
-    auto cr = std::find_if(callresults.begin(), callresults.end(), [api_call](struct Steam_Call_Result const& item) {
-        return item.api_call == api_call;
-    });
-    if (callresults.end() == cr) return false;
+    auto cr = find(api_call);
+    if (!cr) return false;
     if (!cr->call_completed()) return false;
     return true;
 }
 
 bool SteamCallResults::callback_result(SteamAPICall_t api_call, void *copy_to, unsigned int size)
 {
-    auto cb_result = std::find_if(callresults.begin(), callresults.end(), [api_call](struct Steam_Call_Result const& item) {
-        return item.api_call == api_call;
-    });
-    if (cb_result != callresults.end()) {
+    auto cb_result = find(api_call);
+    if (cb_result) {
         if (!cb_result->call_completed()) return false;
         if (cb_result->result.size() > size) return false;
 
@@ -133,8 +239,8 @@ bool SteamCallResults::callback_result(SteamAPICall_t api_call, void *copy_to, u
 
 void SteamCallResults::rmCallBack(SteamAPICall_t api_call, class CCallbackBase *cb)
 {
-    auto cb_result = std::find_if(callresults.begin(), callresults.end(), [api_call](struct Steam_Call_Result const& item) { return item.api_call == api_call; });
-    if (cb_result != callresults.end()) {
+    auto cb_result = find(api_call);
+    if (cb_result) {
         auto it = std::find(cb_result->callbacks.begin(), cb_result->callbacks.end(), cb);
         if (it != cb_result->callbacks.end()) {
             cb_result->callbacks.erase(it);
@@ -163,21 +269,20 @@ void SteamCallResults::rmCallBack(class CCallbackBase *cb)
 SteamAPICall_t SteamCallResults::addCallResult(SteamAPICall_t api_call, int iCallback, void *result, unsigned int size, double timeout, bool run_call_completed_cb)
 {
     PRINT_DEBUG("%i", iCallback);
-    auto cb_result = std::find_if(callresults.begin(), callresults.end(), [api_call](struct Steam_Call_Result const& item) { return item.api_call == api_call; });
-    if (cb_result != callresults.end()) {
+    auto cb_result = find(api_call);
+    if (cb_result) {
         // only change the data if this is a previously reserved callresult
         if (cb_result->reserved) {
             std::chrono::high_resolution_clock::time_point created = cb_result->created;
-            std::vector<class CCallbackBase *> temp_cbs = cb_result->callbacks;
-            *cb_result = Steam_Call_Result(api_call, iCallback, result, size, timeout, run_call_completed_cb);
-            cb_result->callbacks = temp_cbs;
+            std::vector<class CCallbackBase *> temp_cbs = std::move(cb_result->callbacks);
+            cb_result->reset(api_call, iCallback, result, size, timeout, run_call_completed_cb);
+            cb_result->callbacks = std::move(temp_cbs);
             cb_result->created = created;
+            schedule_due(*cb_result);
             return cb_result->api_call;
         }
     } else {
-        struct Steam_Call_Result res = Steam_Call_Result(api_call, iCallback, result, size, timeout, run_call_completed_cb);
-        callresults.push_back(res);
-        return callresults.back().api_call;
+        return store(api_call, iCallback, result, size, timeout, run_call_completed_cb, false);
     }
 
     PRINT_DEBUG("ERROR");
@@ -186,10 +291,7 @@ SteamAPICall_t SteamCallResults::addCallResult(SteamAPICall_t api_call, int iCal
 
 SteamAPICall_t SteamCallResults::reserveCallResult()
 {
-    struct Steam_Call_Result res = Steam_Call_Result(generate_steam_api_call_id(), 0, NULL, 0, 0.0, true);
-    res.reserved = true;
-    callresults.push_back(res);
-    return callresults.back().api_call;
+    return store(generate_steam_api_call_id(), 0, NULL, 0, 0.0, true, true);
 }
 
 SteamAPICall_t SteamCallResults::addCallResult(int iCallback, void *result, unsigned int size, double timeout, bool run_call_completed_cb)
@@ -204,95 +306,179 @@ void SteamCallResults::setCbAll(void (*cb_all)(std::vector<char> result, int cal
 
 void SteamCallResults::runCallResults()
 {
-    unsigned long current_size = static_cast<unsigned long>(callresults.size());
-    for (unsigned i = 0; i < current_size; ++i) {
-        unsigned index = i;
-
-        if (!callresults[index].to_delete) {
-            if (callresults[index].can_execute()) {
-                std::vector<char> result = callresults[index].result;
-                SteamAPICall_t api_call = callresults[index].api_call;
-                bool run_call_completed_cb = callresults[index].run_call_completed_cb;
-                int iCallback = callresults[index].iCallback;
-                if (run_call_completed_cb) {
-                    callresults[index].run_call_completed_cb = false;
-                }
+    std::vector<Call_Result_Timers::Timer> fired = timer_buffers.take();
+    timers.expire(std::chrono::high_resolution_clock::now(), fired);
+    for (auto &timer : fired) {
+        auto it = callresults_index.find(timer.api_call);
+        if (it == callresults_index.end()) continue;
+
+        if (timer.kind == Call_Result_Timers::DUE) {
+            if (!it->second->to_delete) {
+                pending.push_back(timer.api_call);
+            } else if (!it->second->run_call_completed_cb) {
+                erase(it);
+            }
+        } else if (it->second->timed_out()) {
+            PRINT_DEBUG("removed callresult %i", it->second->iCallback);
+            erase(it);
+        } else {
+            timers.schedule(timer.api_call, Call_Result_Timers::EXPIRED, timer.when);
+        }
+    }
+    timer_buffers.give(std::move(fired));
+
+    // anything added while the callbacks run (mutex unlocked) goes into the new 'pending' and waits for the next run
+    std::vector<SteamAPICall_t> due = api_call_buffers.take();
+    due.swap(pending);
+    for (auto api_call : due) {
+        auto it = callresults_index.find(api_call);
+        if (it == callresults_index.end()) continue;
+
+        auto callresult = &(*it->second);
+        if (callresult->to_delete) {
+            if (!callresult->run_call_completed_cb) erase(it);
+            continue;
+        }
 
-                callresults[index].to_delete = true;
-                if (callresults[index].has_cb()) {
-                    std::vector<class CCallbackBase *> temp_cbs = callresults[index].callbacks;
-                    for (auto & cb : temp_cbs) {
-                        PRINT_DEBUG("Calling callresult %p %i, kind=%i (0=callback, 1=call result)", cb, cb->GetICallback(), (int)run_call_completed_cb);
-                        global_mutex.unlock();
-
-                        //TODO: unlock relock doesn't work if mutex was locked more than once.
-                        if (run_call_completed_cb) { //run the right function depending on if it's a callback or a call result.
-                            cb->Run(&(result[0]), false, api_call);
-                        } else { // if this is a callback
-                            cb->Run(&(result[0]));
-                        }
-
-                        // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-                        //COULD BE DELETED SO DON'T TOUCH CB
-                        // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-
-                        global_mutex.lock();
-                        PRINT_DEBUG("callresult done");
-                    }
-                }
+        if (!callresult->can_execute()) {
+            // waiting for a callback to be attached, or reserved again
+            if (!callresult->reserved) pending.push_back(api_call);
+            continue;
+        }
 
-                if (run_call_completed_cb) {
-                    //can it happen that one is removed during the callback?
-                    std::vector<class CCallbackBase *> callbacks = completed_callbacks;
-                    SteamAPICallCompleted_t data{};
-                    data.m_hAsyncCall = api_call;
-                    data.m_iCallback = iCallback;
-                    data.m_cubParam = (uint32)result.size();
-
-                    for (auto & cb: callbacks) {
-                        PRINT_DEBUG("Calling complete cb %p %i %llu", cb, iCallback, api_call);
-                        //TODO: check if this is a problem or not.
-                        SteamAPICallCompleted_t temp = data;
-                        global_mutex.unlock();
-                        cb->Run(&temp);
-                        global_mutex.lock();
-                    }
-
-                    if (cb_all) {
-                        std::vector<char> res{};
-                        res.resize(sizeof(data));
-                        memcpy(&(res[0]), &data, sizeof(data));
-                        cb_all(res, data.k_iCallback);
-                    }
-                } else {
-                    if (cb_all) {
-                        cb_all(result, iCallback);
-                    }
-                }
-            } else {
-                if (callresults[index].timed_out()) {
-                    callresults[index].to_delete = true;
+        std::vector<char> result = result_buffers.take();
+        result.assign(callresult->result.begin(), callresult->result.end());
+        bool run_call_completed_cb = callresult->run_call_completed_cb;
+        int iCallback = callresult->iCallback;
+        if (run_call_completed_cb) {
+            callresult->run_call_completed_cb = false;
+        }
+
+        callresult->to_delete = true;
+        if (callresult->has_cb()) {
+            std::vector<class CCallbackBase *> temp_cbs = callback_buffers.take();
+            temp_cbs.assign(callresult->callbacks.begin(), callresult->callbacks.end());
+            for (auto & cb : temp_cbs) {
+                PRINT_DEBUG("Calling callresult %p %i, kind=%i (0=callback, 1=call result)", cb, cb->GetICallback(), (int)run_call_completed_cb);
+                global_mutex.unlock();
+
+                //TODO: unlock relock doesn't work if mutex was locked more than once.
+                if (run_call_completed_cb) { //run the right function depending on if it's a callback or a call result.
+                    cb->Run(&(result[0]), false, api_call);
+                } else { // if this is a callback
+                    cb->Run(&(result[0]));
                 }
+
+                // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+                //COULD BE DELETED SO DON'T TOUCH CB
+                // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
+
+                global_mutex.lock();
+                PRINT_DEBUG("callresult done");
             }
+            callback_buffers.give(std::move(temp_cbs));
         }
-    }
 
-    PRINT_DEBUG("erase to_delete");
-    auto c = std::begin(callresults);
-    while (c != std::end(callresults)) {
-        if (c->to_delete) {
-            if (c->timed_out()) {
-                PRINT_DEBUG("removed callresult %i", c->iCallback);
-                c = callresults.erase(c);
-            } else {
-                ++c;
+        if (run_call_completed_cb) {
+            //can it happen that one is removed during the callback?
+            std::vector<class CCallbackBase *> callbacks = callback_buffers.take();
+            callbacks.assign(completed_callbacks.begin(), completed_callbacks.end());
+            SteamAPICallCompleted_t data{};
+            data.m_hAsyncCall = api_call;
+            data.m_iCallback = iCallback;
+            data.m_cubParam = (uint32)result.size();
+
+            for (auto & cb: callbacks) {
+                PRINT_DEBUG("Calling complete cb %p %i %llu", cb, iCallback, api_call);
+                //TODO: check if this is a problem or not.
+                SteamAPICallCompleted_t temp = data;
+                global_mutex.unlock();
+                cb->Run(&temp);
+                global_mutex.lock();
+            }
+            callback_buffers.give(std::move(callbacks));
+
+            if (cb_all) {
+                std::vector<char> res{};
+                res.resize(sizeof(data));
+                memcpy(&(res[0]), &data, sizeof(data));
+                cb_all(res, data.k_iCallback);
             }
         } else {
-            ++c;
+            if (cb_all) {
+                cb_all(result, iCallback);
+            }
+
+            // callbacks use ids the game never sees, nothing can ask for this result anymore
+            it = callresults_index.find(api_call);
+            if (it != callresults_index.end()) erase(it);
+        }
+
+        result_buffers.give(std::move(result));
+    }
+    api_call_buffers.give(std::move(due));
+}
+
+
+
+const char *Steam_Call_Back::result_data(const struct Result &res) const
+{
+    return &results_data[res.offset];
+}
+
+bool Steam_Call_Back::has_result(const void *result, unsigned int size, size_t hash) const
+{
+    if (results_table.empty()) return false;
+
+    size_t mask = results_table.size() - 1;
+    for (size_t slot = hash & mask; results_table[slot]; slot = (slot + 1) & mask) {
+        const struct Result &res = results[results_table[slot] - 1];
+        if (res.hash == hash && res.size == size && memcmp(result_data(res), result, size) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Steam_Call_Back::table_insert(unsigned int index)
+{
+    size_t mask = results_table.size() - 1;
+    size_t slot = results[index].hash & mask;
+    while (results_table[slot]) slot = (slot + 1) & mask;
+    results_table[slot] = index + 1;
+}
+
+void Steam_Call_Back::add_result(const void *result, unsigned int size, size_t hash)
+{
+    struct Result res{};
+    res.offset = results_data.size();
+    res.size = size;
+    res.hash = hash;
+    results_data.insert(results_data.end(), static_cast<const char *>(result), static_cast<const char *>(result) + size);
+    results.push_back(res);
+
+    // keep the load factor at 1/2 or less
+    if (results.size() * 2 > results_table.size()) {
+        results_table.assign(std::max<size_t>(16, results_table.size() * 2), 0);
+        for (unsigned int i = 0; i < results.size(); ++i) {
+            table_insert(i);
         }
+    } else {
+        table_insert(static_cast<unsigned int>(results.size() - 1));
     }
 }
 
+void Steam_Call_Back::clear_results()
+{
+    if (results.empty()) return;
+
+    // clear() keeps the capacity, next frame reuses the same memory
+    results_data.clear();
+    results.clear();
+    std::fill(results_table.begin(), results_table.end(), 0);
+}
+
 
 
 SteamCallBacks::SteamCallBacks(SteamCallResults *results)
@@ -309,13 +495,14 @@ void SteamCallBacks::addCallBack(int iCallback, class CCallbackBase *cb)
         return;
     }
 
-    if (std::find(callbacks[iCallback].callbacks.begin(), callbacks[iCallback].callbacks.end(), cb) == callbacks[iCallback].callbacks.end()) {
-        callbacks[iCallback].callbacks.push_back(cb);
+    auto &callback = callbacks[iCallback];
+    if (std::find(callback.callbacks.begin(), callback.callbacks.end(), cb) == callback.callbacks.end()) {
+        callback.callbacks.push_back(cb);
         PRINT_DEBUG("new cb for callback [result k_iCallback=%i] %p", iCallback, cb);
         CCallbackMgr::SetRegister(cb, iCallback);
-        for (auto & res: callbacks[iCallback].results) {
+        for (auto & res: callback.results) {
             //TODO: timeout?
-            SteamAPICall_t api_id = results->addCallResult(iCallback, &(res[0]), static_cast<unsigned long>(res.size()), 0.0, false);
+            SteamAPICall_t api_id = results->addCallResult(iCallback, (void *)callback.result_data(res), res.size, 0.0, false);
             results->addCallBack(api_id, cb);
         }
     }
@@ -323,27 +510,20 @@ void SteamCallBacks::addCallBack(int iCallback, class CCallbackBase *cb)
 
 void SteamCallBacks::addCBResult(int iCallback, void *result, unsigned int size, double timeout, bool dont_post_if_already)
 {
-    if (dont_post_if_already) {
-        for (auto & r : callbacks[iCallback].results) {
-            if (r.size() == size) {
-                if (memcmp(&(r[0]), result, size) == 0) {
-                    //cb already posted
-                    return;
-                }
-            }
-        }
+    auto &callback = callbacks[iCallback];
+    size_t hash = std::hash<std::string_view>{}(std::string_view(static_cast<const char *>(result), size));
+    if (dont_post_if_already && callback.has_result(result, size, hash)) {
+        //cb already posted
+        return;
     }
 
-    std::vector<char> temp{};
-    temp.resize(size);
-    memcpy(&(temp[0]), result, size);
-    callbacks[iCallback].results.push_back(temp);
-    for (auto cb: callbacks[iCallback].callbacks) {
+    callback.add_result(result, size, hash);
+    for (auto cb: callback.callbacks) {
         SteamAPICall_t api_id = results->addCallResult(iCallback, result, size, timeout, false);
         results->addCallBack(api_id, cb);
     }
 
-    if (callbacks[iCallback].callbacks.empty()) {
+    if (callback.callbacks.empty()) {
         results->addCallResult(iCallback, result, size, timeout, false);
     }
 }
@@ -371,9 +551,10 @@ void SteamCallBacks::rmCallBack(int iCallback, class CCallbackBase *cb)
         return;
     }
 
-    auto c = std::find(callbacks[iCallback].callbacks.begin(), callbacks[iCallback].callbacks.end(), cb);
-    if (c != callbacks[iCallback].callbacks.end()) {
-        callbacks[iCallback].callbacks.erase(c);
+    auto &callback = callbacks[iCallback];
+    auto c = std::find(callback.callbacks.begin(), callback.callbacks.end(), cb);
+    if (c != callback.callbacks.end()) {
+        callback.callbacks.erase(c);
         CCallbackMgr::SetUnregister(cb);
         PRINT_DEBUG("removed cb for callback [result k_iCallback=%i] %p", iCallback, cb);
         results->rmCallBack(cb);
@@ -383,7 +564,7 @@ void SteamCallBacks::rmCallBack(int iCallback, class CCallbackBase *cb)
 void SteamCallBacks::runCallBacks()
 {
     for (auto & c : callbacks) {
-        c.second.results.clear();
+        c.second.clear_results();
     }
 }
 
@@ -47,6 +47,9 @@ struct Steam_Call_Result {
 
     Steam_Call_Result(SteamAPICall_t a, int icb, void *r, unsigned int s, double r_in, bool run_cc_cb);
 
+    // same as constructing a new one, but reuses the memory of 'callbacks' and 'result'
+    void reset(SteamAPICall_t a, int icb, void *r, unsigned int s, double r_in, bool run_cc_cb);
+
     bool operator==(const struct Steam_Call_Result& other) const;
 
     bool timed_out() const;
@@ -59,11 +62,94 @@ struct Steam_Call_Result {
 
 };
 
+// hashed timer wheel with fixed size slots, used to wake up call results when they're due or expired
+// entries are only checked when their slot is visited, so the cost of a run doesn't depend on the number of waiting entries
+class Call_Result_Timers {
+public:
+    enum Kinds {
+        DUE, // the call result can be executed
+        EXPIRED, // the call result must be removed
+    };
+
+    struct Timer {
+        SteamAPICall_t api_call{};
+        Kinds kind{};
+        std::chrono::high_resolution_clock::time_point when{};
+    };
+
+private:
+    constexpr static const unsigned SLOTS_COUNT = 256;
+    constexpr static const double SLOT_SECONDS = STEAM_CALLRESULT_WAIT_FOR_CB;
+
+    std::vector<Timer> slots[SLOTS_COUNT]{};
+    std::chrono::high_resolution_clock::time_point origin = std::chrono::high_resolution_clock::now();
+    long long last_tick = -1;
+
+    long long tick_of(std::chrono::high_resolution_clock::time_point time) const;
+
+public:
+    void schedule(SteamAPICall_t api_call, Kinds kind, std::chrono::high_resolution_clock::time_point when);
+
+    // move every timer which is due at 'now' to 'fired'
+    void expire(std::chrono::high_resolution_clock::time_point now, std::vector<Timer> &fired);
+};
+
+// vectors given back after use, so their memory is reused instead of allocating new ones
+// callbacks can run the call results again, each run takes its own buffers from here
+template<typename T>
+class Buffer_Pool {
+    constexpr static const size_t MAX_FREE_BUFFERS = 16;
+
+    std::vector<std::vector<T>> free_buffers{};
+
+public:
+    std::vector<T> take()
+    {
+        if (free_buffers.empty()) return std::vector<T>();
+
+        std::vector<T> buffer = std::move(free_buffers.back());
+        free_buffers.pop_back();
+        return buffer;
+    }
+
+    void give(std::vector<T> &&buffer)
+    {
+        if (free_buffers.size() >= MAX_FREE_BUFFERS) return;
+
+        buffer.clear();
+        free_buffers.push_back(std::move(buffer));
+    }
+};
+
 class SteamCallResults {
-    std::vector<struct Steam_Call_Result> callresults{};
+    // upper bound on erased call results kept around for reuse
+    constexpr static const size_t MAX_FREE_CALLRESULTS = 256;
+
+    using Callresults_Index = std::unordered_map<SteamAPICall_t, std::list<struct Steam_Call_Result>::iterator>;
+
+    // every stored call result in creation order, the list keeps the entries stable when others are added/removed
+    std::list<struct Steam_Call_Result> callresults{};
+    Callresults_Index callresults_index{};
+    // erased call results and index nodes, spliced back in by the next ones so storing a result doesn't allocate
+    std::list<struct Steam_Call_Result> free_callresults{};
+    std::vector<Callresults_Index::node_type> free_index_nodes{};
+    // call results which are due and checked on every run
+    std::vector<SteamAPICall_t> pending{};
+    Call_Result_Timers timers{};
     std::vector<class CCallbackBase *> completed_callbacks{};
     void (*cb_all)(std::vector<char> result, int callback) = nullptr;
 
+    Buffer_Pool<Call_Result_Timers::Timer> timer_buffers{};
+    Buffer_Pool<SteamAPICall_t> api_call_buffers{};
+    Buffer_Pool<char> result_buffers{};
+    Buffer_Pool<class CCallbackBase *> callback_buffers{};
+
+    struct Steam_Call_Result *find(SteamAPICall_t api_call);
+    const struct Steam_Call_Result *find(SteamAPICall_t api_call) const;
+    SteamAPICall_t store(SteamAPICall_t api_call, int iCallback, void *result, unsigned int size, double timeout, bool run_call_completed_cb, bool reserved);
+    void erase(Callresults_Index::iterator it);
+    void schedule_due(const struct Steam_Call_Result &res);
+
 public:
     void addCallCompleted(class CCallbackBase *cb);
 
@@ -90,9 +176,28 @@ public:
     void runCallResults();
 };
 
+// results posted during the current frame, their data is stored back to back in a buffer
+// which keeps its capacity between frames, so posting doesn't allocate once the buffer has grown
 struct Steam_Call_Back {
+    struct Result {
+        size_t offset{};
+        unsigned int size{};
+        size_t hash{};
+    };
+
     std::vector<class CCallbackBase *> callbacks{};
-    std::vector<std::vector<char>> results{};
+    std::vector<char> results_data{};
+    std::vector<struct Result> results{};
+    // open addressing table of (index in 'results' + 1), 0 is an empty slot, its size is always a power of 2
+    std::vector<unsigned int> results_table{};
+
+    const char *result_data(const struct Result &res) const;
+    bool has_result(const void *result, unsigned int size, size_t hash) const;
+    void add_result(const void *result, unsigned int size, size_t hash);
+    void clear_results();
+
+private:
+    void table_insert(unsigned int index);
 };
 
 class SteamCallBacks {
@@ -45,6 +45,7 @@
 
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <set>
 #include <queue>
 #include <list>
@@ -52,6 +53,8 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
+#include <future>
 
 #include <string.h>
 #include <stdio.h>
@@ -119,6 +122,7 @@ static inline void reset_LastError()
     #include <sys/types.h>
     #include <sys/stat.h>
     #include <sys/ioctl.h>
+    #include <sys/epoll.h>
     #include <sys/socket.h>
     #include <sys/mount.h>
     #include <sys/stat.h>
@@ -21,6 +21,8 @@
 #include "base.h"
 
 #define MAX_FILENAME_LENGTH 300
+// suffix of the temporary file a write goes to before it's renamed over the actual file
+#define WRITE_TEMP_SUFFIX ".gse_tmp"
 
 union image_pixel_t {
     uint32_t pixel;
@@ -51,6 +53,7 @@ public:
     static constexpr char leaderboard_storage_folder[] = "leaderboard";
     static constexpr char user_data_storage[]          = "local";
     static constexpr char screenshots_folder[]         = "screenshots";
+    static constexpr char avatars_cache_folder[]       = "avatars";
     static constexpr char game_settings_folder[]       = "steam_settings";
 
     static std::string get_program_path();
@@ -67,11 +70,55 @@ public:
     static const std::string& get_saves_folder_name();
 
 private:
+    struct Indexed_File {
+        std::string name{}; // relative to the indexed folder, as found on disk
+        unsigned int size{};
+        uint64_t timestamp{};
+    };
+
+    // files of a save folder (recursive), built on the first query and kept up to date by our own writes/deletes
+    // so counting, iterating and looking up files doesn't walk the directory every time
+    struct Directory_Index {
+        std::vector<struct Indexed_File> files{};
+        std::unordered_map<std::string, size_t> positions{}; // index_key(name) -> position in 'files'
+    };
+
+    // a write (or delete) which wasn't committed to disk yet, only the latest one per file is kept
+    struct Pending_Write {
+        bool remove{};
+        std::string data{};
+    };
+
     std::string save_directory{};
     std::string appid{}; // game appid
+    std::map<std::string, struct Directory_Index> directory_indexes{}; // full folder path -> index
+
+    // write-behind, files are written by a worker thread so saving doesn't block the caller
+    std::thread writer_thread{};
+    std::mutex writes_mutex{};
+    std::condition_variable writes_cv{};
+    std::condition_variable writes_done_cv{};
+    bool writer_stop{};
+    std::map<std::string, struct Pending_Write> pending_writes{}; // full path -> write
+    std::map<std::string, struct Pending_Write> committing_writes{}; // taken by the worker, being written right now
+    // writes which couldn't be committed, still served to readers and tried again by flush()
+    std::map<std::string, struct Pending_Write> failed_writes{};
+
+    void queue_write(const std::string &full_path, struct Pending_Write &&write);
+    bool get_pending_write(const std::string &full_path, struct Pending_Write &write);
+    void writer_proc();
+
+    std::string get_folder_path(std::string folder) const;
+    struct Directory_Index& get_directory_index(const std::string &folder_path);
+    const struct Indexed_File* find_indexed_file(const std::string &folder_path, const std::string &file);
+    static void index_store(struct Directory_Index &index, const std::string &name, unsigned int size);
+    static void index_remove(struct Directory_Index &index, const std::string &name);
+    void index_file_stored(const std::string &full_path, unsigned int size);
+    void index_file_deleted(const std::string &full_path);
     
 public:
     Local_Storage(const std::string &save_directory);
+    ~Local_Storage();
 
     const std::string& get_current_save_directory() const;
     void setAppId(uint32 appid);
@@ -90,6 +137,9 @@ public:
     std::string get_path(std::string folder);
 
     bool update_save_filenames(std::string folder);
+    // block until every queued write was committed to disk, writes which failed before are tried again
+    // returns false if some of them still couldn't be written
+    bool flush();
 
     bool load_json(const std::string &full_path, nlohmann::json& json);
     bool load_json_file(std::string folder, std::string const& file, nlohmann::json& json);
@@ -97,6 +147,12 @@ public:
 
     std::vector<image_pixel_t> load_image(std::string const& image_path);
     static std::string load_image_resized(std::string const& image_path, std::string const& image_data, int resolution);
+    // decodes a png/jpeg held in memory to RGBA pixels, resized to resolution x resolution
+    static std::string decode_image_resized(std::string const& encoded_image, int resolution);
+    // resizes the RGBA pixels of a width x height image to resolution x resolution
+    static std::string resize_image(std::string const& image_data, int width, int height, int resolution);
+    // png encoding of RGBA pixels, empty on failure
+    static std::string encode_png(std::string const& image_data, int width, int height);
     bool save_screenshot(std::string const& image_path, uint8_t* img_ptr, int32_t width, int32_t height, int32_t channels);
 
     static std::string sanitize_string(std::string name);
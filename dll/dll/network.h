@@ -47,6 +47,23 @@ struct IP_PORT {
     }
 };
 
+// a queued UDP packet, the payload lives in a shared arena at [offset, offset + size)
+struct UDP_Datagram {
+    IP_PORT ip_port{};
+    size_t offset{};
+    size_t size{};
+};
+
+// optional message formats, a peer only gets them once it announced it understands them
+// peers running an older build announce none and keep getting the formats they know
+enum Peer_Features {
+    PEER_FEATURE_SOCKETS_BATCHES = 1 << 0, // several messages in Networking_Sockets.messages
+    PEER_FEATURE_LOBBY_DELTAS = 1 << 1, // Common_Message.lobby_delta
+    PEER_FEATURE_AVATAR_HASHES = 1 << 2, // Friend.avatar_hash and the AVATAR_REQUEST/AVATAR friend messages
+};
+
+#define PEER_FEATURES_SUPPORTED (PEER_FEATURE_SOCKETS_BATCHES | PEER_FEATURE_LOBBY_DELTAS | PEER_FEATURE_AVATAR_HASHES)
+
 struct Network_Callback {
     void (*message_callback)(void *object, Common_Message *msg) = nullptr;
     void *object{};
@@ -71,15 +88,181 @@ enum Callback_Ids {
 };
 
 struct Network_Callback_Container {
+    // all subscribers in registration order, used for broadcast messages (dest_id = 0)
     std::vector<struct Network_Callback> callbacks{};
+    // index of the same subscribers rebuilt on every (un)subscribe, used for targeted messages
+    // subscribers for any steam id, the subscribers of a destination without one of its own
+    std::vector<struct Network_Callback> any_steam_id{};
+    // destination steam id -> its subscribers merged with the ones above, in registration order
+    std::unordered_map<uint64, std::vector<struct Network_Callback>> by_steam_id{};
+};
+
+// size of the tables indexed by Common_Message::messages_case()
+#define NETWORK_MESSAGE_CASES_MAX (Common_Message::kLobbyDelta + 1)
+
+// counters per inbound message type, see Networking::get_message_stats()
+struct Network_Message_Stats {
+    unsigned long long count{};
+    unsigned long long bytes{}; // wire size, messages sent to ourselves are not counted
+    std::chrono::nanoseconds handler_time{};
+};
+
+// byte queue used for TCP framing with consume-offset semantics:
+// consuming from the front only advances an offset, the consumed bytes are reclaimed in a single move
+// once they make up at least half of the storage, so draining a backlog of small frames is linear instead of quadratic
+class TCP_Buffer {
+    std::vector<char> storage{};
+    size_t start = 0; // offset of the first unconsumed byte
+
+public:
+    size_t size() const { return storage.size() - start; }
+    bool empty() const { return storage.size() == start; }
+
+    char *data() { return storage.data() + start; }
+    const char *data() const { return storage.data() + start; }
+
+    // grow the buffer by len bytes and return a pointer to the new (uninitialized) region
+    char *append(size_t len)
+    {
+        if (start && start >= storage.size() / 2) {
+            size_t remaining = size();
+            if (remaining) memmove(storage.data(), storage.data() + start, remaining);
+            storage.resize(remaining);
+            start = 0;
+        }
+
+        size_t old_size = storage.size();
+        storage.resize(old_size + len);
+        return storage.data() + old_size;
+    }
+
+    // give back len trailing bytes obtained from append() which were not filled
+    void unappend(size_t len)
+    {
+        storage.resize(storage.size() - std::min(len, size()));
+    }
+
+    void consume(size_t len)
+    {
+        start += std::min(len, size());
+        if (start == storage.size()) {
+            // keep the capacity around for the next frames
+            storage.clear();
+            start = 0;
+        }
+    }
+
+    void clear()
+    {
+        storage.clear();
+        start = 0;
+    }
 };
 
 struct TCP_Socket {
     sock_t sock = static_cast<sock_t>(~0);
     bool received_data = false;
-    std::vector<char> recv_buffer{};
-    std::vector<char> send_buffer{};
+    TCP_Buffer recv_buffer{};
+    TCP_Buffer send_buffer{};
     std::chrono::high_resolution_clock::time_point last_heartbeat_sent{}, last_heartbeat_received{};
+    double rtt{}; // smoothed heartbeat round trip in seconds, 0 until measured
+};
+
+// counters of the socket I/O done by the networking layer, used to verify how many syscalls each tick costs
+struct Networking_IO_Stats {
+    unsigned long long ticks{};
+    unsigned long long syscalls_total{};
+    unsigned long long syscalls_last_tick{};
+    size_t watched_sockets{};
+    size_t ready_sockets_last_tick{};
+};
+
+// a message handed over from the I/O thread to Networking::Run()
+struct Network_Inbound {
+    enum Types {
+        MESSAGE, // dispatched to the message callbacks
+        USER_STATUS, // dispatched to CALLBACK_ID_USER_STATUS
+        SOURCE_QUERY, // raw source query packet in data, from ip_port
+    };
+
+    Types type = MESSAGE;
+    Common_Message msg{};
+    size_t size{};
+    std::string data{};
+    IP_PORT ip_port{};
+};
+
+// a send request queued by the game threads, executed by the I/O thread
+struct Network_Outbound {
+    enum Targets {
+        TARGET_DEST_ID,
+        TARGET_ALL,
+        TARGET_INDIVIDUALS,
+        TARGET_GAMESERVERS,
+        TARGET_IP_PORT,
+    };
+
+    Targets target = TARGET_DEST_ID;
+    // the serialized message, followed by room for one more dest_id field, see Networking::fan_out()
+    std::vector<char> data{};
+    size_t size{};
+    uint64 dest_id{};
+    bool reliable{};
+    uint32 ip{};
+    uint16 port{};
+    // Peer_Features filter of TARGET_INDIVIDUALS
+    uint32 required_features{};
+    uint32 excluded_features{};
+};
+
+// what the I/O thread last published about a steam id, the game threads read this instead of the connections
+struct Network_Route {
+    uint8 flags{}; // ROUTE_xxx
+    uint32 ip{}; // host byte order, see Networking::getIP()
+    int ping = -1;
+    uint32 peer_features{};
+};
+
+// reliable UDP state of a connection, see Settings::reliable_udp
+// reliable messages are split in sequenced fragments which are resent until acked, with at most
+// RUDP_SEND_WINDOW fragments in flight, the receiver delivers them in order once a message is complete
+// unreliable messages too big for one packet are fragmented too, but never resent
+struct Reliable_UDP_Channel {
+    struct Sent_Fragment {
+        uint32 fragment_index{};
+        uint32 fragment_count{};
+        std::string data{};
+        std::chrono::high_resolution_clock::time_point last_sent{};
+        unsigned sends{};
+    };
+
+    struct Received_Fragment {
+        uint32 fragment_index{};
+        uint32 fragment_count{};
+        std::string data{};
+    };
+
+    struct Partial_Message {
+        std::vector<std::string> fragments{};
+        uint32 received{};
+        std::chrono::high_resolution_clock::time_point started{};
+    };
+
+    uint64 send_next = 1;
+    std::map<uint64, struct Sent_Fragment> unacked{};
+    std::deque<std::pair<uint64, struct Sent_Fragment>> send_queue{}; // sequenced fragments waiting for room in the window
+    double srtt{}; // smoothed round trip time in seconds, 0 until the first sample
+    bool failed = false; // the peer stopped acking, our reliable messages went back to TCP
+
+    uint64 recv_session{};
+    uint64 recv_next = 1;
+    std::map<uint64, struct Received_Fragment> recv_out_of_order{};
+    std::string recv_message{}; // in order fragments of the reliable message being reassembled
+    bool recv_message_started = false; // the first fragment of 'recv_message' was received
+    bool ack_pending = false;
+
+    uint64 unreliable_next = 1;
+    std::map<uint64, struct Partial_Message> unreliable_partial{};
 };
 
 struct Connection {
@@ -91,17 +274,28 @@ struct Connection {
     std::vector<CSteamID> ids{};
     uint32 appid{};
     std::chrono::high_resolution_clock::time_point last_received{};
+    uint64 sequence{}; // creation order, lookups through the indexes return the oldest match like a linear search would
+    bool peer_reliable_udp = false;
+    uint32 peer_features{}; // Peer_Features from its announce
+    std::chrono::high_resolution_clock::time_point tcp_reliable_sent{}; // last reliable message sent over TCP
+    bool tcp_reliable_outgoing = false; // the socket reliable messages currently go through, see reliable_tcp_socket()
+    struct Reliable_UDP_Channel rudp{};
 };
 
 class Networking
 {
     bool enabled = false;
-    bool query_alive{};
+    std::atomic<bool> query_alive{};
     std::chrono::high_resolution_clock::time_point last_run{};
     sock_t query_socket, udp_socket{}, tcp_socket{};
     uint16 udp_port{}, tcp_port{};
     uint32 own_ip{};
-    std::vector<struct Connection> connections{};
+    // list so pointers to a connection stay valid until that connection is erased
+    std::list<struct Connection> connections{};
+    uint64 connections_sequence{};
+    // steam id -> connections having this id, tcp ip (host byte order) -> connections
+    std::unordered_map<uint64, std::vector<struct Connection *>> connections_by_id{};
+    std::unordered_map<uint32, std::vector<struct Connection *>> connections_by_ip{};
 
     std::vector<CSteamID> ids;
     uint32 appid;
@@ -113,25 +307,102 @@ class Networking
 
     struct Network_Callback_Container callbacks[CALLBACK_IDS_MAX];
     std::vector<Common_Message> local_send;
+    std::vector<Common_Message> local_send_processing{};
+
+    // messages received during a run are allocated here and freed all at once at the end of the run,
+    // the arena starts with a preallocated block which grows to the high-water mark so steady traffic doesn't allocate
+    google::protobuf::Arena *message_arena{};
+    std::vector<char> message_arena_block{};
+    // with the I/O thread the messages are handed over to Run() instead, a message in the arena would have to be
+    // deep copied out of it, so they are heap messages reused from one run to the next
+    std::vector<Common_Message *> received_messages{};
+    size_t received_messages_used = 0;
+    Network_Message_Stats message_stats[NETWORK_MESSAGE_CASES_MAX]{};
+    Networking_IO_Stats io_stats{};
+
+    // recvmmsg()/sendmmsg() path, see Settings::batched_udp_io
+    bool batched_udp = false;
+    std::vector<char> udp_recv_arena{};
+    std::vector<char> udp_send_arena{};
+    std::vector<UDP_Datagram> udp_send_queue{};
+    // nesting of begin_udp_batch(), udp_send_queue is flushed when it drops back to 0
+    unsigned int udp_batch_depth = 0;
+    // body of the message being broadcast by fan_out(), serialized once for all the recipients
+    std::vector<char> fan_out_buffer{};
+
+    // see Settings::reliable_udp
+    bool reliable_udp = false;
+    uint64 rudp_session{};
+    std::vector<char> rudp_buffer{};
+
+    // dedicated I/O thread mode, see Settings::networking_io_thread
+    // the I/O thread holds 'mutex' while it touches the sockets and connections,
+    // 'queue_mutex' only guards the handoff queues and the published snapshot so the game threads never wait for socket operations
+    bool io_thread_enabled = false;
+    bool io_thread_stop = false;
+    std::thread io_thread{};
+    // set by the I/O thread itself, 'io_thread' is still being assigned when it starts running
+    std::atomic<std::thread::id> io_thread_id{};
+    std::mutex queue_mutex{};
+    std::condition_variable queue_cv{};
+    std::vector<Network_Inbound> inbound{};
+    std::vector<Network_Outbound> outbound{};
+    // snapshot of the reachable steam ids and of the lookups below published by the I/O thread
+    std::map<uint64, Network_Route> routes{};
+    uint32 routes_own_ip{};
+    Networking_IO_Stats routes_io_stats{};
 
     struct Connection *find_connection(CSteamID id, uint32 appid = 0);
     struct Connection *new_connection(CSteamID id, uint32 appid);
+    void set_connection_tcp_ip_port(struct Connection *conn, IP_PORT ip_port);
+    void remove_connection_id(struct Connection *conn, std::vector<CSteamID>::iterator id);
+    std::list<struct Connection>::iterator erase_connection(std::list<struct Connection>::iterator conn);
 
     bool handle_announce(Common_Message *msg, IP_PORT ip_port);
     bool handle_low_level_udp(Common_Message *msg, IP_PORT ip_port);
-    bool handle_tcp(Common_Message *msg, struct TCP_Socket &socket);
+    bool handle_tcp(Common_Message *msg, struct TCP_Socket &socket, size_t size);
+    void handle_udp_packet(const char *data, int len, IP_PORT ip_port);
+    void queue_udp(IP_PORT ip_port, Common_Message *msg, size_t size);
+    void queue_udp(IP_PORT ip_port, const char *data, size_t size);
+    void flush_udp();
+    void begin_udp_batch();
+    void end_udp_batch();
+    void send_udp_data(IP_PORT ip_port, const char *data, size_t size);
+    bool use_reliable_udp(const struct Connection *conn) const;
+    void send_reliable_udp(struct Connection *conn, const char *data, size_t size, bool reliable);
+    void handle_reliable_udp(Common_Message *msg, IP_PORT ip_port);
+    void deliver_reliable_udp(const std::string &data, IP_PORT ip_port);
+    void run_reliable_udp(struct Connection *conn);
+    void send_reliable_fragment(struct Connection *conn, uint64 sequence, const struct Reliable_UDP_Channel::Sent_Fragment &fragment);
     void send_announce_broadcasts();
 
     bool add_id_connection(struct Connection *connection, CSteamID steam_id);
     void run_callbacks(Callback_Ids id, Common_Message *msg);
     void run_callback_user(CSteamID steam_id, bool online, uint32 appid);
-    void do_callbacks_message(Common_Message *msg);
+    void do_callbacks_message(Common_Message *msg, size_t size = 0);
+    void dispatch_message(Common_Message *msg, size_t size);
+    void handle_query_packet(char *data, int len, IP_PORT ip_port);
+
+    void run_io();
+    Common_Message *new_received_message();
+    void reset_message_arena();
+    void io_thread_proc();
+    bool on_io_thread();
+    bool queue_outbound(Network_Outbound::Targets target, Common_Message *msg, bool reliable, uint32 ip = 0, uint16 port = 0, uint32 required_features = 0, uint32 excluded_features = 0);
+    void run_outbound(Network_Outbound &request);
+    bool fan_out(Common_Message *msg, bool reliable, bool (*accept)(const CSteamID &steam_id), uint32 required_features = 0, uint32 excluded_features = 0);
+    uint64 fan_out_data(char *data, size_t body_size, bool reliable, bool (*accept)(const CSteamID &steam_id), uint32 required_features = 0, uint32 excluded_features = 0);
+    void send_data(struct Connection *conn, const char *data, size_t size, bool reliable);
+    std::vector<struct Connection *> ip_port_connections(uint32 ip);
+    void publish_routes();
+    Network_Route published_route(CSteamID id);
+    void print_message_stats();
 
     Common_Message create_announce(bool request);
 
 
 public:
-    Networking(CSteamID id, uint32 appid, uint16 port, std::set<IP_PORT> *custom_broadcasts, bool disable_sockets);
+    Networking(CSteamID id, uint32 appid, uint16 port, std::set<IP_PORT> *custom_broadcasts, bool disable_sockets, bool batched_udp = false, bool io_thread = false, bool reliable_udp = false);
     ~Networking();
     
     //NOTE: for all functions ips/ports are passed/returned in host byte order
@@ -146,7 +417,8 @@ public:
     bool sendTo(Common_Message *msg, bool reliable, Connection *conn = NULL);
     
     // send to all users whose account type is Individual, no need to call set_dest_id(), this is done automatically
-    bool sendToAllIndividuals(Common_Message *msg, bool reliable);
+    // only the peers which announced every required_features and none of excluded_features get it
+    bool sendToAllIndividuals(Common_Message *msg, bool reliable, uint32 required_features = 0, uint32 excluded_features = 0);
 
     // send to all users whose account type is GameServer, no need to call set_dest_id(), this is done automatically
     bool sendToAllGameservers(Common_Message *msg, bool reliable);
@@ -162,11 +434,19 @@ public:
     void rmCallback(Callback_Ids id, CSteamID steam_id, void (*message_callback)(void *object, Common_Message *msg), void *object);
 
     uint32 getIP(CSteamID id);
+    // round trip to the peer in milliseconds measured with the heartbeats, -1 if unknown
+    int get_ping(CSteamID id);
+    // Peer_Features announced by the peer, every supported one for our own ids, 0 if unknown
+    uint32 get_peer_features(CSteamID id);
     uint32 getOwnIP();
 
     void startQuery(IP_PORT ip_port);
     void shutDownQuery();
     bool isQueryAlive();
+
+    Networking_IO_Stats get_io_stats();
+    // message_case is a value of Common_Message::MessagesCase
+    Network_Message_Stats get_message_stats(int message_case);
 };
 
 #endif // NETWORK_INCLUDE_H
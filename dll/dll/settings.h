@@ -97,7 +97,12 @@ struct Stat_config {
 struct Image_Data {
     uint32 width{};
     uint32 height{};
-    std::string data{};
+    // RGBA pixels, identical images share the same buffer
+    std::shared_ptr<const std::string> data{};
+    uint64 hash{}; // FNV-1a 64 of the pixels
+    // pinned images live as long as the process, the others are evicted least recently used first
+    bool pinned{};
+    std::list<int>::iterator lru{};
 };
 
 struct Controller_Settings {
@@ -212,6 +217,16 @@ private:
     std::set<std::string> supported_languages_set{};
     std::string supported_languages{};
 
+    //images, handles handed to the game through ISteamUtils::GetImageRGBA()
+    std::unordered_map<int, struct Image_Data> images{};
+    std::unordered_map<uint64, std::weak_ptr<const std::string>> image_pixels{}; // pixels hash -> shared buffer
+    std::list<int> unpinned_images{}; // most recently used first
+    size_t unpinned_images_size{};
+    int last_image{};
+
+    std::shared_ptr<const std::string> share_image_pixels(const std::string &data, uint64 hash);
+    void release_image_pixels(struct Image_Data &image);
+
 public:
     //Depots
     std::vector<DepotId_t> depots{};
@@ -221,6 +236,16 @@ public:
 
     //networking
     bool disable_networking = false;
+    // receive/send UDP datagrams in batches with recvmmsg()/sendmmsg(), Linux only
+    bool batched_udp_io = false;
+    // run the sockets on a dedicated thread, Steam_Client::RunCallbacks() only dispatches the received messages
+    bool networking_io_thread = false;
+    // send reliable and oversized messages over UDP (acked, resent and fragmented) instead of TCP, when the peer supports it
+    bool reliable_udp = false;
+    // how long small ISteamNetworkingSockets messages wait for more to be packed with them, 0 sends right away
+    unsigned networking_sockets_nagle_time_us = 0;
+    // periodically write the ISteamNetworkingSockets connection stats to a json file in the saves folder
+    bool networking_sockets_stats_dump = false;
 
     //gameserver source query
     bool disable_source_query = false;
@@ -251,6 +276,9 @@ public:
     // the stat itself is always saved regardless of that flag, only affects the achievement progress
     bool save_only_higher_stat_achievement_progress = true;
 
+    // load the achievements and user stats from a compiled binary snapshot instead of the json files while they don't change
+    bool stats_snapshot = false;
+
     // bypass to make SetAchievement() always return true, prevent some games from breaking
     bool achievement_bypass = false;
 
@@ -262,8 +290,6 @@ public:
     // enable owning Steam Applications IDs (mostly builtin apps + dedicated servers)
     bool enable_builtin_preowned_ids = false;
 
-    std::map<int, struct Image_Data> images{};
-
     //subscribed lobby/group ids
     std::set<uint64> subscribed_groups{};
     std::vector<Group_Clans> subscribed_groups_clans{};
@@ -379,7 +405,14 @@ public:
     std::map<std::string, Stat_config>::const_iterator setStatDefiniton(const std::string &name, const struct Stat_config &stat_config);
 
     //images
-    int add_image(const std::string &data, uint32 width, uint32 height);
+    // size of the pixels kept for unpinned images before the least recently used ones are evicted
+    static constexpr size_t max_unpinned_images_size = 16 * 1024 * 1024;
+    // returns a new handle, never 0 and never reused
+    int add_image(const std::string &data, uint32 width, uint32 height, bool pinned = true);
+    // replaces the pixels of an image while keeping its handle
+    bool set_image(int handle, const std::string &data);
+    // nullptr if the handle doesn't exist or was evicted
+    const struct Image_Data* get_image(int handle);
 
     // overlay auto accept stuff
     void acceptAnyOverlayInvites(bool value);
@@ -56,7 +56,40 @@ public ISteamFriends
     bool modified{};
     std::vector<Friend> friends{};
 
+    // avatars are identified by the FNV-1a hash of their png encoding, which is also what goes over the network.
+    // the ones fetched by hash are decoded off-thread and written into the images already handed out by add_friend_avatars(),
+    // the local avatar file and the raw avatars of older peers are loaded right away
+    struct Avatar_Images {
+        uint64 hash{};
+        std::string png{};
+        std::string large{}; // 184x184 RGBA
+        std::string medium{}; // 64x64 RGBA
+        std::string small{}; // 32x32 RGBA
+    };
+
+    struct Avatar_Decode {
+        std::vector<uint64> steam_ids{};
+        uint64 hash{}; // expected hash, the decode is dropped if the steam id moved on to another one
+        bool store{}; // received from a peer, write it to the disk cache once verified
+        uint64 sender{}; // the peer it was received from
+        std::future<Avatar_Images> images{};
+    };
+
+    struct Avatar_Request {
+        std::set<uint64> steam_ids{}; // everyone waiting for this avatar
+        std::set<uint64> excluded{}; // peers which sent something else, not asked again
+        std::chrono::high_resolution_clock::time_point last_sent{};
+    };
+
     std::map<uint64, struct Avatar_Numbers> avatars{};
+    std::map<uint64, uint64> avatar_hashes{}; // steam id -> hash of the avatar shown or being fetched
+    std::map<uint64, struct Avatar_Request> avatar_requests{}; // hash -> pending request
+    std::vector<struct Avatar_Decode> avatar_decodes{};
+    // steam ids whose first avatar is still being fetched, GetLargeFriendAvatar() returns -1 for them
+    std::set<uint64> avatars_loading{};
+    // our own avatar, also shown for friends without any
+    Avatar_Images local_avatar{};
+    bool local_avatar_loaded{};
     CSteamID lobby_id{};
 
     std::chrono::high_resolution_clock::time_point last_sent_friends{};
@@ -71,6 +104,16 @@ public ISteamFriends
 
     struct Avatar_Numbers add_friend_avatars(CSteamID id);
 
+    static Avatar_Images load_avatar(std::string file_path, std::string data, bool raw_rgba);
+    static std::string avatar_cache_file(uint64 hash);
+    std::string find_avatar_file();
+    const Avatar_Images& get_local_avatar();
+    void decode_avatar(std::vector<uint64> steam_ids, uint64 hash, std::string data, bool store, uint64 sender);
+    bool request_avatar(uint64 hash, struct Avatar_Request &request);
+    void fetch_avatar(uint64 steam_id, uint64 hash);
+    void install_avatar(struct Avatar_Decode &decode, Avatar_Images &images);
+    void check_avatar_decodes();
+
     static bool ok_friend_flags(int iFriendFlags);
 
     static void steam_friends_callback(void *object, Common_Message *msg);
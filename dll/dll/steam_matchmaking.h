@@ -48,6 +48,28 @@ struct Filter_Values {
 	ELobbyComparison eComparisonType{};
 };
 
+// filters of a RequestLobbyList() call
+struct Lobby_Search {
+    std::vector<struct Filter_Values> filters{};
+    // lowercase key and target value, results are ordered by distance to them, earlier filters first
+    std::vector<std::pair<std::string, int>> near_values{};
+    int slots_available{};
+    int max_results{};
+};
+
+// a lobby value parsed once for the search filters
+struct Lobby_Search_Value {
+    std::string value{};
+    int64 number{};
+    bool is_number{};
+};
+
+// search columns of a lobby, dropped when its data changes and rebuilt by the next search
+struct Lobby_Search_Entry {
+    std::map<std::string, Lobby_Search_Value> values{}; // lowercase key
+    uint64 search_id{}; // last search this lobby was evaluated by
+};
+
 struct Chat_Entry {
     std::string message{};
     EChatEntryType type{};
@@ -74,13 +96,17 @@ public ISteamMatchmaking
 
     std::vector<Lobby> lobbies{};
     std::chrono::high_resolution_clock::time_point last_sent_lobbies{};
+    std::chrono::high_resolution_clock::time_point last_full_lobbies{};
+    // last state of each owned lobby sent to the other peers, the deltas are made against it
+    std::map<uint64, Lobby> replicated_lobbies{};
     std::vector<struct Pending_Joins> pending_joins{};
     std::vector<struct Pending_Creates> pending_creates{};
 
-    std::vector<struct Filter_Values> filter_values{};
-    int filter_max_results{};
-    std::vector<struct Filter_Values> filter_values_copy{};
-    int filter_max_results_copy{};
+    struct Lobby_Search search_filters{}; // being set up by the AddRequestLobbyList*() calls
+    struct Lobby_Search active_search{};
+    uint64 active_search_id{};
+    std::unordered_map<uint64, struct Lobby_Search_Entry> lobby_search_index{};
+    std::vector<uint64> search_matches{}; // in the order they were found
     std::vector<CSteamID> filtered_lobbies{};
     std::chrono::high_resolution_clock::time_point lobby_last_search{};
     SteamAPICall_t search_call_api_id{};
@@ -98,7 +124,21 @@ public ISteamMatchmaking
     static bool leave_lobby(Lobby *lobby, CSteamID id);
 
     Lobby *get_lobby(CSteamID id);
-    void send_lobby_data();
+
+    // must be called whenever the values of a lobby change
+    void lobby_search_invalidate(uint64 room_id);
+    struct Lobby_Search_Entry &lobby_search_entry(const Lobby &lobby);
+    bool lobby_search_usable(const Lobby &lobby) const;
+    bool lobby_search_matches(const Lobby_Search_Entry &entry) const;
+    void lobby_search_run();
+    void lobby_search_finish();
+    static Lobby_Delta *make_lobby_delta(const Lobby &from, const Lobby &to);
+    static void apply_lobby_delta(Lobby *lobby, const Lobby_Delta &delta);
+    // sends what changed in an owned lobby, or all of it for a full snapshot / when dest is set (to that peer only)
+    void send_lobby_update(Lobby *lobby, bool full_snapshot, CSteamID dest = k_steamIDNil);
+    void send_full_lobby_to_legacy_peers(Lobby *lobby);
+    void send_lobby_data(bool full_snapshot);
+    void on_lobby_state(Lobby *new_lobby);
 
     void trigger_lobby_dataupdate(CSteamID lobby, CSteamID member, bool success, double cb_timeout=0.005, bool send_changed_lobby=true);
     void trigger_lobby_member_join_leave(CSteamID lobby, CSteamID member, bool leaving, bool success, double cb_timeout=0.0);
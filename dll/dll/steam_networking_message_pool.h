@@ -0,0 +1,55 @@
+/* Copyright (C) 2019 Mr Goldberg
+   This file is part of the Goldberg Emulator
+
+   The Goldberg Emulator is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   The Goldberg Emulator is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the Goldberg Emulator; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#ifndef __INCLUDED_STEAM_NETWORKING_MESSAGE_POOL_H__
+#define __INCLUDED_STEAM_NETWORKING_MESSAGE_POOL_H__
+
+#include "base.h"
+
+// every SteamNetworkingMessage_t handed to the game comes from here
+// released messages go back to a free list instead of being deleted, and the payload
+// is a std::string owned by the message so received data can be swapped in without a copy
+class Steam_Networking_Message_Pool {
+    struct Pooled_Message : public SteamNetworkingMessage_t {
+        std::string payload{};
+        Pooled_Message *next_free{};
+    };
+
+    // upper bound on idle messages kept around
+    static constexpr size_t MAX_FREE_MESSAGES = 1024;
+    // payload buffers above this size are dropped instead of being kept for reuse
+    static constexpr size_t MAX_KEPT_PAYLOAD = 64 * 1024;
+
+    // Release() may be called from any thread, this is a leaf lock
+    static std::mutex free_mutex;
+    static Pooled_Message *free_list;
+    static size_t free_count;
+
+    static Pooled_Message *take();
+    static void free_payload(SteamNetworkingMessage_t *pMsg);
+    static void release_message(SteamNetworkingMessage_t *pMsg);
+
+public:
+    // zeroed message, with an owned payload buffer of cbAllocateBuffer bytes when non zero
+    static SteamNetworkingMessage_t *allocate(int cbAllocateBuffer);
+    // zeroed message that takes over the buffer of payload, payload is left empty
+    static SteamNetworkingMessage_t *allocate(std::string &payload);
+    // moves the payload of a message into data, copies only when the buffer isn't one of ours
+    static void take_payload(SteamNetworkingMessage_t *pMsg, std::string &data);
+};
+
+#endif // __INCLUDED_STEAM_NETWORKING_MESSAGE_POOL_H__
@@ -19,6 +19,7 @@
 #define __INCLUDED_STEAM_NETWORKING_MESSAGES_H__
 
 #include "base.h"
+#include "steam_networking_message_pool.h"
 
 struct Steam_Message_Connection {
     SteamNetworkingIdentity remote_identity{};
@@ -49,8 +50,6 @@ public ISteamNetworkingMessages
     unsigned id_counter = 0;
     std::chrono::steady_clock::time_point created{};
     
-    static void free_steam_message_data(SteamNetworkingMessage_t *pMsg);
-    static void delete_steam_message(SteamNetworkingMessage_t *pMsg);
 
     static void steam_callback(void *object, Common_Message *msg);
     static void steam_run_every_runcb(void *object);
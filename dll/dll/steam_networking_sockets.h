@@ -19,6 +19,7 @@
 #define __INCLUDED_STEAM_NETWORKING_SOCKETS_H__
 
 #include "base.h"
+#include "steam_networking_message_pool.h"
 
 struct Listen_Socket {
     HSteamListenSocket socket_id{};
@@ -38,13 +39,72 @@ enum connect_socket_status {
     CONNECT_SOCKET_TIMEDOUT
 };
 
-struct Connect_Socket {
+struct Outgoing_Socket_Message {
+    std::string data{};
+    uint64 message_number{};
+    uint16 lane{};
+    bool reliable{};
+    // weighted fair queueing finish tag, lanes with the same priority are served by the smallest one
+    double finish{};
+};
+
+struct Connection_Lane {
+    int priority{}; // lower goes first
+    uint16 weight = 1;
+    double last_finish{};
+    std::deque<Outgoing_Socket_Message> queue{};
+};
+
+// traffic counters of a connection, the rates are recomputed about once per second by RunCallbacks()
+struct Connection_Telemetry {
+    unsigned long long packets_out{}, bytes_out{}, messages_out{};
+    unsigned long long packets_in{}, bytes_in{}, messages_in{};
+
+    // totals at the start of the current rate window
+    unsigned long long window_packets_out{}, window_bytes_out{};
+    unsigned long long window_packets_in{}, window_bytes_in{};
+    std::chrono::steady_clock::time_point window_start{};
+
+    float out_packets_per_sec{}, out_bytes_per_sec{};
+    float in_packets_per_sec{}, in_bytes_per_sec{};
+};
+
+// received messages of a connection: each lane is read in message number order, but lanes
+// come out in the order their messages arrived so a higher priority lane isn't held back
+// behind older messages of the others
+struct Received_Messages {
     struct compare_snm_for_queue {
-        bool operator()(const Networking_Sockets &left, const Networking_Sockets &right) {
-            return left.message_number() > right.message_number();
+        bool operator()(const SteamNetworkingMessage_t *left, const SteamNetworkingMessage_t *right) {
+            return left->m_nMessageNumber > right->m_nMessageNumber;
         }
     };
 
+    std::vector<std::priority_queue<SteamNetworkingMessage_t *, std::vector<SteamNetworkingMessage_t *>, compare_snm_for_queue>> lanes{};
+    // lane of every message, in arrival order
+    std::deque<uint16> order{};
+
+    bool empty() const { return order.empty(); }
+    size_t size() const { return order.size(); }
+
+    void push(SteamNetworkingMessage_t *pMsg)
+    {
+        uint16 lane = static_cast<uint16>(pMsg->m_idxLane);
+        if (lane >= lanes.size()) lanes.resize(lane + 1);
+        lanes[lane].push(pMsg);
+        order.push_back(lane);
+    }
+
+    SteamNetworkingMessage_t *pop()
+    {
+        auto &lane = lanes[order.front()];
+        order.pop_front();
+        SteamNetworkingMessage_t *pMsg = lane.top();
+        lane.pop();
+        return pMsg;
+    }
+};
+
+struct Connect_Socket {
     int virtual_port{};
     int real_port{};
 
@@ -56,20 +116,40 @@ struct Connect_Socket {
     enum connect_socket_status status{};
     int64 user_data{};
 
-    std::priority_queue<Networking_Sockets, std::vector<Networking_Sockets>, compare_snm_for_queue> data{};
+    // pooled messages already holding the received payload, released on close if never read
+    struct Received_Messages data{};
     HSteamNetPollGroup poll_group{};
 
     unsigned long long packet_send_counter{};
     CSteamID created_by{};
 
+    std::vector<Connection_Lane> lanes = std::vector<Connection_Lane>(1);
+    // finish tag of the last message sent, an idle lane restarts from here instead of building up credit
+    double lanes_virtual_time{};
+    // bytes waiting on the lanes, they go out at nagle_deadline unless something flushes them earlier
+    size_t queued_send_size{};
+    bool nagle_pending{};
+    std::chrono::steady_clock::time_point nagle_deadline{};
+
+    struct Connection_Telemetry telemetry{};
+
     std::chrono::steady_clock::time_point connect_request_last_sent{};
     unsigned connect_requests_sent{};
 };
 
+struct Poll_Group {
+    std::list<HSteamNetConnection> connections{};
+    // one entry per message received on a member connection, in arrival order
+    // entries are dropped when their connection leaves the group, an entry whose connection
+    // has nothing left (read directly with ReceiveMessagesOnConnection) is skipped
+    std::deque<std::pair<HSteamNetConnection, struct Connect_Socket *>> ready{};
+};
+
 struct shared_between_client_server {
     std::vector<struct Listen_Socket> listen_sockets{};
     std::map<HSteamNetConnection, struct Connect_Socket> connect_sockets{};
-    std::map<HSteamNetPollGroup, std::list<HSteamNetConnection>> poll_groups{};
+    std::map<HSteamNetPollGroup, struct Poll_Group> poll_groups{};
+    std::chrono::steady_clock::time_point last_stats_dump{};
     unsigned used{};
 };
 
@@ -84,6 +164,7 @@ public ISteamNetworkingSockets009,
 public ISteamNetworkingSockets
 {
     class Settings *settings{};
+    class Local_Storage *local_storage{};
     class Networking *network{};
     class SteamCallResults *callback_results{};
     class SteamCallBacks *callbacks{};
@@ -93,13 +174,34 @@ public ISteamNetworkingSockets
     std::chrono::steady_clock::time_point created{};
 
     static const int SNS_DISABLED_PORT = -1;
+    static const int SNS_MAX_LANES = 255;
+    // messages for the same connection are packed into one frame up to this size, bigger ones go alone
+    static const size_t SNS_FRAME_MAX_SIZE = 8 * 1024;
+    // seconds between refreshes of the connection rates, and between writes of the stats file
+    static constexpr double SNS_TELEMETRY_INTERVAL = 1.0;
+    static constexpr double SNS_STATS_DUMP_INTERVAL = 5.0;
+    static constexpr const char *SNS_STATS_FILE = "networking_sockets_stats.json";
 
     static void steam_callback(void *object, Common_Message *msg);
     static void steam_run_every_runcb(void *object);
 
     SteamNetworkingMessage_t *get_steam_message_connection(HSteamNetConnection hConn);
-    static void free_steam_message_data(SteamNetworkingMessage_t *pMsg);
-    static void delete_steam_message(SteamNetworkingMessage_t *pMsg);
+    SteamNetworkingMessage_t *pop_steam_message(struct Connect_Socket &connect_socket, HSteamNetConnection hConn);
+    void queue_steam_message(struct Connect_Socket &connect_socket, HSteamNetConnection hConn, std::string *data, uint64 message_number, uint16 lane);
+    void queue_steam_messages(struct Connect_Socket &connect_socket, HSteamNetConnection hConn, Networking_Sockets *data);
+    void leave_poll_group(HSteamNetConnection hConn, struct Connect_Socket &connect_socket);
+
+    EResult queue_send_message(HSteamNetConnection hConn, std::string &data, int nSendFlags, uint16 lane, int64 *pOutMessageNumber);
+    bool send_queued_messages(HSteamNetConnection hConn);
+    bool schedule_queued_messages(HSteamNetConnection hConn, bool flush);
+    void send_overdue_messages(std::chrono::steady_clock::time_point now);
+    bool send_data_frame(HSteamNetConnection hConn, struct Connect_Socket &connect_socket, Networking_Sockets *frame, bool reliable);
+
+    void update_telemetry(struct Connect_Socket &connect_socket, std::chrono::steady_clock::time_point now);
+    void get_pending_bytes(const struct Connect_Socket &connect_socket, int lane, int *unreliable, int *reliable);
+    SteamNetworkingMicroseconds get_queue_time(const struct Connect_Socket &connect_socket);
+    int get_ping(const struct Connect_Socket &connect_socket);
+    void dump_stats();
 
     static unsigned long get_socket_id();
 
@@ -119,7 +221,7 @@ public ISteamNetworkingSockets
     void Callback(Common_Message *msg);
 
 public:
-    Steam_Networking_Sockets(class Settings *settings, class Networking *network, class SteamCallResults *callback_results, class SteamCallBacks *callbacks, class RunEveryRunCB *run_every_runcb, shared_between_client_server *sbcs);
+    Steam_Networking_Sockets(class Settings *settings, class Local_Storage *local_storage, class Networking *network, class SteamCallResults *callback_results, class SteamCallBacks *callbacks, class RunEveryRunCB *run_every_runcb, shared_between_client_server *sbcs);
     ~Steam_Networking_Sockets();
 
     shared_between_client_server *get_shared_between_client_server();
@@ -19,6 +19,7 @@
 #define __INCLUDED_STEAM_NETWORKING_UTILS_H__
 
 #include "base.h"
+#include "steam_networking_message_pool.h"
 
 class Steam_Networking_Utils :
 public ISteamNetworkingUtils001,
@@ -47,9 +48,6 @@ public ISteamNetworkingUtils
     which will delay that first access.
     */
 
-    static void free_steam_message_data(SteamNetworkingMessage_t *pMsg);
-    static void delete_steam_message(SteamNetworkingMessage_t *pMsg);
-
     static void steam_callback(void *object, Common_Message *msg);
     static void steam_run_every_runcb(void *object);
 
@@ -71,6 +71,14 @@ public ISteamUserStats
 {
 public:
     static constexpr auto achievements_user_file = "achievements.json";
+    // all the user stats in one file, replaces the old layout of one file per stat in Local_Storage::stats_storage_folder
+    static constexpr auto stats_user_file = "stats.json";
+    // changed stats are written at the latest this many seconds after the first change
+    static constexpr double stats_save_interval = 10.0;
+    // compiled achievements + user stats/achievements, used instead of the json files while they don't change
+    static constexpr auto snapshot_user_file = "stats_snapshot.bin";
+    static constexpr uint32 snapshot_magic = 0x53545347; // "GSTS"
+    static constexpr uint32 snapshot_version = 2;
 
 private:
     template<typename T>
@@ -91,13 +99,64 @@ private:
 
     std::vector<struct Steam_Leaderboard> cached_leaderboards{};
 
-    nlohmann::json defined_achievements{};
+    // achievements.json compiled at load time, the id of an achievement is its index in these arrays
+    // the json data is only used to load the definitions and to load/save the user state
+    struct Achievement_Table {
+        std::vector<std::string> name{}; // as written in achievements.json
+        std::vector<std::string> display_name{};
+        std::vector<std::string> description{};
+        std::vector<std::string> hidden{};
+        std::vector<std::string> icon{};
+        std::vector<std::string> icon_gray{};
+        std::vector<uint8> schema_progress{}; // the schema has a "progress" object
+        std::vector<uint32> progress_min{}; // initial progress from the schema, 0 if it has none
+        std::vector<uint32> progress_max{}; // 0 if the achievement isn't unlocked by a stat
+
+        // user state
+        std::vector<uint8> earned{};
+        std::vector<uint32> earned_time{};
+        std::vector<uint8> has_progress{};
+        std::vector<float> progress{};
+        std::vector<float> max_progress{};
+
+        // lowercase name -> id
+        std::unordered_map<std::string, int> ids{};
+
+        size_t size() const { return name.size(); }
+    };
+
+    Achievement_Table achievements{};
+    // only parsed when it has to be written, when the state came from the snapshot
     nlohmann::json user_achievements{};
+    bool user_achievements_loaded = false;
     std::vector<std::string> sorted_achievement_names{};
     std::map<std::string, int32> stats_cache_int{};
     std::map<std::string, float> stats_cache_float{};
+    // accumulated count and session length of the avgrate stats
+    std::map<std::string, std::pair<float, double>> stats_avgrate_totals{};
+    // stats which have a value to save, the others only hold their default value in the cache
+    std::set<std::string> stats_stored{};
+    bool stats_dirty = false;
+    std::chrono::steady_clock::time_point stats_dirty_since{};
+
+    // hashes of the json files a snapshot was made from, and of the stat definitions of steam_settings
+    struct Snapshot_Sources {
+        uint64 schema{};
+        uint64 achievements{};
+        uint64 stats{};
+        uint64 stat_definitions{};
+
+        bool operator==(const Snapshot_Sources &other) const;
+    };
+    // the snapshot on disk matches the current state
+    bool snapshot_current = false;
+    // hash of the stat definitions at startup, the stats added later by allow_unknown_stats don't count
+    uint64 snapshot_stat_definitions{};
 
     std::map<std::string, std::vector<achievement_trigger>> achievement_stat_trigger{};
+
+    // icon file -> unpinned image handle, loaded again if the image was evicted
+    std::map<std::string, int> achievement_icon_images{};
     
     // triggered when an achievement is unlocked
     // https://partner.steamgames.com/doc/api/ISteamUserStats#StoreStats
@@ -106,10 +165,25 @@ private:
     GameServerStats_Messages::AllStats pending_server_updates{};
 
     void load_achievements_db();
+    void load_user_achievements();
     void load_achievements();
+    nlohmann::json &get_user_achievements();
     void save_achievements();
 
-    nlohmann::detail::iter_impl<nlohmann::json> defined_achievements_find(const std::string &key);
+    void load_stats();
+    bool load_legacy_stat(const std::string &stat_name, GameServerStats_Messages::StatInfo::Stat_Type type);
+    void mark_stat_changed(const std::string &stat_name);
+    void save_stats();
+
+    // steam_user_stats_snapshot.cpp
+    Snapshot_Sources get_snapshot_sources();
+    bool load_snapshot();
+    void save_snapshot();
+
+    // id of the achievement, or -1 if it isn't defined
+    int find_achievement(const std::string &name) const;
+    // copies the state of the achievement to user_achievements and returns its json entry
+    nlohmann::json &update_user_achievement(int id);
     std::string get_value_for_language(const nlohmann::json &json, std::string_view key, std::string_view language);
 
     std::vector<Steam_Leaderboard_Entry> load_leaderboard_entries(const std::string &name);
@@ -156,6 +230,10 @@ public:
     Steam_User_Stats(Settings *settings, class Networking *network, Local_Storage *local_storage, class SteamCallResults *callback_results, class SteamCallBacks *callbacks, class RunEveryRunCB *run_every_runcb, Steam_Overlay* overlay);
     ~Steam_User_Stats();
 
+    // write the stats changed since the last save and wait for them to reach the disk, called at shutdown
+    // the stats stay dirty if the write failed
+    void flush_stats();
+
     // Ask the server to send down this user's data and achievements for this game
     STEAM_CALL_BACK( UserStatsReceived_t )
     bool RequestCurrentStats();
@@ -105,6 +105,11 @@ Local_Storage::Local_Storage(const std::string &save_directory)
 
 }
 
+Local_Storage::~Local_Storage()
+{
+
+}
+
 const std::string& Local_Storage::get_current_save_directory() const
 {
     return empty_str;
@@ -175,6 +180,11 @@ bool Local_Storage::update_save_filenames(std::string folder)
     return true;
 }
 
+bool Local_Storage::flush()
+{
+    return true;
+}
+
 bool Local_Storage::load_json(const std::string &full_path, nlohmann::json& json)
 {
     return false;
@@ -200,6 +210,21 @@ std::string Local_Storage::load_image_resized(std::string const& image_path, std
     return empty_str;
 }
 
+std::string Local_Storage::decode_image_resized(std::string const& encoded_image, int resolution)
+{
+    return empty_str;
+}
+
+std::string Local_Storage::resize_image(std::string const& image_data, int width, int height, int resolution)
+{
+    return empty_str;
+}
+
+std::string Local_Storage::encode_png(std::string const& image_data, int width, int height)
+{
+    return empty_str;
+}
+
 bool Local_Storage::save_screenshot(std::string const& image_path, uint8_t* img_ptr, int32_t width, int32_t height, int32_t channels)
 {
     return false;
@@ -424,11 +449,22 @@ static std::vector<struct File_Data> get_filenames_recursive(std::string base_pa
     {
         if (strcmp(dp->d_name, ".") != 0 && strcmp(dp->d_name, "..") != 0)
         {
-            if (dp->d_type == DT_REG) {
+            unsigned char d_type = dp->d_type;
+            if (d_type == DT_UNKNOWN || d_type == DT_LNK) {
+                // some filesystems don't fill d_type, also count symlinks to files like stat() based lookups do
+                struct stat sb{};
+                std::string entry_path(base_path + "/" + dp->d_name);
+                if (stat(entry_path.c_str(), &sb) == 0) {
+                    if (S_ISREG(sb.st_mode)) d_type = DT_REG;
+                    else if (S_ISDIR(sb.st_mode) && d_type == DT_UNKNOWN) d_type = DT_DIR;
+                }
+            }
+
+            if (d_type == DT_REG) {
                 File_Data f;
                 f.name = dp->d_name;
                 output.push_back(f);
-            } else if (dp->d_type == DT_DIR) {
+            } else if (d_type == DT_DIR) {
                 // Construct new path from our base path
                 std::string dir_name(dp->d_name);
 
@@ -450,6 +486,41 @@ static std::vector<struct File_Data> get_filenames_recursive(std::string base_pa
 
 #endif 
 
+// write to a temporary file then rename it over the destination, so a crash mid write never leaves a truncated file
+static int write_file_atomic(const std::string &full_path, const char *data, unsigned int length)
+{
+    const std::string temp_path(full_path + WRITE_TEMP_SUFFIX);
+    std::ofstream myfile;
+    myfile.open(std::filesystem::u8path(temp_path), std::ios::binary | std::ios::out | std::ios::trunc);
+    if (!myfile.is_open()) return -1;
+    myfile.write(data, length);
+    int position = myfile.tellp();
+    myfile.close();
+    if (myfile.fail()) {
+        std::error_code ec{};
+        std::filesystem::remove(std::filesystem::u8path(temp_path), ec);
+        return -1;
+    }
+
+    std::error_code ec{};
+    std::filesystem::rename(std::filesystem::u8path(temp_path), std::filesystem::u8path(full_path), ec);
+    if (ec) {
+        PRINT_DEBUG("failed to rename '%s': %s", temp_path.c_str(), ec.message().c_str());
+        std::filesystem::remove(std::filesystem::u8path(temp_path), ec);
+        return -1;
+    }
+
+    return position;
+}
+
+static std::string parent_folder(const std::string &full_path)
+{
+    std::string::size_type pos = full_path.rfind(PATH_SEPARATOR);
+    if (pos == std::string::npos) return std::string();
+
+    return full_path.substr(0, pos);
+}
+
 std::string Local_Storage::get_program_path()
 {
     return get_full_program_path();
@@ -537,6 +608,33 @@ static std::string desanitize_file_name(std::string name)
     return name;
 }
 
+// file names are case insensitive on Windows
+static std::string index_key(std::string name)
+{
+#if defined(STEAM_WIN32)
+    std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+#endif
+    return name;
+}
+
+// false if the file doesn't exist or is a directory
+static bool stat_file(const std::string &full_path, unsigned int &size, uint64_t &timestamp)
+{
+#if defined(STEAM_WIN32)
+    struct _stat buffer{};
+    if (_wstat(utf8_decode(full_path).c_str(), &buffer) != 0) return false;
+    if (buffer.st_mode & S_IFDIR) return false;
+#else
+    struct stat buffer{};
+    if (stat(full_path.c_str(), &buffer) != 0) return false;
+    if (S_ISDIR(buffer.st_mode)) return false;
+#endif
+
+    size = static_cast<unsigned int>(buffer.st_size);
+    timestamp = buffer.st_mtime;
+    return true;
+}
+
 Local_Storage::Local_Storage(const std::string &save_directory)
 {
     this->save_directory = save_directory;
@@ -546,6 +644,116 @@ Local_Storage::Local_Storage(const std::string &save_directory)
     }
 }
 
+Local_Storage::~Local_Storage()
+{
+    {
+        std::lock_guard<std::mutex> lock(writes_mutex);
+        writer_stop = true;
+    }
+    writes_cv.notify_all();
+
+    // the worker commits everything still queued before leaving
+    if (writer_thread.joinable()) writer_thread.join();
+
+#ifndef EMU_RELEASE_BUILD
+    for (auto &w : failed_writes) {
+        PRINT_DEBUG("'%s' was never written", w.first.c_str());
+    }
+#endif
+}
+
+void Local_Storage::queue_write(const std::string &full_path, struct Pending_Write &&write)
+{
+    {
+        std::lock_guard<std::mutex> lock(writes_mutex);
+        // a newer write to the same file replaces the queued one
+        pending_writes[full_path] = std::move(write);
+        failed_writes.erase(full_path);
+        if (!writer_thread.joinable()) {
+            writer_thread = std::thread(&Local_Storage::writer_proc, this);
+        }
+    }
+
+    writes_cv.notify_one();
+}
+
+bool Local_Storage::get_pending_write(const std::string &full_path, struct Pending_Write &write)
+{
+    std::lock_guard<std::mutex> lock(writes_mutex);
+    for (auto writes : { &pending_writes, &committing_writes, &failed_writes }) {
+        auto it = writes->find(full_path);
+        if (it != writes->end()) {
+            write = it->second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Local_Storage::writer_proc()
+{
+    std::unique_lock<std::mutex> lock(writes_mutex);
+    while (true) {
+        writes_cv.wait(lock, [this]{ return writer_stop || !pending_writes.empty(); });
+        if (pending_writes.empty()) break;
+
+        // everything queued while the previous batch was written gets coalesced in this one
+        committing_writes.swap(pending_writes);
+        lock.unlock();
+
+        std::vector<std::string> failed{};
+        for (auto &w : committing_writes) {
+            const std::string &full_path = w.first;
+            if (w.second.remove) {
+#if defined(STEAM_WIN32)
+                _wremove(utf8_decode(full_path).c_str());
+#else
+                remove(full_path.c_str());
+#endif
+            } else {
+                create_directory(parent_folder(full_path));
+                if (write_file_atomic(full_path, w.second.data.data(), static_cast<unsigned int>(w.second.data.size())) < 0) {
+                    PRINT_DEBUG("failed to write '%s'", full_path.c_str());
+                    failed.push_back(full_path);
+                }
+            }
+        }
+
+        lock.lock();
+        // keep the data of the failed writes unless a newer write was queued meanwhile,
+        // the index already describes these files and reads must keep finding them
+        for (auto &full_path : failed) {
+            if (pending_writes.count(full_path)) continue;
+
+            failed_writes[full_path] = std::move(committing_writes[full_path]);
+        }
+        committing_writes.clear();
+        writes_done_cv.notify_all();
+    }
+
+    reset_LastError();
+}
+
+bool Local_Storage::flush()
+{
+    std::unique_lock<std::mutex> lock(writes_mutex);
+    if (failed_writes.size()) {
+        for (auto &w : failed_writes) {
+            pending_writes.emplace(w.first, std::move(w.second));
+        }
+        failed_writes.clear();
+
+        if (!writer_thread.joinable()) {
+            writer_thread = std::thread(&Local_Storage::writer_proc, this);
+        }
+        writes_cv.notify_one();
+    }
+
+    writes_done_cv.wait(lock, [this]{ return pending_writes.empty() && committing_writes.empty(); });
+    return failed_writes.empty();
+}
+
 const std::string& Local_Storage::get_current_save_directory() const
 {
     return this->save_directory;
@@ -573,13 +781,7 @@ int Local_Storage::store_file_data(std::string folder, std::string file, const c
     }
 
     create_directory(folder + file_folder);
-    std::ofstream myfile;
-    myfile.open(std::filesystem::u8path(folder + file), std::ios::binary | std::ios::out);
-    if (!myfile.is_open()) return -1;
-    myfile.write(data, length);
-    int position = myfile.tellp();
-    myfile.close();
-    return position;
+    return write_file_atomic(folder + file, data, length);
 }
 
 std::string Local_Storage::get_path(std::string folder)
@@ -589,6 +791,117 @@ std::string Local_Storage::get_path(std::string folder)
     return path;
 }
 
+std::string Local_Storage::get_folder_path(std::string folder) const
+{
+    if (folder.size() && folder.back() != *PATH_SEPARATOR) {
+        folder.append(PATH_SEPARATOR);
+    }
+
+    return save_directory + appid + folder;
+}
+
+struct Local_Storage::Directory_Index& Local_Storage::get_directory_index(const std::string &folder_path)
+{
+    auto it = directory_indexes.find(folder_path);
+    if (it != directory_indexes.end()) return it->second;
+
+    struct Directory_Index &index = directory_indexes[folder_path];
+    std::vector<struct File_Data> files = get_filenames_recursive(folder_path);
+    index.files.reserve(files.size());
+    const std::string temp_suffix(WRITE_TEMP_SUFFIX);
+    for (auto &f : files) {
+        if (f.name.size() >= temp_suffix.size() && f.name.compare(f.name.size() - temp_suffix.size(), temp_suffix.size(), temp_suffix) == 0) continue;
+
+        struct Indexed_File entry{};
+        entry.name = std::move(f.name);
+        stat_file(folder_path + entry.name, entry.size, entry.timestamp);
+        index.positions[index_key(entry.name)] = index.files.size();
+        index.files.push_back(std::move(entry));
+    }
+
+    // writes which aren't on disk yet are already part of the folder, oldest first so the latest one wins
+    {
+        std::lock_guard<std::mutex> lock(writes_mutex);
+        for (auto writes : { &failed_writes, &committing_writes, &pending_writes }) {
+            for (auto &w : *writes) {
+                const std::string &full_path = w.first;
+                if (full_path.size() <= folder_path.size() || full_path.compare(0, folder_path.size(), folder_path) != 0) continue;
+
+                if (w.second.remove) {
+                    index_remove(index, full_path.substr(folder_path.size()));
+                } else {
+                    index_store(index, full_path.substr(folder_path.size()), static_cast<unsigned int>(w.second.data.size()));
+                }
+            }
+        }
+    }
+
+    PRINT_DEBUG("indexed '%s' (%zu files)", folder_path.c_str(), index.files.size());
+    return index;
+}
+
+const struct Local_Storage::Indexed_File* Local_Storage::find_indexed_file(const std::string &folder_path, const std::string &file)
+{
+    struct Directory_Index &index = get_directory_index(folder_path);
+    auto it = index.positions.find(index_key(file));
+    if (it == index.positions.end()) return nullptr;
+
+    return &index.files[it->second];
+}
+
+void Local_Storage::index_store(struct Directory_Index &index, const std::string &name, unsigned int size)
+{
+    // the write may not be committed yet, describe the file as it's going to be
+    struct Indexed_File entry{};
+    entry.name = name;
+    entry.size = size;
+    entry.timestamp = static_cast<uint64_t>(std::time(nullptr));
+
+    auto it = index.positions.find(index_key(entry.name));
+    if (it != index.positions.end()) {
+        index.files[it->second].size = entry.size;
+        index.files[it->second].timestamp = entry.timestamp;
+    } else {
+        index.positions[index_key(entry.name)] = index.files.size();
+        index.files.push_back(std::move(entry));
+    }
+}
+
+void Local_Storage::index_remove(struct Directory_Index &index, const std::string &name)
+{
+    auto it = index.positions.find(index_key(name));
+    if (it == index.positions.end()) return;
+
+    // keep the order of the remaining files, iterate_file() indexes depend on it
+    size_t position = it->second;
+    index.positions.erase(it);
+    index.files.erase(index.files.begin() + position);
+    for (auto &p : index.positions) {
+        if (p.second > position) --p.second;
+    }
+}
+
+void Local_Storage::index_file_stored(const std::string &full_path, unsigned int size)
+{
+    // a file can be part of the index of its folder and of any parent folder which was indexed
+    for (auto &folder : directory_indexes) {
+        const std::string &folder_path = folder.first;
+        if (full_path.size() <= folder_path.size() || full_path.compare(0, folder_path.size(), folder_path) != 0) continue;
+
+        index_store(folder.second, full_path.substr(folder_path.size()), size);
+    }
+}
+
+void Local_Storage::index_file_deleted(const std::string &full_path)
+{
+    for (auto &folder : directory_indexes) {
+        const std::string &folder_path = folder.first;
+        if (full_path.size() <= folder_path.size() || full_path.compare(0, folder_path.size(), folder_path) != 0) continue;
+
+        index_remove(folder.second, full_path.substr(folder_path.size()));
+    }
+}
+
 std::string Local_Storage::get_global_settings_path()
 {
     return save_directory + settings_storage_folder + PATH_SEPARATOR;
@@ -647,7 +960,12 @@ int Local_Storage::store_data(std::string folder, std::string file, char *data,
         folder.append(PATH_SEPARATOR);
     }
 
-    return store_file_data(save_directory + appid + folder, file, data, length);
+    std::string full_path(save_directory + appid + folder + sanitize_file_name(file));
+    struct Pending_Write write{};
+    write.data.assign(data, length);
+    queue_write(full_path, std::move(write));
+    index_file_stored(full_path, length);
+    return static_cast<int>(length);
 }
 
 int Local_Storage::store_data_settings(std::string file, const char *data, unsigned int length)
@@ -676,6 +994,16 @@ int Local_Storage::get_data(std::string folder, std::string file, char *data, un
     }
 
     std::string full_path(save_directory + appid + folder + file);
+    struct Pending_Write write{};
+    if (get_pending_write(full_path, write)) {
+        if (write.remove) return -1;
+        if (offset >= write.data.size()) return 0;
+
+        unsigned int read = std::min(max_length, static_cast<unsigned int>(write.data.size() - offset));
+        memcpy(data, write.data.data() + offset, read);
+        return static_cast<int>(read);
+    }
+
     return get_file_data(full_path, data, max_length, offset);
 }
 
@@ -695,33 +1023,20 @@ int Local_Storage::get_data_settings(std::string file, char *data, unsigned int
 
 int Local_Storage::count_files(std::string folder)
 {
-    if (folder.size() && folder.back() != *PATH_SEPARATOR) {
-        folder.append(PATH_SEPARATOR);
-    }
-
-    return get_filenames_recursive(save_directory + appid + folder).size();
+    return static_cast<int>(get_directory_index(get_folder_path(folder)).files.size());
 }
 
 bool Local_Storage::file_exists(std::string folder, std::string file)
 {
-    file = sanitize_file_name(file);
-    if (folder.size() && folder.back() != *PATH_SEPARATOR) {
-        folder.append(PATH_SEPARATOR);
-    }
-
-    std::string full_path(save_directory + appid + folder + file);
-    return file_exists_(full_path);
+    return find_indexed_file(get_folder_path(folder), sanitize_file_name(file)) != nullptr;
 }
 
 unsigned int Local_Storage::file_size(std::string folder, std::string file)
 {
-    file = sanitize_file_name(file);
-    if (folder.size() && folder.back() != *PATH_SEPARATOR) {
-        folder.append(PATH_SEPARATOR);
-    }
+    const struct Indexed_File *indexed = find_indexed_file(get_folder_path(folder), sanitize_file_name(file));
+    if (!indexed) return 0;
 
-    std::string full_path(save_directory + appid + folder + file);
-    return file_size_(full_path);
+    return indexed->size;
 }
 
 bool Local_Storage::file_delete(std::string folder, std::string file)
@@ -731,44 +1046,31 @@ bool Local_Storage::file_delete(std::string folder, std::string file)
         folder.append(PATH_SEPARATOR);
     }
 
+    if (!find_indexed_file(save_directory + appid + folder, file)) return false;
+
     std::string full_path(save_directory + appid + folder + file);
-#if defined(STEAM_WIN32)
-    return _wremove(utf8_decode(full_path).c_str()) == 0;
-#else
-    return remove(full_path.c_str()) == 0;
-#endif
+    struct Pending_Write write{};
+    write.remove = true;
+    queue_write(full_path, std::move(write));
+    index_file_deleted(full_path);
+    return true;
 }
 
 uint64_t Local_Storage::file_timestamp(std::string folder, std::string file)
 {
-    file = sanitize_file_name(file);
-    if (folder.size() && folder.back() != *PATH_SEPARATOR) {
-        folder.append(PATH_SEPARATOR);
-    }
+    const struct Indexed_File *indexed = find_indexed_file(get_folder_path(folder), sanitize_file_name(file));
+    if (!indexed) return 0;
 
-    std::string full_path(save_directory + appid + folder + file);
-
-#if defined(STEAM_WIN32)
-    struct _stat buffer = {};
-    if (_wstat(utf8_decode(full_path).c_str(), &buffer) != 0) return 0;
-#else
-    struct stat buffer = {};
-    if (stat (full_path.c_str(), &buffer) != 0) return 0;
-#endif
-    return buffer.st_mtime;
+    return indexed->timestamp;
 }
 
 bool Local_Storage::iterate_file(std::string folder, int index, char *output_filename, int32 *output_size)
 {
-    if (folder.size() && folder.back() != *PATH_SEPARATOR) {
-        folder.append(PATH_SEPARATOR);
-    }
-
-    std::vector<struct File_Data> files = get_filenames_recursive(save_directory + appid + folder);
+    const std::vector<struct Indexed_File> &files = get_directory_index(get_folder_path(folder)).files;
     if (index < 0 || static_cast<size_t>(index) >= files.size()) return false;
 
     std::string name(desanitize_file_name(files[index].name));
-    if (output_size) *output_size = file_size(folder, name);
+    if (output_size) *output_size = files[index].size;
 #if defined(STEAM_WIN32)
     name = replace_with(name, PATH_SEPARATOR, "/");
 #endif
@@ -778,6 +1080,9 @@ bool Local_Storage::iterate_file(std::string folder, int index, char *output_fil
 
 bool Local_Storage::update_save_filenames(std::string folder)
 {
+    // the files are renamed directly on disk
+    flush();
+
     std::vector<struct File_Data> files = get_filenames_recursive(save_directory + appid + folder);
 
     for (auto &f : files) {
@@ -785,12 +1090,10 @@ bool Local_Storage::update_save_filenames(std::string folder)
         PRINT_DEBUG("remote file '%s'", path.c_str());
         std::string to(sanitize_file_name(desanitize_file_name(path)));
         if (path != to && !file_exists(folder, to)) {
-            //create the folder
-            store_data(folder, to, (char *)"", 0);
-            file_delete(folder, to);
-
             std::string from(save_directory + appid + folder + PATH_SEPARATOR + path);
             to = save_directory + appid + folder + PATH_SEPARATOR + to;
+            //create the folder
+            create_directory(parent_folder(to));
             PRINT_DEBUG("renaming '%s' to '%s'", from.c_str(), to.c_str());
             if (std::rename(from.c_str(), to.c_str()) < 0) {
                 PRINT_DEBUG("ERROR RENAMING");
@@ -798,11 +1101,27 @@ bool Local_Storage::update_save_filenames(std::string folder)
         }
     }
 
+    // files were renamed behind the indexes' back, rebuild them on the next query
+    directory_indexes.clear();
     return true;
 }
 
 bool Local_Storage::load_json(const std::string &full_path, nlohmann::json& json)
 {
+    struct Pending_Write write{};
+    if (get_pending_write(full_path, write)) {
+        if (write.remove) return false;
+
+        try {
+            json = nlohmann::json::parse(write.data);
+            PRINT_DEBUG("Loaded json '%s' from queued write (%zu items)", full_path.c_str(), json.size());
+            return true;
+        } catch (const std::exception& e) {
+            PRINT_DEBUG("Error while parsing '%s' json error: %s", full_path.c_str(), e.what());
+            return false;
+        }
+    }
+
     std::ifstream inventory_file(std::filesystem::u8path(full_path), std::ios::in | std::ios::binary);
     // If there is a file and we opened it
     if (inventory_file) {
@@ -840,18 +1159,18 @@ bool Local_Storage::write_json_file(std::string folder, std::string const&file,
     std::string inv_path(save_directory + appid + folder);
     std::string full_path(inv_path + file);
 
-    create_directory(inv_path);
-
-    std::ofstream inventory_file(std::filesystem::u8path(full_path), std::ios::trunc | std::ios::out | std::ios::binary);
-    if (inventory_file) {
-        inventory_file << std::setw(2) << json;
-        return true;
+    struct Pending_Write write{};
+    try {
+        write.data = json.dump(2);
+    } catch (const std::exception& e) {
+        PRINT_DEBUG("Couldn't serialize json for '%s': %s", full_path.c_str(), e.what());
+        return false;
     }
-    
-    PRINT_DEBUG("Couldn't open file '%s' to write json", full_path.c_str());
 
-    reset_LastError();
-    return false;
+    unsigned int size = static_cast<unsigned int>(write.data.size());
+    queue_write(full_path, std::move(write));
+    index_file_stored(full_path, size);
+    return true;
 }
 
 std::vector<image_pixel_t> Local_Storage::load_image(std::string const& image_path)
@@ -897,6 +1216,55 @@ std::string Local_Storage::load_image_resized(std::string const& image_path, std
     return resized_image;
 }
 
+std::string Local_Storage::decode_image_resized(std::string const& encoded_image, int resolution)
+{
+    std::string resized_image{};
+    if (encoded_image.empty() || encoded_image.size() > INT_MAX) return resized_image;
+
+    int width = 0;
+    int height = 0;
+    unsigned char *img = stbi_load_from_memory((const stbi_uc *)encoded_image.data(), (int)encoded_image.size(), &width, &height, nullptr, 4);
+    PRINT_DEBUG("stbi_load_from_memory(%zu bytes) -> %s", encoded_image.size(), (img == nullptr ? stbi_failure_reason() : "loaded"));
+    if (img != nullptr) {
+        if (width == resolution && height == resolution) {
+            resized_image = std::string((char*)img, (size_t)width * height * 4);
+        } else {
+            resized_image.resize((size_t)resolution * resolution * 4);
+            stbir_resize_uint8(img, width, height, 0, (unsigned char*)&resized_image[0], resolution, resolution, 0, 4);
+        }
+        stbi_image_free(img);
+    }
+
+    reset_LastError();
+    return resized_image;
+}
+
+std::string Local_Storage::resize_image(std::string const& image_data, int width, int height, int resolution)
+{
+    std::string resized_image{};
+    if (image_data.size() != (size_t)width * height * 4) return resized_image;
+
+    resized_image.resize((size_t)resolution * resolution * 4);
+    stbir_resize_uint8((const unsigned char*)image_data.data(), width, height, 0, (unsigned char*)&resized_image[0], resolution, resolution, 0, 4);
+    return resized_image;
+}
+
+std::string Local_Storage::encode_png(std::string const& image_data, int width, int height)
+{
+    std::string png{};
+    if (image_data.size() != (size_t)width * height * 4) return png;
+
+    auto append = [](void *context, void *data, int size) {
+        static_cast<std::string *>(context)->append(static_cast<const char *>(data), size);
+    };
+    if (stbi_write_png_to_func(append, &png, width, height, 4, image_data.data(), 0) != 1) {
+        png.clear();
+    }
+
+    reset_LastError();
+    return png;
+}
+
 bool Local_Storage::save_screenshot(std::string const& image_path, uint8_t* img_ptr, int32_t width, int32_t height, int32_t channels)
 {
     std::string screenshot_path(save_directory + appid + screenshots_folder + PATH_SEPARATOR); 
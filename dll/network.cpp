@@ -26,9 +26,47 @@ static uint32_t upper_range_ips[MAX_BROADCASTS];
 
 #define BROADCAST_INTERVAL 5.0
 #define HEARTBEAT_TIMEOUT 20.0
+// heartbeats also measure the round trip, so they are sent more often than the timeout needs
+#define HEARTBEAT_INTERVAL 2.0
 #define USER_TIMEOUT 20.0
 
 #define MAX_UDP_SIZE 16384
+#define TCP_RECV_CHUNK_SIZE (64 * 1024)
+// max number of UDP packets received/sent by a single recvmmsg()/sendmmsg()
+#define UDP_BATCH_SIZE 64
+
+// initial and max size of the block backing the received messages arena
+#define MESSAGE_ARENA_BLOCK_SIZE (64 * 1024)
+#define MESSAGE_ARENA_BLOCK_SIZE_MAX (4 * 1024 * 1024)
+
+// max time the I/O thread sleeps between two runs when nothing is queued
+#define IO_THREAD_INTERVAL_MS 5
+
+// reliable UDP, payload bytes per fragment (keeps the packets below the usual MTU), max fragments in flight per connection
+#define RUDP_FRAGMENT_SIZE 1200
+#define RUDP_SEND_WINDOW 256
+#define RUDP_FRAGMENTS_MAX (64 * 1024)
+// resend timeout before the first round trip was measured, and its lower bound
+#define RUDP_RTO_INITIAL 0.2
+#define RUDP_RTO_MIN 0.03
+// number of later fragments which must be acked before a fragment is resent without waiting for the timeout
+#define RUDP_FAST_RESEND_GAP 3
+// incomplete unreliable messages are dropped after this long, or when too many are waiting
+#define RUDP_PARTIAL_TIMEOUT 1.0
+#define RUDP_PARTIAL_MAX 32
+// a fragment sent this many times without an ack means the peer doesn't get our packets, about 20s with the backoff at the initial timeout
+#define RUDP_SENDS_MAX 10
+// fragments waiting for room in the window, reliable messages which don't fit anymore are dropped
+#define RUDP_SEND_QUEUE_MAX RUDP_FRAGMENTS_MAX
+// once reliable messages switch from TCP to reliable UDP, how long after the last one sent over TCP the new ones wait
+// so they can't be handled by the peer before the older ones still travelling on the TCP stream
+#define RUDP_SWITCH_DELAY RUDP_RTO_INITIAL
+
+// flags of Networking::routes
+#define ROUTE_SELF 1
+#define ROUTE_TCP 2
+#define ROUTE_UDP 4
+#define ROUTE_RUDP 8
 
 #if defined(STEAM_WIN32)
 
@@ -224,8 +262,158 @@ static bool disable_nagle(sock_t sock)
     return (setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char *)&set, sizeof(set)) == 0);
 }
 
+// number of socket syscalls issued by the networking layer, see Networking::get_io_stats()
+// incremented by whichever thread runs the sockets, read by the others
+static std::atomic<unsigned long long> io_syscalls{};
+
+static inline void count_syscall(unsigned long long count = 1)
+{
+    io_syscalls.fetch_add(count, std::memory_order_relaxed);
+}
+
+// readiness based socket watcher, only the sockets reported here are touched by Networking::Run()
+// on Linux this is an epoll instance, elsewhere we fall back to select() in chunks of FD_SETSIZE
+class Socket_Poller {
+#if defined(__linux__)
+    int epoll_fd = -1;
+    std::vector<struct epoll_event> events{};
+#endif
+    std::vector<sock_t> watched{};
+    std::vector<sock_t> ready{};
+
+public:
+    void add(sock_t sock)
+    {
+        if (!is_socket_valid(sock)) return;
+        if (std::find(watched.begin(), watched.end(), sock) != watched.end()) return;
+
+#if defined(__linux__)
+        if (epoll_fd < 0) {
+            epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+            count_syscall();
+            if (epoll_fd < 0) {
+                PRINT_DEBUG("epoll_create1 failed %i", errno);
+                return;
+            }
+        }
+
+        struct epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = sock;
+        count_syscall();
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &ev) != 0 && errno != EEXIST) {
+            PRINT_DEBUG("epoll_ctl add failed for socket %i, error %i", sock, errno);
+            return;
+        }
+#endif
+
+        watched.push_back(sock);
+    }
+
+    // must be called before the socket is closed
+    void remove(sock_t sock)
+    {
+        auto it = std::find(watched.begin(), watched.end(), sock);
+        if (it == watched.end()) return;
+
+        watched.erase(it);
+        ready.erase(std::remove(ready.begin(), ready.end(), sock), ready.end());
+#if defined(__linux__)
+        if (epoll_fd >= 0) {
+            struct epoll_event ev{};
+            count_syscall();
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sock, &ev);
+        }
+#endif
+    }
+
+    // collect the sockets which have pending events without blocking
+    size_t wait()
+    {
+        ready.clear();
+        if (watched.empty()) return 0;
+
+#if defined(__linux__)
+        if (epoll_fd < 0) return 0;
+
+        events.resize(watched.size());
+        count_syscall();
+        int count = epoll_wait(epoll_fd, &events[0], static_cast<int>(events.size()), 0);
+        for (int i = 0; i < count; ++i) {
+            ready.push_back(static_cast<sock_t>(events[i].data.fd));
+        }
+#else
+        for (size_t start = 0; start < watched.size(); start += FD_SETSIZE) {
+            size_t end = std::min(watched.size(), start + FD_SETSIZE);
+            fd_set read_set;
+            FD_ZERO(&read_set);
+            sock_t max_sock = 0;
+            for (size_t i = start; i < end; ++i) {
+                FD_SET(watched[i], &read_set);
+                if (watched[i] > max_sock) max_sock = watched[i];
+            }
+
+            struct timeval timeout{};
+            count_syscall();
+            if (select(static_cast<int>(max_sock + 1), &read_set, NULL, NULL, &timeout) <= 0) continue;
+
+            for (size_t i = start; i < end; ++i) {
+                if (FD_ISSET(watched[i], &read_set)) ready.push_back(watched[i]);
+            }
+        }
+#endif
+
+        std::sort(ready.begin(), ready.end());
+        return ready.size();
+    }
+
+    bool is_ready(sock_t sock) const
+    {
+        return std::binary_search(ready.begin(), ready.end(), sock);
+    }
+
+    size_t watched_count() const
+    {
+        return watched.size();
+    }
+
+    void close()
+    {
+        watched.clear();
+        ready.clear();
+#if defined(__linux__)
+        if (epoll_fd >= 0) {
+            ::close(epoll_fd);
+            epoll_fd = -1;
+        }
+#endif
+    }
+};
+
+static Socket_Poller socket_poller{};
+
+#ifndef EMU_RELEASE_BUILD
+// heap blocks allocated by the received messages arena, 0 per run once the arena has grown to the traffic
+static unsigned long long message_arena_heap_allocs = 0;
+
+static void *message_arena_block_alloc(size_t size)
+{
+    ++message_arena_heap_allocs;
+    return ::operator new(size);
+}
+
+static void message_arena_block_dealloc(void *ptr, size_t size)
+{
+    ::operator delete(ptr);
+}
+#endif
+
 static void kill_socket(sock_t sock)
 {
+    if (is_socket_valid(sock)) {
+        socket_poller.remove(sock);
+    }
+
 #if defined(STEAM_WIN32)
     closesocket(sock);
 #else
@@ -299,6 +487,7 @@ static int send_packet_to(sock_t sock, IP_PORT ip_port, char *data, unsigned lon
     addr4->sin_addr.s_addr = ip_port.ip;
     addr4->sin_port = ip_port.port;
 
+    count_syscall();
     return sendto(sock, data, length, 0, (struct sockaddr *)&addr, addrsize);
 }
 
@@ -311,6 +500,7 @@ static int receive_packet(sock_t sock, IP_PORT *ip_port, char *data, unsigned lo
     socklen_t addrlen = sizeof(addr);
 #endif
 
+    count_syscall();
     int ret = recvfrom(sock, (char *) data, max_length, 0, (struct sockaddr *)&addr, &addrlen);
     if (ret >= 0) {
         struct sockaddr_in *addr_in = (struct sockaddr_in *)&addr;
@@ -322,7 +512,97 @@ static int receive_packet(sock_t sock, IP_PORT *ip_port, char *data, unsigned lo
     return -1;
 }
 
-static bool send_broadcasts(sock_t sock, uint16 port, char *data, unsigned long length, std::vector<IP_PORT> *custom_broadcasts)
+// receive up to UDP_BATCH_SIZE packets, each one is stored in its own MAX_UDP_SIZE slot of the arena
+// returns the number of packets received or -1
+static int receive_packet_batch(sock_t sock, char *arena, IP_PORT *ip_ports, int *lengths)
+{
+#if defined(__linux__)
+    struct mmsghdr msgs[UDP_BATCH_SIZE]{};
+    struct iovec iovs[UDP_BATCH_SIZE]{};
+    struct sockaddr_in addrs[UDP_BATCH_SIZE]{};
+
+    for (int i = 0; i < UDP_BATCH_SIZE; ++i) {
+        iovs[i].iov_base = arena + (size_t)i * MAX_UDP_SIZE;
+        iovs[i].iov_len = MAX_UDP_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+    }
+
+    count_syscall();
+    int count = recvmmsg(sock, msgs, UDP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+    for (int i = 0; i < count; ++i) {
+        ip_ports[i].ip = addrs[i].sin_addr.s_addr;
+        ip_ports[i].port = addrs[i].sin_port;
+        lengths[i] = static_cast<int>(msgs[i].msg_len);
+    }
+
+    return count;
+#else
+    int count = 0;
+    while (count < UDP_BATCH_SIZE) {
+        int len = receive_packet(sock, &ip_ports[count], arena + (size_t)count * MAX_UDP_SIZE, MAX_UDP_SIZE);
+        if (len < 0) break;
+        lengths[count++] = len;
+    }
+
+    return count ? count : -1;
+#endif
+}
+
+// send each datagram whose payload is stored inside the arena, using one sendmmsg() per UDP_BATCH_SIZE packets
+static void send_packet_batch(sock_t sock, const std::vector<UDP_Datagram> &datagrams, char *arena)
+{
+#if defined(__linux__)
+    struct mmsghdr msgs[UDP_BATCH_SIZE]{};
+    struct iovec iovs[UDP_BATCH_SIZE]{};
+    struct sockaddr_in addrs[UDP_BATCH_SIZE]{};
+
+    for (size_t start = 0; start < datagrams.size(); start += UDP_BATCH_SIZE) {
+        unsigned int count = static_cast<unsigned int>(std::min(datagrams.size() - start, (size_t)UDP_BATCH_SIZE));
+        for (unsigned int i = 0; i < count; ++i) {
+            const UDP_Datagram &datagram = datagrams[start + i];
+            PRINT_DEBUG("send: %zu %hhu.%hhu.%hhu.%hhu:%hu", datagram.size, ((unsigned char *)&datagram.ip_port.ip)[0], ((unsigned char *)&datagram.ip_port.ip)[1], ((unsigned char *)&datagram.ip_port.ip)[2], ((unsigned char *)&datagram.ip_port.ip)[3], htons(datagram.ip_port.port));
+            addrs[i] = {};
+            addrs[i].sin_family = AF_INET;
+            addrs[i].sin_addr.s_addr = datagram.ip_port.ip;
+            addrs[i].sin_port = datagram.ip_port.port;
+            iovs[i].iov_base = arena + datagram.offset;
+            iovs[i].iov_len = datagram.size;
+            msgs[i] = {};
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &addrs[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        }
+
+        unsigned int sent = 0;
+        while (sent < count) {
+            count_syscall();
+            int ret = sendmmsg(sock, msgs + sent, count - sent, MSG_NOSIGNAL);
+            if (ret > 0) {
+                sent += ret;
+            } else if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                // the send buffer is full, give each remaining packet its own sendto() like the unbatched path
+                for (; sent < count; ++sent) {
+                    const UDP_Datagram &datagram = datagrams[start + sent];
+                    send_packet_to(sock, datagram.ip_port, arena + datagram.offset, static_cast<unsigned long>(datagram.size));
+                }
+            } else {
+                // like a failed sendto(), the packet which couldn't be sent is dropped
+                ++sent;
+            }
+        }
+    }
+#else
+    for (auto &datagram : datagrams) {
+        send_packet_to(sock, datagram.ip_port, arena + datagram.offset, static_cast<unsigned long>(datagram.size));
+    }
+#endif
+}
+
+static bool send_broadcasts(sock_t sock, uint16 port, char *data, unsigned long length, std::vector<IP_PORT> *custom_broadcasts, bool batched)
 {
     static std::chrono::high_resolution_clock::time_point last_get_broadcast_info;
     if (number_broadcasts < 0 || check_timedout(last_get_broadcast_info, 60.0)) {
@@ -341,6 +621,24 @@ static bool send_broadcasts(sock_t sock, uint16 port, char *data, unsigned long
     IP_PORT main_broadcast;
     main_broadcast.ip = INADDR_BROADCAST;
     main_broadcast.port = port;
+
+    if (batched) {
+        std::vector<UDP_Datagram> datagrams{};
+        datagrams.push_back({main_broadcast, 0, length});
+        if (number_broadcasts) {
+            for (int i = 0; i < number_broadcasts; i++) {
+                datagrams.push_back({broadcasts[i], 0, length});
+            }
+
+            for (auto &addr : *custom_broadcasts) {
+                datagrams.push_back({addr, 0, length});
+            }
+        }
+
+        send_packet_batch(sock, datagrams, data);
+        return number_broadcasts != 0;
+    }
+
     int ret = send_packet_to(sock, main_broadcast, data, length);
 
     if (!number_broadcasts)
@@ -411,18 +709,6 @@ static void connect_socket(sock_t sock, IP_PORT ip_port)
     connect(sock, (struct sockaddr *)&addr, addrsize);
 }
 
-unsigned int receive_buffer_amount(sock_t sock)
-{
-#if defined(STEAM_WIN32)
-    unsigned long count = 0;
-    ioctlsocket(sock, FIONREAD, &count);
-#else
-    int count = 0;
-    ioctl(sock, FIONREAD, &count);
-#endif
-
-    return count;
-}
 
 
 static void send_tcp_pending(struct TCP_Socket &socket)
@@ -430,73 +716,121 @@ static void send_tcp_pending(struct TCP_Socket &socket)
     size_t buf_size = socket.send_buffer.size();
     if (buf_size == 0) return;
 
-    int len = send(socket.sock, &(socket.send_buffer[0]), static_cast<int>(buf_size), MSG_NOSIGNAL);
+    count_syscall();
+    int len = send(socket.sock, socket.send_buffer.data(), static_cast<int>(buf_size), MSG_NOSIGNAL);
     if (len <= 0) return;
 
-    socket.send_buffer.erase(socket.send_buffer.begin(), socket.send_buffer.begin() + len);
+    socket.send_buffer.consume(len);
+}
+
+// send an already serialized message
+static void send_data_tcp(struct TCP_Socket &socket, const char *data, uint32 size)
+{
+    char *frame = socket.send_buffer.append(sizeof(uint32) + size);
+    memcpy(frame, &size, sizeof(size));
+    memcpy(frame + sizeof(uint32), data, size);
+
+    send_tcp_pending(socket);
 }
 
 static void send_buffer_tcp(struct TCP_Socket &socket, Common_Message *msg)
 {
-    uint32 size = static_cast<uint32>(msg->ByteSizeLong()), old_size = static_cast<uint32>(socket.send_buffer.size());
-    socket.send_buffer.resize(old_size + sizeof(uint32) + size);
-    memcpy(&(socket.send_buffer[old_size]), &size, sizeof(size));
-    msg->SerializeToArray(&(socket.send_buffer[old_size + sizeof(uint32)]), size);
+    uint32 size = static_cast<uint32>(msg->ByteSizeLong());
+    char *frame = socket.send_buffer.append(sizeof(uint32) + size);
+    memcpy(frame, &size, sizeof(size));
+    msg->SerializeToArray(frame + sizeof(uint32), size);
 
     send_tcp_pending(socket);
 }
 
+// reliable messages keep going through the socket the previous ones used while it is up,
+// moving to the other one once it connects would let them overtake the ones still in flight
+static struct TCP_Socket *reliable_tcp_socket(struct Connection *conn)
+{
+    struct TCP_Socket &current = conn->tcp_reliable_outgoing ? conn->tcp_socket_outgoing : conn->tcp_socket_incoming;
+    if (current.received_data) return &current;
+
+    if (conn->tcp_socket_incoming.received_data) {
+        conn->tcp_reliable_outgoing = false;
+        return &conn->tcp_socket_incoming;
+    }
+
+    if (conn->tcp_socket_outgoing.received_data) {
+        conn->tcp_reliable_outgoing = true;
+        return &conn->tcp_socket_outgoing;
+    }
+
+    return nullptr;
+}
+
 static unsigned long peek_buffer_tcp(struct TCP_Socket &socket)
 {
     uint32 length;
     if (socket.recv_buffer.size() < sizeof(length)) return 0;
 
-    memcpy(&length, &(socket.recv_buffer[0]), sizeof(length));
+    memcpy(&length, socket.recv_buffer.data(), sizeof(length));
     if (sizeof(length) + length > socket.recv_buffer.size()) return 0;
 
     return length;
 }
 
-static bool unbuffer_tcp(struct TCP_Socket &socket, Common_Message *msg)
+// returns the size of the parsed message, or 0 if no complete message is available
+static uint32 unbuffer_tcp(struct TCP_Socket &socket, Common_Message *msg)
 {
     uint32 l = peek_buffer_tcp(socket);
     if (!l) {
-        return false;
+        return 0;
     }
 
-    if (msg->ParseFromArray(&(socket.recv_buffer[sizeof(uint32)]), l)) {
-        socket.recv_buffer.erase(socket.recv_buffer.begin(), socket.recv_buffer.begin() + sizeof(l) + l);
-        return true;
+    if (msg->ParseFromArray(socket.recv_buffer.data() + sizeof(uint32), l)) {
+        socket.recv_buffer.consume(sizeof(l) + l);
+        return l;
     } else {
-        PRINT_DEBUG("BAD TCP DATA %u %zu %zu %hhu", l, socket.recv_buffer.size(), sizeof(uint32), *((char *)&(socket.recv_buffer[sizeof(uint32)])));
+        PRINT_DEBUG("BAD TCP DATA %u %zu %zu %hhu", l, socket.recv_buffer.size(), sizeof(uint32), *(socket.recv_buffer.data() + sizeof(uint32)));
         kill_tcp_socket(socket);
     }
 
-    return false;
+    return 0;
 }
 
+// only called for sockets reported as readable by the poller,
+// reads directly into the buffer instead of asking the socket for the pending amount first
 static bool recv_tcp(struct TCP_Socket &socket)
 {
-    if (is_socket_valid(socket.sock)) {
-        unsigned int size = receive_buffer_amount(socket.sock), old_size = static_cast<uint32>(socket.recv_buffer.size());
-        int len;
-        socket.recv_buffer.resize(old_size + size);
-        if (size > 0) {
-            len = recv(socket.sock, &(socket.recv_buffer[old_size]), size, MSG_NOSIGNAL);
-            socket.received_data = true;
-            return true;
-        }
+    if (!is_socket_valid(socket.sock)) return false;
+
+    bool received = false;
+    while (true) {
+        char *chunk = socket.recv_buffer.append(TCP_RECV_CHUNK_SIZE);
+        count_syscall();
+        int len = recv(socket.sock, chunk, TCP_RECV_CHUNK_SIZE, MSG_NOSIGNAL);
+        socket.recv_buffer.unappend(TCP_RECV_CHUNK_SIZE - (len > 0 ? len : 0));
+        if (len <= 0) break;
+
+        received = true;
+        // a partial read means the kernel buffer was drained
+        if (len < TCP_RECV_CHUNK_SIZE) break;
     }
 
-    return false;
+    if (received) {
+        socket.received_data = true;
+    }
+
+    return received;
+}
+
+static uint64 heartbeat_clock()
+{
+    return static_cast<uint64>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
 }
 
 static void socket_timeouts(struct TCP_Socket &socket, double extra_time)
 {
-    if (check_timedout(socket.last_heartbeat_sent, HEARTBEAT_TIMEOUT / 2.0)) {
+    if (check_timedout(socket.last_heartbeat_sent, HEARTBEAT_INTERVAL)) {
         Common_Message msg;
         msg.set_allocated_low_level(new Low_Level());
         msg.mutable_low_level()->set_type(Low_Level::HEARTBEAT);
+        msg.mutable_low_level()->set_ping_time(heartbeat_clock());
         send_buffer_tcp(socket, &msg);
         socket.last_heartbeat_sent = std::chrono::high_resolution_clock::now();
     }
@@ -540,71 +874,505 @@ std::set<IP_PORT> Networking::resolve_ip(std::string dns)
     return ips;
 }
 
-void Networking::do_callbacks_message(Common_Message *msg)
+struct Message_Case_Dispatch {
+    Callback_Ids callback_id = CALLBACK_IDS_MAX; // CALLBACK_IDS_MAX = handled by the networking layer itself
+    const char *name = "unknown";
+};
+
+// which callback list receives each type of message, indexed by Common_Message::messages_case()
+static const std::vector<Message_Case_Dispatch> message_case_dispatch = []{
+    std::vector<Message_Case_Dispatch> table(NETWORK_MESSAGE_CASES_MAX);
+    table[Common_Message::MESSAGES_NOT_SET] = { CALLBACK_IDS_MAX, "empty" };
+    table[Common_Message::kAnnounce] = { CALLBACK_IDS_MAX, "announce" };
+    table[Common_Message::kLowLevel] = { CALLBACK_IDS_MAX, "low_level" };
+    table[Common_Message::kLobby] = { CALLBACK_ID_LOBBY, "lobby" };
+    table[Common_Message::kLobbyMessages] = { CALLBACK_ID_LOBBY, "lobby_messages" };
+    table[Common_Message::kNetwork] = { CALLBACK_ID_NETWORKING, "network" };
+    table[Common_Message::kGameserver] = { CALLBACK_ID_GAMESERVER, "gameserver" };
+    table[Common_Message::kFriend] = { CALLBACK_ID_FRIEND, "friend_" };
+    table[Common_Message::kAuthTicket] = { CALLBACK_ID_AUTH_TICKET, "auth_ticket" };
+    table[Common_Message::kFriendMessages] = { CALLBACK_ID_FRIEND_MESSAGES, "friend_messages" };
+    table[Common_Message::kNetworkOld] = { CALLBACK_ID_NETWORKING, "network_old" };
+    table[Common_Message::kNetworkingSockets] = { CALLBACK_ID_NETWORKING_SOCKETS, "networking_sockets" };
+    table[Common_Message::kSteamMessages] = { CALLBACK_ID_STEAM_MESSAGES, "steam_messages" };
+    table[Common_Message::kNetworkingMessages] = { CALLBACK_ID_NETWORKING_MESSAGES, "networking_messages" };
+    table[Common_Message::kGameserverStatsMessages] = { CALLBACK_ID_GAMESERVER_STATS, "gameserver_stats_messages" };
+    table[Common_Message::kLeaderboardsMessages] = { CALLBACK_ID_LEADERBOARDS_STATS, "leaderboards_messages" };
+    table[Common_Message::kReliableUdp] = { CALLBACK_IDS_MAX, "reliable_udp" };
+    table[Common_Message::kLobbyDelta] = { CALLBACK_ID_LOBBY, "lobby_delta" };
+    return table;
+}();
+
+void Networking::do_callbacks_message(Common_Message *msg, size_t size)
 {
-    if (msg->has_network() || msg->has_network_old()) {
-        PRINT_DEBUG("has_network");
-        run_callbacks(CALLBACK_ID_NETWORKING, msg);
+    if (io_thread_enabled) {
+        // callbacks belong to the thread running Networking::Run()
+        // both are heap messages, see new_received_message(), so this only swaps their contents' pointers
+        Network_Inbound item{};
+        item.type = Network_Inbound::MESSAGE;
+        item.msg.Swap(msg);
+        item.size = size;
+
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        inbound.push_back(std::move(item));
+        return;
     }
 
-    if (msg->has_lobby()) {
-        PRINT_DEBUG("has_lobby");
-        run_callbacks(CALLBACK_ID_LOBBY, msg);
+    dispatch_message(msg, size);
+}
+
+void Networking::dispatch_message(Common_Message *msg, size_t size)
+{
+    int message_case = static_cast<int>(msg->messages_case());
+    if (message_case < 0 || message_case >= NETWORK_MESSAGE_CASES_MAX) {
+        PRINT_DEBUG("unknown message type %i", message_case);
+        return;
     }
 
-    if (msg->has_lobby_messages()) {
-        PRINT_DEBUG("has_lobby_messages");
-        run_callbacks(CALLBACK_ID_LOBBY, msg);
+    Network_Message_Stats &stats = message_stats[message_case];
+    ++stats.count;
+    stats.bytes += size;
+
+    const Message_Case_Dispatch &dispatch = message_case_dispatch[message_case];
+    if (dispatch.callback_id >= CALLBACK_IDS_MAX) return;
+
+    PRINT_DEBUG("has_%s", dispatch.name);
+    auto handler_start = std::chrono::steady_clock::now();
+    run_callbacks(dispatch.callback_id, msg);
+    stats.handler_time += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - handler_start);
+}
+
+void Networking::print_message_stats()
+{
+#ifndef EMU_RELEASE_BUILD
+    PRINT_DEBUG("IO: %llu ticks, %llu syscalls total, %llu last tick, %zu/%zu sockets ready",
+        io_stats.ticks, io_stats.syscalls_total, io_stats.syscalls_last_tick, io_stats.ready_sockets_last_tick, io_stats.watched_sockets);
+    for (int i = 0; i < NETWORK_MESSAGE_CASES_MAX; ++i) {
+        const Network_Message_Stats &stats = message_stats[i];
+        if (!stats.count) continue;
+
+        PRINT_DEBUG("%s: count %llu, bytes %llu, handler time %.3f ms",
+            message_case_dispatch[i].name, stats.count, stats.bytes,
+            std::chrono::duration<double, std::milli>(stats.handler_time).count());
     }
+#endif
+}
 
-    if (msg->has_gameserver()) {
-        PRINT_DEBUG("has_gameserver");
-        run_callbacks(CALLBACK_ID_GAMESERVER, msg);
+void Networking::handle_udp_packet(const char *data, int len, IP_PORT ip_port)
+{
+    PRINT_DEBUG("recv %i %hhu.%hhu.%hhu.%hhu:%hu", len,
+        ((unsigned char *)&ip_port.ip)[0], ((unsigned char *)&ip_port.ip)[1], ((unsigned char *)&ip_port.ip)[2], ((unsigned char *)&ip_port.ip)[3], htons(ip_port.port));
+    Common_Message &msg = *new_received_message();
+    if (msg.ParseFromArray(data, len)) {
+        if (msg.source_id()) {
+            if (msg.has_announce()) {
+                handle_announce(&msg, ip_port);
+            } else if (msg.has_low_level()) {
+                handle_low_level_udp(&msg, ip_port);
+            } else if (msg.has_reliable_udp()) {
+                handle_reliable_udp(&msg, ip_port);
+            } else {
+                msg.set_source_ip(ntohl(ip_port.ip));
+                msg.set_source_port(ntohs(ip_port.port));
+                do_callbacks_message(&msg, len);
+            }
+        }
     }
+}
 
-    if (msg->has_friend_()) {
-        PRINT_DEBUG("has_friend_");
-        run_callbacks(CALLBACK_ID_FRIEND, msg);
+// the returned message is only valid until the end of the current run
+Common_Message *Networking::new_received_message()
+{
+    if (io_thread_enabled) {
+        if (received_messages_used == received_messages.size()) received_messages.push_back(new Common_Message());
+        return received_messages[received_messages_used++];
     }
 
-    if (msg->has_auth_ticket()) {
-        PRINT_DEBUG("has_auth_ticket");
-        run_callbacks(CALLBACK_ID_AUTH_TICKET, msg);
+    if (!message_arena) reset_message_arena();
+
+    return google::protobuf::Arena::CreateMessage<Common_Message>(message_arena);
+}
+
+void Networking::reset_message_arena()
+{
+    size_t high_water_mark = 0;
+    if (message_arena) {
+        high_water_mark = static_cast<size_t>(message_arena->SpaceAllocated());
+        if (high_water_mark <= message_arena_block.size()) {
+            message_arena->Reset();
+            return;
+        }
+
+        delete message_arena;
+        message_arena = nullptr;
     }
 
-    if (msg->has_friend_messages()) {
-        PRINT_DEBUG("has_friend_messages");
-        run_callbacks(CALLBACK_ID_FRIEND_MESSAGES, msg);
+    size_t block_size = message_arena_block.size() ? message_arena_block.size() : MESSAGE_ARENA_BLOCK_SIZE;
+    while (block_size < high_water_mark && block_size < MESSAGE_ARENA_BLOCK_SIZE_MAX) {
+        block_size *= 2;
     }
 
-    if (msg->has_networking_sockets()) {
-        PRINT_DEBUG("has_networking_sockets");
-        run_callbacks(CALLBACK_ID_NETWORKING_SOCKETS, msg);
+    PRINT_DEBUG("received messages arena block: %zu bytes", block_size);
+    message_arena_block.resize(block_size);
+
+    google::protobuf::ArenaOptions options{};
+    options.initial_block = &message_arena_block[0];
+    options.initial_block_size = message_arena_block.size();
+#ifndef EMU_RELEASE_BUILD
+    options.block_alloc = &message_arena_block_alloc;
+    options.block_dealloc = &message_arena_block_dealloc;
+#endif
+    message_arena = new google::protobuf::Arena(options);
+}
+
+// serialize the message into the send arena, the packet is sent by the next flush_udp()
+void Networking::queue_udp(IP_PORT ip_port, Common_Message *msg, size_t size)
+{
+    UDP_Datagram datagram{};
+    datagram.ip_port = ip_port;
+    datagram.offset = udp_send_arena.size();
+    datagram.size = size;
+
+    udp_send_arena.resize(datagram.offset + size);
+    msg->SerializeToArray(&udp_send_arena[datagram.offset], static_cast<int>(size));
+    udp_send_queue.push_back(datagram);
+
+    if (udp_send_queue.size() >= UDP_BATCH_SIZE) {
+        flush_udp();
     }
+}
 
-    if (msg->has_steam_messages()) {
-        PRINT_DEBUG("has_steam_messages");
-        run_callbacks(CALLBACK_ID_STEAM_MESSAGES, msg);
+void Networking::queue_udp(IP_PORT ip_port, const char *data, size_t size)
+{
+    UDP_Datagram datagram{};
+    datagram.ip_port = ip_port;
+    datagram.offset = udp_send_arena.size();
+    datagram.size = size;
+
+    udp_send_arena.insert(udp_send_arena.end(), data, data + size);
+    udp_send_queue.push_back(datagram);
+
+    if (udp_send_queue.size() >= UDP_BATCH_SIZE) {
+        flush_udp();
     }
+}
+
+void Networking::flush_udp()
+{
+    if (udp_send_queue.empty()) return;
+
+    send_packet_batch(udp_socket, udp_send_queue, &udp_send_arena[0]);
+    udp_send_queue.clear();
+    udp_send_arena.clear();
+}
 
-    if (msg->has_networking_messages()) {
-        PRINT_DEBUG("has_networking_messages");
-        run_callbacks(CALLBACK_ID_NETWORKING_MESSAGES, msg);
+// the packets queued between the outermost begin and end are sent together, so a send made
+// outside of Run() goes out before the call returns instead of waiting for the next Run()
+void Networking::begin_udp_batch()
+{
+    ++udp_batch_depth;
+}
+
+void Networking::end_udp_batch()
+{
+    if (--udp_batch_depth == 0) flush_udp();
+}
+
+void Networking::send_udp_data(IP_PORT ip_port, const char *data, size_t size)
+{
+    if (batched_udp) {
+        queue_udp(ip_port, data, size);
+    } else {
+        send_packet_to(udp_socket, ip_port, (char *)data, static_cast<unsigned long>(size));
     }
+}
+
+bool Networking::use_reliable_udp(const struct Connection *conn) const
+{
+    return reliable_udp && conn->peer_reliable_udp && conn->udp_pinged && !conn->rudp.failed;
+}
 
-    if (msg->has_gameserver_stats_messages()) {
-        PRINT_DEBUG("has_gameserver_stats");
-        run_callbacks(CALLBACK_ID_GAMESERVER_STATS, msg);
+// 'data' is a serialized Common_Message
+void Networking::send_reliable_udp(struct Connection *conn, const char *data, size_t size, bool reliable)
+{
+    struct Reliable_UDP_Channel &channel = conn->rudp;
+    uint32 fragment_count = static_cast<uint32>((size + RUDP_FRAGMENT_SIZE - 1) / RUDP_FRAGMENT_SIZE);
+    if (!fragment_count) fragment_count = 1;
+    if (fragment_count > RUDP_FRAGMENTS_MAX) {
+        PRINT_DEBUG("message too big for reliable UDP: %zu bytes", size);
+        return;
     }
-    
-    if (msg->has_leaderboards_messages()) {
-        PRINT_DEBUG("has_leaderboards_messages");
-        run_callbacks(CALLBACK_ID_LEADERBOARDS_STATS, msg);
+
+    if (reliable) {
+        if (channel.send_queue.size() + fragment_count > RUDP_SEND_QUEUE_MAX) {
+            PRINT_DEBUG("reliable UDP send queue full, dropping a message of %zu bytes", size);
+            return;
+        }
+
+        for (uint32 i = 0; i < fragment_count; ++i) {
+            size_t offset = static_cast<size_t>(i) * RUDP_FRAGMENT_SIZE;
+            struct Reliable_UDP_Channel::Sent_Fragment fragment{};
+            fragment.fragment_index = i;
+            fragment.fragment_count = fragment_count;
+            fragment.data.assign(data + offset, std::min<size_t>(RUDP_FRAGMENT_SIZE, size - offset));
+            channel.send_queue.emplace_back(channel.send_next++, std::move(fragment));
+        }
+
+        // send what fits in the window right away, the rest goes out as acks come back
+        run_reliable_udp(conn);
+        return;
+    }
+
+    Common_Message packet_msg{};
+    packet_msg.set_source_id(ids[0].ConvertToUint64());
+    Reliable_UDP *fragment = packet_msg.mutable_reliable_udp();
+    fragment->set_type(Reliable_UDP::DATA);
+    fragment->set_session(rudp_session);
+    fragment->set_sequence(channel.unreliable_next++);
+    fragment->set_fragment_count(fragment_count);
+    for (uint32 i = 0; i < fragment_count; ++i) {
+        size_t offset = static_cast<size_t>(i) * RUDP_FRAGMENT_SIZE;
+        fragment->set_fragment_index(i);
+        fragment->set_data(data + offset, std::min<size_t>(RUDP_FRAGMENT_SIZE, size - offset));
+        std::string packet(packet_msg.SerializeAsString());
+        send_udp_data(conn->udp_ip_port, packet.data(), packet.size());
     }
-    
 }
 
-bool Networking::handle_tcp(Common_Message *msg, struct TCP_Socket &socket)
+// the packet is built on each send so it carries the current start of the window
+void Networking::send_reliable_fragment(struct Connection *conn, uint64 sequence, const struct Reliable_UDP_Channel::Sent_Fragment &fragment)
+{
+    const struct Reliable_UDP_Channel &channel = conn->rudp;
+    Common_Message msg{};
+    msg.set_source_id(ids[0].ConvertToUint64());
+    Reliable_UDP *packet = msg.mutable_reliable_udp();
+    packet->set_type(Reliable_UDP::DATA);
+    packet->set_session(rudp_session);
+    packet->set_reliable(true);
+    packet->set_sequence(sequence);
+    packet->set_window_start(channel.unacked.empty() ? sequence : std::min(sequence, channel.unacked.begin()->first));
+    packet->set_fragment_index(fragment.fragment_index);
+    packet->set_fragment_count(fragment.fragment_count);
+    packet->set_data(fragment.data);
+
+    size_t size = msg.ByteSizeLong();
+    rudp_buffer.resize(size);
+    msg.SerializeToArray(&rudp_buffer[0], static_cast<int>(size));
+    send_udp_data(conn->udp_ip_port, &rudp_buffer[0], size);
+}
+
+void Networking::deliver_reliable_udp(const std::string &data, IP_PORT ip_port)
+{
+    Common_Message &msg = *new_received_message();
+    if (!msg.ParseFromString(data) || !msg.source_id()) {
+        PRINT_DEBUG("bad reliable UDP message, %zu bytes", data.size());
+        return;
+    }
+
+    msg.set_source_ip(ntohl(ip_port.ip));
+    msg.set_source_port(ntohs(ip_port.port));
+    do_callbacks_message(&msg, data.size());
+}
+
+void Networking::handle_reliable_udp(Common_Message *msg, IP_PORT ip_port)
+{
+    struct Connection *conn = find_connection((uint64)msg->source_id(), this->appid);
+    if (!conn) conn = find_connection((uint64)msg->source_id());
+    if (!conn || !reliable_udp) return;
+
+    conn->last_received = std::chrono::high_resolution_clock::now();
+    struct Reliable_UDP_Channel &channel = conn->rudp;
+    const Reliable_UDP &packet = msg->reliable_udp();
+    if (packet.type() == Reliable_UDP::ACK) {
+        if (packet.session() != rudp_session) return; // acks data sent before we restarted
+
+        auto now = std::chrono::high_resolution_clock::now();
+        auto acked = [&channel, &now](std::map<uint64, struct Reliable_UDP_Channel::Sent_Fragment>::iterator it) {
+            // Karn's algorithm, resent fragments don't give a usable round trip sample
+            if (it->second.sends == 1) {
+                double sample = std::chrono::duration_cast<std::chrono::duration<double>>(now - it->second.last_sent).count();
+                channel.srtt = channel.srtt > 0 ? (channel.srtt * 7 + sample) / 8 : sample;
+            }
+
+            return channel.unacked.erase(it);
+        };
+
+        auto it = channel.unacked.begin();
+        while (it != channel.unacked.end() && it->first < packet.ack()) it = acked(it);
+        uint64 highest_acked = 0;
+        for (unsigned i = 0; i < 64; ++i) {
+            if (!(packet.ack_bits() & (1ULL << i))) continue;
+            highest_acked = packet.ack() + 1 + i;
+            auto sent = channel.unacked.find(highest_acked);
+            if (sent != channel.unacked.end()) acked(sent);
+        }
+
+        // fast resend, a fragment is considered lost once 3 fragments sent after it were received,
+        // without waiting for the timeout which would stall the whole window
+        for (auto &sent : channel.unacked) {
+            if (sent.first + RUDP_FAST_RESEND_GAP > highest_acked) break;
+            if (sent.second.sends == 1) sent.second.last_sent = std::chrono::high_resolution_clock::time_point{};
+        }
+
+        return;
+    }
+
+    if (packet.fragment_count() == 0 || packet.fragment_count() > RUDP_FRAGMENTS_MAX || packet.fragment_index() >= packet.fragment_count()) return;
+
+    if (!packet.reliable()) {
+        if (packet.fragment_count() == 1) {
+            deliver_reliable_udp(packet.data(), ip_port);
+            return;
+        }
+
+        auto &partial = channel.unreliable_partial[packet.sequence()];
+        if (partial.fragments.empty()) {
+            partial.fragments.resize(packet.fragment_count());
+            partial.started = std::chrono::high_resolution_clock::now();
+            if (channel.unreliable_partial.size() > RUDP_PARTIAL_MAX) {
+                channel.unreliable_partial.erase(channel.unreliable_partial.begin());
+            }
+        }
+
+        auto found = channel.unreliable_partial.find(packet.sequence());
+        if (found == channel.unreliable_partial.end() || found->second.fragments.size() != packet.fragment_count()) return;
+
+        std::string &part = found->second.fragments[packet.fragment_index()];
+        if (!part.empty() || packet.data().empty()) return;
+        part = packet.data();
+        if (++found->second.received == packet.fragment_count()) {
+            std::string data{};
+            for (auto &f : found->second.fragments) data += f;
+            channel.unreliable_partial.erase(found);
+            deliver_reliable_udp(data, ip_port);
+        }
+
+        return;
+    }
+
+    if (packet.session() != channel.recv_session) {
+        // first packet, or either side restarted
+        PRINT_DEBUG("new reliable UDP session from %llu", (uint64)msg->source_id());
+        channel.recv_session = packet.session();
+        channel.recv_next = 1;
+        channel.recv_out_of_order.clear();
+        channel.recv_message.clear();
+        channel.recv_message_started = false;
+    }
+
+    if (packet.window_start() > channel.recv_next) {
+        // everything before was acked, to a previous instance of ours if we restarted
+        channel.recv_next = packet.window_start();
+        channel.recv_out_of_order.erase(channel.recv_out_of_order.begin(), channel.recv_out_of_order.lower_bound(channel.recv_next));
+        channel.recv_message.clear();
+        channel.recv_message_started = false;
+    }
+
+    // duplicates are acked again, the previous ack might have been lost
+    channel.ack_pending = true;
+    if (packet.sequence() < channel.recv_next || packet.sequence() >= channel.recv_next + RUDP_SEND_WINDOW) return;
+
+    struct Reliable_UDP_Channel::Received_Fragment received{};
+    received.fragment_index = packet.fragment_index();
+    received.fragment_count = packet.fragment_count();
+    received.data = packet.data();
+    channel.recv_out_of_order.emplace(packet.sequence(), std::move(received));
+
+    auto next = channel.recv_out_of_order.begin();
+    while (next != channel.recv_out_of_order.end() && next->first == channel.recv_next) {
+        if (next->second.fragment_index == 0) {
+            channel.recv_message.clear();
+            channel.recv_message_started = true;
+        }
+
+        // the beginning of a message can be missing after skipping to the sender's window
+        if (channel.recv_message_started) {
+            channel.recv_message += next->second.data;
+            if (next->second.fragment_index + 1 == next->second.fragment_count) {
+                deliver_reliable_udp(channel.recv_message, ip_port);
+                channel.recv_message.clear();
+                channel.recv_message_started = false;
+            }
+        }
+
+        next = channel.recv_out_of_order.erase(next);
+        ++channel.recv_next;
+    }
+}
+
+// resend the fragments which weren't acked in time, send the queued ones which fit in the window and ack what was received
+void Networking::run_reliable_udp(struct Connection *conn)
+{
+    struct Reliable_UDP_Channel &channel = conn->rudp;
+    auto now = std::chrono::high_resolution_clock::now();
+
+    double rto = channel.srtt > 0 ? std::max(RUDP_RTO_MIN, channel.srtt * 2) : RUDP_RTO_INITIAL;
+    for (auto &sent : channel.unacked) {
+        // exponential backoff, capped at 16 times the timeout
+        double timeout = rto * (1 << std::min(sent.second.sends - 1, 4u));
+        if (std::chrono::duration_cast<std::chrono::duration<double>>(now - sent.second.last_sent).count() < timeout) continue;
+
+        if (sent.second.sends >= RUDP_SENDS_MAX) {
+            // what wasn't acked is lost like with a reset TCP stream, the next reliable messages use TCP
+            PRINT_DEBUG("reliable UDP peer unresponsive, dropping %zu fragments", channel.unacked.size() + channel.send_queue.size());
+            channel.unacked.clear();
+            channel.send_queue.clear();
+            channel.failed = true;
+            break;
+        }
+
+        send_reliable_fragment(conn, sent.first, sent.second);
+        sent.second.last_sent = now;
+        ++sent.second.sends;
+    }
+
+    // reliable messages sent over TCP before the switch to reliable UDP must reach the peer first
+    bool tcp_pending = !conn->tcp_socket_incoming.send_buffer.empty() || !conn->tcp_socket_outgoing.send_buffer.empty() ||
+        !check_timedout(conn->tcp_reliable_sent, RUDP_SWITCH_DELAY);
+    while (!tcp_pending && !channel.send_queue.empty()) {
+        uint64 window_start = channel.unacked.empty() ? channel.send_queue.front().first : channel.unacked.begin()->first;
+        if (channel.send_queue.front().first >= window_start + RUDP_SEND_WINDOW) break;
+
+        uint64 sequence = channel.send_queue.front().first;
+        struct Reliable_UDP_Channel::Sent_Fragment &sent = channel.unacked[sequence];
+        sent = std::move(channel.send_queue.front().second);
+        sent.last_sent = now;
+        sent.sends = 1;
+        channel.send_queue.pop_front();
+        send_reliable_fragment(conn, sequence, sent);
+    }
+
+    auto partial = channel.unreliable_partial.begin();
+    while (partial != channel.unreliable_partial.end()) {
+        if (check_timedout(partial->second.started, RUDP_PARTIAL_TIMEOUT)) {
+            partial = channel.unreliable_partial.erase(partial);
+        } else {
+            ++partial;
+        }
+    }
+
+    if (channel.ack_pending) {
+        uint64 ack_bits = 0;
+        for (auto &received : channel.recv_out_of_order) {
+            if (received.first <= channel.recv_next || received.first > channel.recv_next + 64) continue;
+            ack_bits |= 1ULL << (received.first - channel.recv_next - 1);
+        }
+
+        Common_Message msg{};
+        msg.set_source_id(ids[0].ConvertToUint64());
+        Reliable_UDP *ack = msg.mutable_reliable_udp();
+        ack->set_type(Reliable_UDP::ACK);
+        ack->set_session(channel.recv_session);
+        ack->set_ack(channel.recv_next);
+        ack->set_ack_bits(ack_bits);
+
+        std::string packet(msg.SerializeAsString());
+        send_udp_data(conn->udp_ip_port, packet.data(), packet.size());
+        channel.ack_pending = false;
+    }
+}
+
+bool Networking::handle_tcp(Common_Message *msg, struct TCP_Socket &socket, size_t size)
 {
     socket.last_heartbeat_received = std::chrono::high_resolution_clock::now();
     if (msg->has_low_level()) {
@@ -614,30 +1382,93 @@ bool Networking::handle_tcp(Common_Message *msg, struct TCP_Socket &socket)
                 break;
             case Low_Level::HEARTBEAT:
                 //socket.last_heartbeat_received = std::chrono::high_resolution_clock::now();
+                if (msg->low_level().ping_time()) {
+                    Common_Message pong;
+                    pong.set_allocated_low_level(new Low_Level());
+                    pong.mutable_low_level()->set_type(Low_Level::HEARTBEAT);
+                    pong.mutable_low_level()->set_pong_time(msg->low_level().ping_time());
+                    send_buffer_tcp(socket, &pong);
+                }
+
+                if (msg->low_level().pong_time()) {
+                    uint64 now = heartbeat_clock();
+                    if (now >= msg->low_level().pong_time()) {
+                        double sample = static_cast<double>(now - msg->low_level().pong_time()) / 1000000.0;
+                        socket.rtt = socket.rtt > 0 ? (socket.rtt * 7 + sample) / 8 : sample;
+                    }
+                }
                 break;
         }
     }
 
-    do_callbacks_message(msg);
+    do_callbacks_message(msg, size);
     return true;
 }
 
+template<typename Key>
+static void unindex_connection(std::unordered_map<Key, std::vector<struct Connection *>> &index, Key key, struct Connection *conn)
+{
+    auto bucket = index.find(key);
+    if (bucket == index.end()) return;
+
+    auto &conns = bucket->second;
+    conns.erase(std::remove(conns.begin(), conns.end(), conn), conns.end());
+    if (conns.empty()) index.erase(bucket);
+}
+
+// lowest round trip time measured on the connection in ms, or -1
+static int connection_ping(const struct Connection *conn)
+{
+    double rtt = 0;
+    for (const TCP_Socket *socket : {&conn->tcp_socket_outgoing, &conn->tcp_socket_incoming}) {
+        if (socket->rtt > 0 && (rtt <= 0 || socket->rtt < rtt)) rtt = socket->rtt;
+    }
+
+    // the reliable UDP channel measures it too, and without the TCP stream's queueing
+    if (conn->rudp.srtt > 0 && (rtt <= 0 || conn->rudp.srtt < rtt)) rtt = conn->rudp.srtt;
+    if (rtt <= 0) return -1;
+    return static_cast<int>(rtt * 1000.0 + 0.5);
+}
+
 struct Connection *Networking::find_connection(CSteamID search_id, uint32 appid)
 {
-    auto conn = std::find_if(connections.begin(), connections.end(), [&search_id, appid](struct Connection const& conn) { 
-        if (appid && (conn.appid != appid)) return false;
+    auto bucket = connections_by_id.find(search_id.ConvertToUint64());
+    if (bucket == connections_by_id.end()) return nullptr;
 
-        for (const auto &id: conn.ids) {
-            if (search_id == id) return true;
-        }
+    struct Connection *found = nullptr;
+    for (auto conn : bucket->second) {
+        if (appid && (conn->appid != appid)) continue;
+        if (!found || conn->sequence < found->sequence) found = conn;
+    }
 
-        return false;
-    });
+    return found;
+}
 
-    if (connections.end() != conn)
-        return &(*conn);
+void Networking::set_connection_tcp_ip_port(struct Connection *conn, IP_PORT ip_port)
+{
+    uint32 old_ip = ntohl(conn->tcp_ip_port.ip);
+    uint32 new_ip = ntohl(ip_port.ip);
+    conn->tcp_ip_port = ip_port;
+    if (old_ip == new_ip && old_ip) return;
 
-    return nullptr;
+    if (old_ip) unindex_connection(connections_by_ip, old_ip, conn);
+    if (new_ip) connections_by_ip[new_ip].push_back(conn);
+}
+
+void Networking::remove_connection_id(struct Connection *conn, std::vector<CSteamID>::iterator id)
+{
+    unindex_connection(connections_by_id, id->ConvertToUint64(), conn);
+    conn->ids.erase(id);
+}
+
+std::list<struct Connection>::iterator Networking::erase_connection(std::list<struct Connection>::iterator conn)
+{
+    for (auto &steam_id : conn->ids) {
+        unindex_connection(connections_by_id, steam_id.ConvertToUint64(), &(*conn));
+    }
+
+    if (conn->tcp_ip_port.ip) unindex_connection(connections_by_ip, (uint32)ntohl(conn->tcp_ip_port.ip), &(*conn));
+    return connections.erase(conn);
 }
 
 bool Networking::add_id_connection(struct Connection *connection, CSteamID steam_id)
@@ -650,6 +1481,7 @@ bool Networking::add_id_connection(struct Connection *connection, CSteamID steam
 
     PRINT_DEBUG("ADDED ID %llu", (uint64)steam_id.ConvertToUint64());
     connection->ids.push_back(steam_id);
+    connections_by_id[steam_id.ConvertToUint64()].push_back(connection);
     if (connection->connected) {
         run_callback_user(steam_id, true, connection->appid);
     }
@@ -667,9 +1499,13 @@ struct Connection *Networking::new_connection(CSteamID search_id, uint32 appid)
     connection.appid = appid;
     connection.last_received = std::chrono::high_resolution_clock::now();
 
+    connection.sequence = ++connections_sequence;
+
     PRINT_DEBUG("ADDED ID %llu", (uint64)search_id.ConvertToUint64());
     connections.push_back(connection);
-    return &(connections[connections.size() - 1]);
+    struct Connection *added = &connections.back();
+    connections_by_id[search_id.ConvertToUint64()].push_back(added);
+    return added;
 }
 
 bool Networking::handle_announce(Common_Message *msg, IP_PORT ip_port)
@@ -682,9 +1518,17 @@ bool Networking::handle_announce(Common_Message *msg, IP_PORT ip_port)
     }
 
     PRINT_DEBUG("Handle Announce: %u, " "%" PRIu64 ", %u, %u", conn->appid, msg->source_id(), msg->announce().appid(), msg->announce().type());
-    conn->tcp_ip_port = ip_port;
-    conn->tcp_ip_port.port = htons(msg->announce().tcp_port());
+    IP_PORT tcp_ip_port = ip_port;
+    tcp_ip_port.port = htons(msg->announce().tcp_port());
+    set_connection_tcp_ip_port(conn, tcp_ip_port);
     conn->appid = msg->announce().appid();
+    if (conn->peer_reliable_udp && !msg->announce().reliable_udp()) {
+        // the peer restarted without reliable UDP, it will never ack what is still waiting
+        conn->rudp.unacked.clear();
+        conn->rudp.send_queue.clear();
+    }
+    conn->peer_reliable_udp = msg->announce().reliable_udp();
+    conn->peer_features = msg->announce().features();
 
     for (int i = 0; i < msg->announce().ids_size(); ++i) {
         add_id_connection(conn, (uint64) msg->announce().ids(i));
@@ -761,12 +1605,17 @@ bool Networking::handle_low_level_udp(Common_Message *msg, IP_PORT ip_port)
 
 #define NUM_TCP_WAITING 128
 
-Networking::Networking(CSteamID id, uint32 appid, uint16 port, std::set<IP_PORT> *custom_broadcasts, bool disable_sockets)
+Networking::Networking(CSteamID id, uint32 appid, uint16 port, std::set<IP_PORT> *custom_broadcasts, bool disable_sockets, bool batched_udp, bool io_thread, bool reliable_udp)
 {
     tcp_port = udp_port = port;
     own_ip = 0x7F000001;
     last_run = std::chrono::high_resolution_clock::now();
     this->appid = appid;
+#if defined(__linux__)
+    this->batched_udp = batched_udp;
+#endif
+    this->reliable_udp = reliable_udp;
+    randombytes((char *)&rudp_session, sizeof(rudp_session));
 
     if (disable_sockets) {
         enabled = false;
@@ -797,6 +1646,7 @@ Networking::Networking(CSteamID id, uint32 appid, uint16 port, std::set<IP_PORT>
             if (bind_socket(sock, udp_port)) {
                 PRINT_DEBUG("UDP successful");
                 udp_socket = sock;
+                socket_poller.add(udp_socket);
                 break;
             } else {
                 //clear the error
@@ -825,6 +1675,7 @@ Networking::Networking(CSteamID id, uint32 appid, uint16 port, std::set<IP_PORT>
                 if ((listen(sock, NUM_TCP_WAITING) == 0)) {
                     PRINT_DEBUG("TCP successful");
                     tcp_socket = sock;
+                    socket_poller.add(tcp_socket);
                     break;
                 } else {
                     int error = 0;
@@ -860,11 +1711,28 @@ Networking::Networking(CSteamID id, uint32 appid, uint16 port, std::set<IP_PORT>
     PRINT_DEBUG("ADDED ID %llu", (uint64)id.ConvertToUint64());
     ids.push_back(id);
 
+    if (enabled && io_thread) {
+        PRINT_DEBUG("starting networking I/O thread");
+        io_thread_enabled = true;
+        publish_routes();
+        this->io_thread = std::thread([this]{ io_thread_proc(); });
+    }
+
     reset_last_error();
 }
 
 Networking::~Networking()
 {
+    if (io_thread_enabled) {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            io_thread_stop = true;
+            queue_cv.notify_one();
+        }
+
+        if (io_thread.joinable()) io_thread.join();
+    }
+
     for (auto &c : connections) {
         kill_tcp_socket(c.tcp_socket_incoming);
         kill_tcp_socket(c.tcp_socket_outgoing);
@@ -876,6 +1744,17 @@ Networking::~Networking()
 
     kill_socket(udp_socket);
     kill_socket(tcp_socket);
+    socket_poller.close();
+
+    if (message_arena) {
+        delete message_arena;
+        message_arena = nullptr;
+    }
+
+    for (auto m : received_messages) {
+        delete m;
+    }
+    received_messages.clear();
 
     curl_global_cleanup();
 }
@@ -902,6 +1781,8 @@ Common_Message Networking::create_announce(bool request)
 
     announce->set_tcp_port(tcp_port);
     announce->set_appid(this->appid);
+    announce->set_reliable_udp(reliable_udp);
+    announce->set_features(PEER_FEATURES_SUPPORTED);
     for (auto &id : ids) announce->add_ids(id.ConvertToUint64());
     Common_Message msg;
     msg.set_allocated_announce(announce);
@@ -916,16 +1797,244 @@ void Networking::send_announce_broadcasts()
     size_t size = msg.ByteSizeLong(); 
     std::vector<char> buffer(size);
     msg.SerializeToArray(&buffer[0], static_cast<int>(size));
-    send_broadcasts(udp_socket, htons(DEFAULT_PORT), &buffer[0], static_cast<unsigned long>(size), &this->custom_broadcasts);
+    send_broadcasts(udp_socket, htons(DEFAULT_PORT), &buffer[0], static_cast<unsigned long>(size), &this->custom_broadcasts, batched_udp);
     if (udp_port != DEFAULT_PORT) {
-        send_broadcasts(udp_socket, htons(udp_port), &buffer[0], static_cast<unsigned long>(size), &this->custom_broadcasts);
+        send_broadcasts(udp_socket, htons(udp_port), &buffer[0], static_cast<unsigned long>(size), &this->custom_broadcasts, batched_udp);
     }
 
     last_broadcast = std::chrono::high_resolution_clock::now();
     PRINT_DEBUG("sent broadcasts");
 }
 
+void Networking::handle_query_packet(char *data, int len, IP_PORT ip_port)
+{
+    Steam_Client* client = get_steam_client();
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+
+    PRINT_DEBUG("requesting Source Query server info from Steam_GameServer");
+    client->steam_gameserver->HandleIncomingPacket(data, len, htonl(ip_port.ip), htons(ip_port.port));
+    len = client->steam_gameserver->GetNextOutgoingPacket(data, MAX_UDP_SIZE, &ip_port.ip, &ip_port.port);
+
+    PRINT_DEBUG("sending Source Query server info");
+    addr.sin_addr.s_addr = htonl(ip_port.ip);
+    addr.sin_port        = htons(ip_port.port);
+    count_syscall();
+    sendto(query_socket, data, len, 0, (sockaddr*)&addr, sizeof(addr));
+}
+
+bool Networking::on_io_thread()
+{
+    return io_thread_enabled && std::this_thread::get_id() == io_thread_id.load();
+}
+
+void Networking::io_thread_proc()
+{
+    io_thread_id = std::this_thread::get_id();
+    PRINT_DEBUG("started");
+    while (true) {
+        std::vector<Network_Outbound> requests{};
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait_for(lock, std::chrono::milliseconds(IO_THREAD_INTERVAL_MS), [this]{ return io_thread_stop || !outbound.empty(); });
+            if (io_thread_stop) break;
+
+            requests.swap(outbound);
+        }
+
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        begin_udp_batch();
+        for (auto &request : requests) {
+            run_outbound(request);
+        }
+
+        run_io();
+        end_udp_batch();
+        publish_routes();
+    }
+
+    PRINT_DEBUG("exited");
+}
+
+// protobuf field 2 (dest_id) as a varint, see Common_Message in net.proto
+#define DEST_ID_FIELD_TAG ((2 << 3) | 0)
+#define DEST_ID_FIELD_SIZE_MAX (1 + 10)
+
+static size_t encode_dest_id_field(uint64 dest_id, char *out)
+{
+    size_t len = 0;
+    out[len++] = (char)DEST_ID_FIELD_TAG;
+    do {
+        uint8 byte = dest_id & 0x7F;
+        dest_id >>= 7;
+        if (dest_id) byte |= 0x80;
+        out[len++] = (char)byte;
+    } while (dest_id);
+
+    return len;
+}
+
+static bool accept_individual(const CSteamID &steam_id)
+{
+    return steam_id.BIndividualAccount();
+}
+
+static bool accept_gameserver(const CSteamID &steam_id)
+{
+    return steam_id.BGameServerAccount();
+}
+
+bool Networking::queue_outbound(Network_Outbound::Targets target, Common_Message *msg, bool reliable, uint32 ip, uint16 port, uint32 required_features, uint32 excluded_features)
+{
+    // the caller keeps its message, serializing it here replaces a copy and the I/O thread sends the bytes as they are
+    Network_Outbound request{};
+    request.target = target;
+    request.dest_id = msg->dest_id();
+    request.size = msg->ByteSizeLong();
+    request.data.resize(request.size + DEST_ID_FIELD_SIZE_MAX);
+    msg->SerializeToArray(&request.data[0], static_cast<int>(request.size));
+    request.reliable = reliable;
+    request.ip = ip;
+    request.port = port;
+    request.required_features = required_features;
+    request.excluded_features = excluded_features;
+
+    bool ret = true;
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    if (target == Network_Outbound::TARGET_DEST_ID) {
+        // same result sendTo() would have given, based on the last state published by the I/O thread
+        auto route = routes.find(request.dest_id);
+        if (route == routes.end()) {
+            ret = false;
+        } else if (!(route->second.flags & ROUTE_SELF)) {
+            uint8 flags = route->second.flags;
+            if (!(flags & ROUTE_RUDP) && (reliable || request.size >= MAX_UDP_SIZE || !(flags & ROUTE_UDP))) {
+                ret = !!(flags & ROUTE_TCP);
+            }
+        }
+    }
+
+    outbound.push_back(std::move(request));
+    queue_cv.notify_one();
+    return ret;
+}
+
+// same routing as sendTo(), fan_out() and sendToIPPort(), with the message already serialized by queue_outbound()
+void Networking::run_outbound(Network_Outbound &request)
+{
+    char *data = &request.data[0];
+    switch (request.target) {
+        case Network_Outbound::TARGET_DEST_ID: {
+            CSteamID dest_id((uint64)request.dest_id);
+            if (std::find(ids.begin(), ids.end(), dest_id) != ids.end()) {
+                PRINT_DEBUG("local send");
+                local_send.emplace_back();
+                local_send.back().ParseFromArray(data, static_cast<int>(request.size));
+                break;
+            }
+
+            Connection *conn = find_connection(dest_id, this->appid);
+            if (conn) send_data(conn, data, request.size, request.reliable);
+        }
+        break;
+
+        case Network_Outbound::TARGET_ALL: fan_out_data(data, request.size, request.reliable, nullptr); break;
+        case Network_Outbound::TARGET_INDIVIDUALS: fan_out_data(data, request.size, request.reliable, &accept_individual, request.required_features, request.excluded_features); break;
+        case Network_Outbound::TARGET_GAMESERVERS: fan_out_data(data, request.size, request.reliable, &accept_gameserver); break;
+
+        case Network_Outbound::TARGET_IP_PORT:
+            for (auto conn : ip_port_connections(request.ip)) {
+                for (auto &steam_id : conn->ids) {
+                    size_t size = request.size + encode_dest_id_field(steam_id.ConvertToUint64(), data + request.size);
+                    send_data(conn, data, size, request.reliable);
+                }
+            }
+        break;
+    }
+
+    reset_last_error();
+}
+
+void Networking::publish_routes()
+{
+    std::map<uint64, Network_Route> new_routes{};
+    for (auto &conn : connections) {
+        if (conn.appid != this->appid) continue;
+
+        uint8 flags = 0;
+        if (conn.tcp_socket_incoming.received_data || conn.tcp_socket_outgoing.received_data) flags |= ROUTE_TCP;
+        if (conn.udp_pinged) flags |= ROUTE_UDP;
+        if (use_reliable_udp(&conn)) flags |= ROUTE_RUDP;
+        for (auto &id : conn.ids) {
+            Network_Route &route = new_routes[id.ConvertToUint64()];
+            route.flags |= flags;
+            // same connection the lookups pick without the I/O thread
+            if (find_connection(id, this->appid) == &conn) {
+                route.ip = ntohl(conn.tcp_ip_port.ip);
+                route.ping = connection_ping(&conn);
+                route.peer_features = conn.peer_features;
+            }
+        }
+    }
+
+    for (auto &id : ids) {
+        Network_Route &route = new_routes[id.ConvertToUint64()];
+        route.flags |= ROUTE_SELF;
+        // messages to our own ids never leave this process
+        route.peer_features = PEER_FEATURES_SUPPORTED;
+    }
+
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    routes.swap(new_routes);
+    routes_own_ip = own_ip;
+    routes_io_stats = io_stats;
+}
+
+Network_Route Networking::published_route(CSteamID id)
+{
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    auto route = routes.find(id.ConvertToUint64());
+    if (route == routes.end()) return {};
+    return route->second;
+}
+
 void Networking::Run()
+{
+    if (!io_thread_enabled) {
+        run_io();
+        return;
+    }
+
+    std::vector<Network_Inbound> items{};
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        items.swap(inbound);
+    }
+
+    for (auto &item : items) {
+        switch (item.type) {
+            case Network_Inbound::MESSAGE:
+                dispatch_message(&item.msg, item.size);
+            break;
+
+            case Network_Inbound::USER_STATUS:
+                run_callbacks(CALLBACK_ID_USER_STATUS, &item.msg);
+            break;
+
+            case Network_Inbound::SOURCE_QUERY: {
+                std::lock_guard<std::recursive_mutex> lock(mutex);
+                if (query_alive && is_socket_valid(query_socket)) {
+                    char data[MAX_UDP_SIZE];
+                    memcpy(data, item.data.data(), item.data.size());
+                    handle_query_packet(data, static_cast<int>(item.data.size()), item.ip_port);
+                }
+            }
+            break;
+        }
+    }
+}
+
+void Networking::run_io()
 {
     std::chrono::high_resolution_clock::time_point now = std::chrono::high_resolution_clock::now();
     double time_extra = std::chrono::duration_cast<std::chrono::duration<double>>(now - last_run).count();
@@ -937,62 +2046,70 @@ void Networking::Run()
 
     //PRINT_DEBUG("%lf", time_extra);
     // PRINT_DEBUG_ENTRY();
+    begin_udp_batch();
+    unsigned long long syscalls_start = io_syscalls.load(std::memory_order_relaxed);
     if (check_timedout(last_broadcast, BROADCAST_INTERVAL)) {
         send_announce_broadcasts();
+        print_message_stats();
     }
 
+    size_t ready_sockets = socket_poller.wait();
+
     IP_PORT ip_port;
     char data[MAX_UDP_SIZE];
     int len;
 
-    if (query_alive && is_socket_valid(query_socket)) {
+    if (query_alive && is_socket_valid(query_socket) && socket_poller.is_ready(query_socket)) {
         PRINT_DEBUG("RECV Source Query");
-        Steam_Client* client = get_steam_client();
-        sockaddr_in addr;
-        addr.sin_family = AF_INET;
-
         while ((len = receive_packet(query_socket, &ip_port, data, sizeof(data))) >= 0) {
-            PRINT_DEBUG("requesting Source Query server info from Steam_GameServer");
-            client->steam_gameserver->HandleIncomingPacket(data, len, htonl(ip_port.ip), htons(ip_port.port));
-            len = client->steam_gameserver->GetNextOutgoingPacket(data, sizeof(data), &ip_port.ip, &ip_port.port);
-
-            PRINT_DEBUG("sending Source Query server info");
-            addr.sin_addr.s_addr = htonl(ip_port.ip);
-            addr.sin_port        = htons(ip_port.port);
-            sendto(query_socket, data, len, 0, (sockaddr*)&addr, sizeof(addr));
+            if (io_thread_enabled) {
+                // the game server interface must be called from the thread running Networking::Run()
+                Network_Inbound item{};
+                item.type = Network_Inbound::SOURCE_QUERY;
+                item.data.assign(data, len);
+                item.ip_port = ip_port;
+
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                inbound.push_back(std::move(item));
+            } else {
+                handle_query_packet(data, len, ip_port);
+            }
         }
     }
 
     PRINT_DEBUG("RECV UDP");
-    while((len = receive_packet(udp_socket, &ip_port, data, sizeof(data))) >= 0) {
-        PRINT_DEBUG("recv %i %hhu.%hhu.%hhu.%hhu:%hu", len,
-            ((unsigned char *)&ip_port.ip)[0], ((unsigned char *)&ip_port.ip)[1], ((unsigned char *)&ip_port.ip)[2], ((unsigned char *)&ip_port.ip)[3], htons(ip_port.port));
-        Common_Message msg;
-        if (msg.ParseFromArray(data, len)) {
-            if (msg.source_id()) {
-                if (msg.has_announce()) {
-                    handle_announce(&msg, ip_port);
-                } else if (msg.has_low_level()) {
-                    handle_low_level_udp(&msg, ip_port);
-                } else {
-                    msg.set_source_ip(ntohl(ip_port.ip));
-                    msg.set_source_port(ntohs(ip_port.port));
-                    do_callbacks_message(&msg);
-                }
+    if (batched_udp) {
+        if (udp_recv_arena.empty()) udp_recv_arena.resize((size_t)UDP_BATCH_SIZE * MAX_UDP_SIZE);
+
+        IP_PORT ip_ports[UDP_BATCH_SIZE];
+        int lengths[UDP_BATCH_SIZE];
+        int count;
+        while (socket_poller.is_ready(udp_socket) && (count = receive_packet_batch(udp_socket, &udp_recv_arena[0], ip_ports, lengths)) > 0) {
+            for (int i = 0; i < count; ++i) {
+                handle_udp_packet(&udp_recv_arena[(size_t)i * MAX_UDP_SIZE], lengths[i], ip_ports[i]);
             }
+
+            // a partial batch means the socket was drained
+            if (count < UDP_BATCH_SIZE) break;
+        }
+    } else {
+        while(socket_poller.is_ready(udp_socket) && (len = receive_packet(udp_socket, &ip_port, data, sizeof(data))) >= 0) {
+            handle_udp_packet(data, len, ip_port);
         }
     }
 
     PRINT_DEBUG("RECV LOCAL %zu", local_send.size());
-    std::vector<Common_Message> local_send_copy = local_send;
-    local_send.clear();
+    // swap instead of copying, anything sent to ourselves by the callbacks is handled in the next run
+    local_send_processing.swap(local_send);
 
-    for (auto & m: local_send_copy) {
+    for (auto & m: local_send_processing) {
         m.set_source_ip(ntohl(own_ip));
         m.set_source_port(ntohs(udp_port));
         do_callbacks_message(&m);
     }
 
+    local_send_processing.clear();
+
     struct sockaddr_storage addr;
 #if defined(STEAM_WIN32)
     int addrlen = sizeof(addr);
@@ -1001,7 +2118,7 @@ void Networking::Run()
 #endif
     sock_t sock;
     PRINT_DEBUG("ACCEPTING");
-    while (is_socket_valid(sock = static_cast<sock_t>(accept(tcp_socket, (struct sockaddr *)&addr, &addrlen)))) {
+    while (socket_poller.is_ready(tcp_socket) && (count_syscall(), is_socket_valid(sock = static_cast<sock_t>(accept(tcp_socket, (struct sockaddr *)&addr, &addrlen))))) {
         PRINT_DEBUG("ACCEPT SOCKET %u", sock);
         struct sockaddr_storage addr;
     #if defined(STEAM_WIN32)
@@ -1019,6 +2136,7 @@ void Networking::Run()
             socket.sock = sock;
             socket.received_data = true;
             socket.last_heartbeat_received = std::chrono::high_resolution_clock::now();
+            socket_poller.add(sock);
             accepted.push_back(socket);
             PRINT_DEBUG("TCP ACCEPTED %u", sock);
         }
@@ -1028,8 +2146,8 @@ void Networking::Run()
     auto conn = std::begin(accepted);
     while (conn != std::end(accepted)) {
         bool deleted = false;
-        recv_tcp(*conn);
-        Common_Message msg;
+        if (socket_poller.is_ready(conn->sock)) recv_tcp(*conn);
+        Common_Message &msg = *new_received_message();
         if (unbuffer_tcp(*conn, &msg)) {
             if (msg.source_id()) {
                 Connection *connection = find_connection((uint64)msg.source_id());
@@ -1072,6 +2190,7 @@ void Networking::Run()
                 disable_nagle(sock);
                 connect_socket(sock, conn.tcp_ip_port);
                 conn.tcp_socket_outgoing.sock = sock;
+                socket_poller.add(sock);
                 conn.tcp_socket_outgoing.last_heartbeat_received = std::chrono::high_resolution_clock::now();
                 Common_Message msg;
                 msg.set_source_id(ids[0].ConvertToUint64());
@@ -1080,8 +2199,8 @@ void Networking::Run()
         }
 
         PRINT_DEBUG("RUN SOCKET1 %u %u", conn.tcp_socket_outgoing.sock, conn.tcp_socket_incoming.sock);
-        recv_tcp(conn.tcp_socket_outgoing);
-        recv_tcp(conn.tcp_socket_incoming);
+        if (socket_poller.is_ready(conn.tcp_socket_outgoing.sock)) recv_tcp(conn.tcp_socket_outgoing);
+        if (socket_poller.is_ready(conn.tcp_socket_incoming.sock)) recv_tcp(conn.tcp_socket_incoming);
 
         if (conn.tcp_socket_incoming.received_data || conn.tcp_socket_outgoing.received_data) {
             if (!conn.connected) {
@@ -1093,7 +2212,7 @@ void Networking::Run()
                         for (auto &steam_id : conn.ids) {
                             auto i = std::find(c.ids.begin(), c.ids.end(), steam_id);
                             if (i != c.ids.end()) {
-                                c.ids.erase(i);
+                                remove_connection_id(&c, i);
                                 run_callback_user(steam_id, false, c.appid);
                                 PRINT_DEBUG("REMOVE OLD CONNECTION ID");
                             }
@@ -1112,18 +2231,19 @@ void Networking::Run()
         send_tcp_pending(conn.tcp_socket_incoming);
 
         PRINT_DEBUG("RUN SOCKET3 %u %u", conn.tcp_socket_outgoing.sock, conn.tcp_socket_incoming.sock);
-        Common_Message msg;
-        while (unbuffer_tcp(conn.tcp_socket_outgoing, &msg)) {
+        Common_Message &msg = *new_received_message();
+        uint32 msg_size;
+        while ((msg_size = unbuffer_tcp(conn.tcp_socket_outgoing, &msg))) {
             PRINT_DEBUG("UNBUFFER SOCKET");
             msg.set_source_ip(ntohl(conn.tcp_ip_port.ip)); //TODO: get from tcp socket
-            handle_tcp(&msg, conn.tcp_socket_outgoing);
+            handle_tcp(&msg, conn.tcp_socket_outgoing, msg_size);
             conn.last_received = std::chrono::high_resolution_clock::now();
         }
 
-        while (unbuffer_tcp(conn.tcp_socket_incoming, &msg)) {
+        while ((msg_size = unbuffer_tcp(conn.tcp_socket_incoming, &msg))) {
             PRINT_DEBUG("UNBUFFER SOCKET");
             msg.set_source_ip(ntohl(conn.tcp_ip_port.ip)); //TODO: get from tcp socket
-            handle_tcp(&msg, conn.tcp_socket_incoming);
+            handle_tcp(&msg, conn.tcp_socket_incoming, msg_size);
             conn.last_received = std::chrono::high_resolution_clock::now();
         }
 
@@ -1140,7 +2260,7 @@ void Networking::Run()
                 if (conn->connected) for (auto &steam_id : conn->ids) run_callback_user(steam_id, false, conn->appid);
                 kill_tcp_socket(conn->tcp_socket_outgoing);
                 kill_tcp_socket(conn->tcp_socket_incoming);
-                conn = connections.erase(conn);
+                conn = erase_connection(conn);
                 PRINT_DEBUG("USER TIMEOUT");
             } else {
                 ++conn;
@@ -1153,7 +2273,41 @@ void Networking::Run()
             if (conn.connected) for (auto &steam_id : conn.ids) run_callback_user(steam_id, false, conn.appid);
             conn.connected = false;
         }
+
+        // still acks what the peer sends after our own reliable messages went back to TCP
+        if (reliable_udp && conn.peer_reliable_udp && conn.udp_pinged) run_reliable_udp(&conn);
+    }
+
+    end_udp_batch();
+
+    if (message_arena) {
+#ifndef EMU_RELEASE_BUILD
+        static unsigned long long arena_allocs_logged = 0;
+        unsigned long long arena_allocs_start = message_arena_heap_allocs;
+        size_t arena_space = static_cast<size_t>(message_arena->SpaceAllocated());
+#endif
+        reset_message_arena();
+#ifndef EMU_RELEASE_BUILD
+        // only when the arena had to allocate, steady traffic would log this every run
+        if (message_arena_heap_allocs != arena_allocs_logged) {
+            PRINT_DEBUG("received messages arena: %zu bytes, %llu heap blocks total (%llu during reset)",
+                arena_space, message_arena_heap_allocs, message_arena_heap_allocs - arena_allocs_start);
+            arena_allocs_logged = message_arena_heap_allocs;
+        }
+#endif
+    }
+
+    for (size_t i = 0; i < received_messages_used; ++i) {
+        received_messages[i]->Clear();
     }
+    received_messages_used = 0;
+
+    unsigned long long syscalls_end = io_syscalls.load(std::memory_order_relaxed);
+    ++io_stats.ticks;
+    io_stats.syscalls_last_tick = syscalls_end - syscalls_start;
+    io_stats.syscalls_total = syscalls_end;
+    io_stats.ready_sockets_last_tick = ready_sockets;
+    io_stats.watched_sockets = socket_poller.watched_count();
 
     reset_last_error();
 }
@@ -1161,6 +2315,7 @@ void Networking::Run()
 void Networking::addListenId(CSteamID id)
 {
     if (!enabled) return;
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     auto i = std::find(ids.begin(), ids.end(), id);
     if (i != ids.end()) {
         return;
@@ -1169,34 +2324,56 @@ void Networking::addListenId(CSteamID id)
     PRINT_DEBUG("ADDED ID %llu", (uint64)id.ConvertToUint64());
     ids.push_back(id);
     send_announce_broadcasts();
+    if (io_thread_enabled) publish_routes();
     return;
 }
 
 void Networking::setAppID(uint32 appid)
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     this->appid = appid;
 }
 
-bool Networking::sendToIPPort(Common_Message *msg, uint32 ip, uint16 port, bool reliable)
+// connections sendToIPPort() delivers to, in the order of the connections
+std::vector<struct Connection *> Networking::ip_port_connections(uint32 ip)
 {
     bool is_local_ip = ((ip >> 24) == 0x7F);
     uint32_t local_ip = getIP(ids.front());
     PRINT_DEBUG("%X %u %X", ip, is_local_ip, local_ip);
     //TODO: actually send to ip/port
-    for (auto &conn: connections) {
-        if (ntohl(conn.tcp_ip_port.ip) == ip || (is_local_ip && ntohl(conn.tcp_ip_port.ip) == local_ip)) {
-            for (auto &steam_id : conn.ids) {
-                msg->set_dest_id(steam_id.ConvertToUint64());
-                sendTo(msg, reliable, &conn);
-            }
+    std::vector<struct Connection *> targets{};
+    auto bucket = connections_by_ip.find(ip);
+    if (bucket != connections_by_ip.end()) targets = bucket->second;
+    if (is_local_ip && local_ip != ip) {
+        bucket = connections_by_ip.find(local_ip);
+        if (bucket != connections_by_ip.end()) targets.insert(targets.end(), bucket->second.begin(), bucket->second.end());
+    }
+
+    std::sort(targets.begin(), targets.end(), [](const struct Connection *a, const struct Connection *b) { return a->sequence < b->sequence; });
+    return targets;
+}
+
+bool Networking::sendToIPPort(Common_Message *msg, uint32 ip, uint16 port, bool reliable)
+{
+    if (io_thread_enabled && !on_io_thread()) return queue_outbound(Network_Outbound::TARGET_IP_PORT, msg, reliable, ip, port);
+
+    begin_udp_batch();
+    for (auto conn : ip_port_connections(ip)) {
+        for (auto &steam_id : conn->ids) {
+            msg->set_dest_id(steam_id.ConvertToUint64());
+            sendTo(msg, reliable, conn);
         }
     }
+    end_udp_batch();
 
     return true;
 }
 
 uint32 Networking::getIP(CSteamID id)
 {
+    if (io_thread_enabled && !on_io_thread()) return published_route(id).ip;
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     Connection *conn = find_connection(id, this->appid);
     if (conn) {
         return ntohl(conn->tcp_ip_port.ip);
@@ -1205,12 +2382,38 @@ uint32 Networking::getIP(CSteamID id)
     return 0;
 }
 
+int Networking::get_ping(CSteamID id)
+{
+    if (io_thread_enabled && !on_io_thread()) return published_route(id).ping;
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    Connection *conn = find_connection(id, this->appid);
+    if (!conn) return -1;
+
+    return connection_ping(conn);
+}
+
+uint32 Networking::get_peer_features(CSteamID id)
+{
+    if (io_thread_enabled && !on_io_thread()) return published_route(id).peer_features;
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    // messages to our own ids never leave this process
+    if (std::find(ids.begin(), ids.end(), id) != ids.end()) return PEER_FEATURES_SUPPORTED;
+
+    Connection *conn = find_connection(id, this->appid);
+    if (!conn) return 0;
+    return conn->peer_features;
+}
+
 bool Networking::sendTo(Common_Message *msg, bool reliable, Connection *conn)
 {
     if (!enabled) return false;
+    if (io_thread_enabled && !on_io_thread()) return queue_outbound(Network_Outbound::TARGET_DEST_ID, msg, reliable);
 
+    begin_udp_batch();
     size_t size = msg->ByteSizeLong();
-    if (size >= MAX_UDP_SIZE) reliable = true; //too big for UDP
+    bool too_big = size >= MAX_UDP_SIZE;
 
     bool ret = false;
     CSteamID dest_id((uint64)msg->dest_id());
@@ -1228,14 +2431,22 @@ bool Networking::sendTo(Common_Message *msg, bool reliable, Connection *conn)
     }
 
     if (!ret && conn) {
-        if (reliable || !conn->udp_pinged) {
-            if (conn->tcp_socket_incoming.received_data) {
-                send_buffer_tcp(conn->tcp_socket_incoming, msg);
-                ret = true;
-            } else if (conn->tcp_socket_outgoing.received_data) {
-                send_buffer_tcp(conn->tcp_socket_outgoing, msg);
+        if ((reliable || too_big) && use_reliable_udp(conn)) {
+            // oversized unreliable messages are fragmented but not resent
+            rudp_buffer.resize(size);
+            msg->SerializeToArray(&rudp_buffer[0], static_cast<int>(size));
+            send_reliable_udp(conn, &rudp_buffer[0], size, reliable);
+            ret = true;
+        } else if (reliable || too_big || !conn->udp_pinged) {
+            struct TCP_Socket *socket = reliable_tcp_socket(conn);
+            if (socket) {
+                send_buffer_tcp(*socket, msg);
+                conn->tcp_reliable_sent = std::chrono::high_resolution_clock::now();
                 ret = true;
             }
+        } else if (batched_udp) {
+            queue_udp(conn->udp_ip_port, msg, size);
+            ret = true;
         } else {
             std::vector<char> buffer(size, 0);
             msg->SerializeToArray(&buffer[0], static_cast<int>(size));
@@ -1244,60 +2455,129 @@ bool Networking::sendTo(Common_Message *msg, bool reliable, Connection *conn)
         }
     }
 
+    end_udp_batch();
     reset_last_error();
     return ret;
 }
 
-bool Networking::sendToAllIndividuals(Common_Message *msg, bool reliable)
+// the message is serialized once without a dest_id, then for each recipient the dest_id field is written after
+// the body, protobuf parsers accept fields in any order so the receiver sees the same message as with sendTo()
+bool Networking::fan_out(Common_Message *msg, bool reliable, bool (*accept)(const CSteamID &steam_id), uint32 required_features, uint32 excluded_features)
+{
+    if (!enabled) return false;
+
+    msg->clear_dest_id();
+    size_t body_size = msg->ByteSizeLong();
+    fan_out_buffer.resize(body_size + DEST_ID_FIELD_SIZE_MAX);
+    msg->SerializeToArray(&fan_out_buffer[0], static_cast<int>(body_size));
+
+    uint64 last_dest_id = fan_out_data(&fan_out_buffer[0], body_size, reliable, accept, required_features, excluded_features);
+
+    // same state as the loop calling set_dest_id() for every recipient used to leave
+    if (last_dest_id) msg->set_dest_id(last_dest_id);
+    reset_last_error();
+    return true;
+}
+
+// 'data' holds the serialized body followed by DEST_ID_FIELD_SIZE_MAX spare bytes, returns the last dest_id written
+uint64 Networking::fan_out_data(char *data, size_t body_size, bool reliable, bool (*accept)(const CSteamID &steam_id), uint32 required_features, uint32 excluded_features)
 {
+    begin_udp_batch();
+    uint64 last_dest_id = 0;
     for (auto &conn: connections) {
+        if ((conn.peer_features & required_features) != required_features) continue;
+        if (conn.peer_features & excluded_features) continue;
+
         for (auto &steam_id : conn.ids) {
-            if (steam_id.BIndividualAccount()) {
-                msg->set_dest_id(steam_id.ConvertToUint64());
-                sendTo(msg, reliable, &conn);
-            }
+            if (accept && !accept(steam_id)) continue;
+
+            last_dest_id = steam_id.ConvertToUint64();
+            size_t size = body_size + encode_dest_id_field(last_dest_id, data + body_size);
+            send_data(&conn, data, size, reliable);
         }
     }
 
-    return true;
+    end_udp_batch();
+    return last_dest_id;
 }
 
-bool Networking::sendToAllGameservers(Common_Message *msg, bool reliable)
+// 'data' is a serialized Common_Message, sent over the same transport sendTo() picks
+void Networking::send_data(struct Connection *conn, const char *data, size_t size, bool reliable)
 {
-    for (auto &conn: connections) {
-        for (auto &steam_id : conn.ids) {
-            if (steam_id.BGameServerAccount()) {
-                msg->set_dest_id(steam_id.ConvertToUint64());
-                sendTo(msg, reliable, &conn);
-            }
+    if ((reliable || size >= MAX_UDP_SIZE) && use_reliable_udp(conn)) {
+        send_reliable_udp(conn, data, size, reliable);
+    } else if (reliable || size >= MAX_UDP_SIZE || !conn->udp_pinged) {
+        struct TCP_Socket *socket = reliable_tcp_socket(conn);
+        if (socket) {
+            send_data_tcp(*socket, data, static_cast<uint32>(size));
+            conn->tcp_reliable_sent = std::chrono::high_resolution_clock::now();
         }
+    } else {
+        send_udp_data(conn->udp_ip_port, data, size);
     }
+}
 
-    return true;
+bool Networking::sendToAllIndividuals(Common_Message *msg, bool reliable, uint32 required_features, uint32 excluded_features)
+{
+    if (io_thread_enabled && !on_io_thread()) return queue_outbound(Network_Outbound::TARGET_INDIVIDUALS, msg, reliable, 0, 0, required_features, excluded_features);
+
+    return fan_out(msg, reliable, &accept_individual, required_features, excluded_features);
+}
+
+bool Networking::sendToAllGameservers(Common_Message *msg, bool reliable)
+{
+    if (io_thread_enabled && !on_io_thread()) return queue_outbound(Network_Outbound::TARGET_GAMESERVERS, msg, reliable);
+
+    return fan_out(msg, reliable, &accept_gameserver);
 }
 
 bool Networking::sendToAll(Common_Message *msg, bool reliable)
 {
-    for (auto &conn: connections) {
-        for (auto &steam_id : conn.ids) {
-            msg->set_dest_id(steam_id.ConvertToUint64());
-            sendTo(msg, reliable, &conn);
+    if (io_thread_enabled && !on_io_thread()) return queue_outbound(Network_Outbound::TARGET_ALL, msg, reliable);
+
+    return fan_out(msg, reliable, nullptr);
+}
+
+static void index_callbacks(struct Network_Callback_Container &container)
+{
+    container.any_steam_id.clear();
+    container.by_steam_id.clear();
+    for (auto &cb : container.callbacks) {
+        uint64 steam_id = cb.steam_id.ConvertToUint64();
+        if (steam_id != 0) container.by_steam_id[steam_id];
+    }
+
+    // every list keeps the registration order, the subscribers for any steam id are in all of them
+    for (auto &cb : container.callbacks) {
+        uint64 steam_id = cb.steam_id.ConvertToUint64();
+        if (steam_id == 0) {
+            container.any_steam_id.push_back(cb);
+            for (auto &by_id : container.by_steam_id) {
+                by_id.second.push_back(cb);
+            }
+        } else {
+            container.by_steam_id[steam_id].push_back(cb);
         }
     }
-
-    return true;
 }
 
 void Networking::run_callbacks(Callback_Ids id, Common_Message *msg)
 {
-    for (auto &cb : callbacks[id].callbacks) {
-        uint64 callback_allowed_steamid = cb.steam_id.ConvertToUint64();
-        uint64 message_destination_steamid = msg->dest_id();
-        if (callback_allowed_steamid == 0 || // callback wants to receive all messages (callback for broadcast)
-            message_destination_steamid == 0 || // message was broadcasted to all (broadcast message)
-            callback_allowed_steamid == message_destination_steamid) { // callback destination is the same as the message destination
+    uint64 message_destination_steamid = msg->dest_id();
+    // message was broadcasted to all (broadcast message)
+    if (message_destination_steamid == 0) {
+        for (auto &cb : callbacks[id].callbacks) {
             cb.message_callback(cb.object, msg);
         }
+
+        return;
+    }
+
+    // callbacks for this destination and callbacks wanting all messages, in registration order
+    auto it = callbacks[id].by_steam_id.find(message_destination_steamid);
+    const auto &subscribers = it != callbacks[id].by_steam_id.end() ? it->second : callbacks[id].any_steam_id;
+    for (auto &cb : subscribers) {
+        cb.message_callback(cb.object, msg);
     }
 }
 
@@ -1315,6 +2595,16 @@ void Networking::run_callback_user(CSteamID steam_id, bool online, uint32 appid)
         msg.mutable_low_level()->set_type(Low_Level::DISCONNECT);
     }
 
+    if (io_thread_enabled) {
+        Network_Inbound item{};
+        item.type = Network_Inbound::USER_STATUS;
+        item.msg.Swap(&msg);
+
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        inbound.push_back(std::move(item));
+        return;
+    }
+
     run_callbacks(CALLBACK_ID_USER_STATUS, &msg);
 }
 
@@ -1328,6 +2618,7 @@ bool Networking::setCallback(Callback_Ids id, CSteamID steam_id, void (*message_
     nc.steam_id = steam_id;
 
     callbacks[id].callbacks.push_back(nc);
+    index_callbacks(callbacks[id]);
     return true;
 }
 
@@ -1347,15 +2638,23 @@ void Networking::rmCallback(Callback_Ids id, CSteamID steam_id, void (*message_c
     );
 
     target_cb.erase(itrm, target_cb.end());
+    index_callbacks(callbacks[id]);
 }
 
 uint32 Networking::getOwnIP()
 {
+    if (io_thread_enabled && !on_io_thread()) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        return routes_own_ip;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     return own_ip;
 }
 
 void Networking::startQuery(IP_PORT ip_port)
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     if (ip_port.port <= 1024)
         return;
 
@@ -1394,6 +2693,7 @@ void Networking::startQuery(IP_PORT ip_port)
             if (res == 0)
             {
                 set_socket_nonblocking(query_socket);
+                socket_poller.add(query_socket);
                 break;
             }
 
@@ -1416,6 +2716,7 @@ void Networking::startQuery(IP_PORT ip_port)
 
 void Networking::shutDownQuery()
 {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
     query_alive = false;
     kill_socket(query_socket);
 }
@@ -1424,3 +2725,21 @@ bool Networking::isQueryAlive()
 {
     return query_alive;
 }
+
+Networking_IO_Stats Networking::get_io_stats()
+{
+    if (io_thread_enabled && !on_io_thread()) {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        return routes_io_stats;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return io_stats;
+}
+
+Network_Message_Stats Networking::get_message_stats(int message_case)
+{
+    if (message_case < 0 || message_case >= NETWORK_MESSAGE_CASES_MAX) return {};
+
+    return message_stats[message_case];
+}
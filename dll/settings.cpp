@@ -351,15 +351,84 @@ std::map<std::string, Stat_config>::const_iterator Settings::setStatDefiniton(co
 }
 
 
-int Settings::add_image(const std::string &data, uint32 width, uint32 height)
-{
-    int last = static_cast<int>(images.size()) + 1;
-    struct Image_Data dt;
-    dt.width = width;
-    dt.height = height;
-    dt.data = data;
-    images[last] = dt;
-    return last;
+std::shared_ptr<const std::string> Settings::share_image_pixels(const std::string &data, uint64 hash)
+{
+    auto &shared = image_pixels[hash];
+    auto pixels = shared.lock();
+    if (pixels && *pixels == data) return pixels;
+
+    auto new_pixels = std::make_shared<const std::string>(data);
+    // on a hash collision the buffer already indexed stays shared, this one isn't
+    if (!pixels) shared = new_pixels;
+    return new_pixels;
+}
+
+void Settings::release_image_pixels(struct Image_Data &image)
+{
+    auto shared = image_pixels.find(image.hash);
+    if (shared != image_pixels.end()) {
+        auto pixels = shared->second.lock();
+        // the last user of the indexed buffer, the local copy and this image
+        if (!pixels || (pixels == image.data && pixels.use_count() <= 2)) image_pixels.erase(shared);
+    }
+
+    image.data.reset();
+}
+
+int Settings::add_image(const std::string &data, uint32 width, uint32 height, bool pinned)
+{
+    int handle = ++last_image;
+    struct Image_Data &image = images[handle];
+    image.width = width;
+    image.height = height;
+    image.hash = common_helpers::fnv1a_64(data);
+    image.data = share_image_pixels(data, image.hash);
+    image.pinned = pinned;
+
+    if (!pinned) {
+        unpinned_images.push_front(handle);
+        image.lru = unpinned_images.begin();
+        unpinned_images_size += data.size();
+
+        while (unpinned_images_size > max_unpinned_images_size && unpinned_images.size() > 1) {
+            auto evicted = images.find(unpinned_images.back());
+            PRINT_DEBUG("evicting image %i", evicted->first);
+            unpinned_images_size -= evicted->second.data->size();
+            unpinned_images.pop_back();
+            release_image_pixels(evicted->second);
+            images.erase(evicted);
+        }
+    }
+
+    return handle;
+}
+
+bool Settings::set_image(int handle, const std::string &data)
+{
+    auto image = images.find(handle);
+    if (images.end() == image) return false;
+
+    if (!image->second.pinned) {
+        unpinned_images_size -= image->second.data->size();
+        unpinned_images_size += data.size();
+    }
+
+    release_image_pixels(image->second);
+    image->second.hash = common_helpers::fnv1a_64(data);
+    image->second.data = share_image_pixels(data, image->second.hash);
+    return true;
+}
+
+const struct Image_Data* Settings::get_image(int handle)
+{
+    auto image = images.find(handle);
+    if (images.end() == image) return nullptr;
+
+    if (!image->second.pinned) {
+        unpinned_images.splice(unpinned_images.begin(), unpinned_images, image->second.lru);
+    }
+
+    return &image->second;
 }
 
 
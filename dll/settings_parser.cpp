@@ -1373,6 +1373,9 @@ static void parse_simple_features(class Settings *settings_client, class Setting
     settings_client->save_only_higher_stat_achievement_progress = ini.GetBoolValue("main::general", "save_only_higher_stat_achievement_progress", settings_client->save_only_higher_stat_achievement_progress);
     settings_server->save_only_higher_stat_achievement_progress = ini.GetBoolValue("main::general", "save_only_higher_stat_achievement_progress", settings_server->save_only_higher_stat_achievement_progress);
 
+    settings_client->stats_snapshot = ini.GetBoolValue("main::general", "stats_snapshot", settings_client->stats_snapshot);
+    settings_server->stats_snapshot = ini.GetBoolValue("main::general", "stats_snapshot", settings_server->stats_snapshot);
+
     settings_client->immediate_gameserver_stats = ini.GetBoolValue("main::general", "immediate_gameserver_stats", settings_client->immediate_gameserver_stats);
     settings_server->immediate_gameserver_stats = ini.GetBoolValue("main::general", "immediate_gameserver_stats", settings_server->immediate_gameserver_stats);
 
@@ -1387,6 +1390,27 @@ static void parse_simple_features(class Settings *settings_client, class Setting
     settings_client->disable_networking = ini.GetBoolValue("main::connectivity", "disable_networking", settings_client->disable_networking);
     settings_server->disable_networking = ini.GetBoolValue("main::connectivity", "disable_networking", settings_server->disable_networking);
 
+    settings_client->batched_udp_io = ini.GetBoolValue("main::connectivity", "batched_udp_io", settings_client->batched_udp_io);
+    settings_server->batched_udp_io = ini.GetBoolValue("main::connectivity", "batched_udp_io", settings_server->batched_udp_io);
+
+    settings_client->networking_io_thread = ini.GetBoolValue("main::connectivity", "networking_io_thread", settings_client->networking_io_thread);
+    settings_server->networking_io_thread = ini.GetBoolValue("main::connectivity", "networking_io_thread", settings_server->networking_io_thread);
+
+    settings_client->reliable_udp = ini.GetBoolValue("main::connectivity", "reliable_udp", settings_client->reliable_udp);
+    settings_server->reliable_udp = ini.GetBoolValue("main::connectivity", "reliable_udp", settings_server->reliable_udp);
+
+    {
+        auto val = ini.GetLongValue("main::connectivity", "networking_sockets_nagle_time_us", -1);
+        if (val >= 0) {
+            settings_client->networking_sockets_nagle_time_us = static_cast<unsigned>(val);
+            settings_server->networking_sockets_nagle_time_us = static_cast<unsigned>(val);
+            PRINT_DEBUG("Setting networking sockets Nagle time to %li us", val);
+        }
+    }
+
+    settings_client->networking_sockets_stats_dump = ini.GetBoolValue("main::connectivity", "networking_sockets_stats_dump", settings_client->networking_sockets_stats_dump);
+    settings_server->networking_sockets_stats_dump = ini.GetBoolValue("main::connectivity", "networking_sockets_stats_dump", settings_server->networking_sockets_stats_dump);
+
     settings_client->disable_sharing_stats_with_gameserver = ini.GetBoolValue("main::connectivity", "disable_sharing_stats_with_gameserver", settings_client->disable_sharing_stats_with_gameserver);
     settings_server->disable_sharing_stats_with_gameserver = ini.GetBoolValue("main::connectivity", "disable_sharing_stats_with_gameserver", settings_server->disable_sharing_stats_with_gameserver);
     
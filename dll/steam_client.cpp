@@ -46,7 +46,7 @@ Steam_Client::Steam_Client()
         std::chrono::duration_cast<std::chrono::milliseconds>(initial_delay),
         std::chrono::duration_cast<std::chrono::milliseconds>(max_stall_ms)
     );
-    network = new Networking(settings_server->get_local_steam_id(), appid, settings_server->get_port(), &(settings_server->custom_broadcasts), settings_server->disable_networking);
+    network = new Networking(settings_server->get_local_steam_id(), appid, settings_server->get_port(), &(settings_server->custom_broadcasts), settings_server->disable_networking, settings_server->batched_udp_io, settings_server->networking_io_thread, settings_server->reliable_udp);
 
     run_every_runcb = new RunEveryRunCB();
 
@@ -112,7 +112,7 @@ Steam_Client::Steam_Client()
     steam_inventory = new Steam_Inventory(settings_client, callback_results_client, callbacks_client, run_every_runcb, local_storage);
     steam_video = new Steam_Video();
     steam_parental = new Steam_Parental();
-    steam_networking_sockets = new Steam_Networking_Sockets(settings_client, network, callback_results_client, callbacks_client, run_every_runcb, NULL);
+    steam_networking_sockets = new Steam_Networking_Sockets(settings_client, local_storage, network, callback_results_client, callbacks_client, run_every_runcb, NULL);
     steam_networking_sockets_serialized = new Steam_Networking_Sockets_Serialized(settings_client, network, callback_results_client, callbacks_client, run_every_runcb);
     steam_networking_messages = new Steam_Networking_Messages(settings_client, network, callback_results_client, callbacks_client, run_every_runcb);
     steam_game_coordinator = new Steam_Game_Coordinator(settings_client, network, callback_results_client, callbacks_client, run_every_runcb);
@@ -138,7 +138,7 @@ Steam_Client::Steam_Client()
     steam_gameserver_inventory = new Steam_Inventory(settings_server, callback_results_server, callbacks_server, run_every_runcb, local_storage);
     steam_gameserver_ugc = new Steam_UGC(settings_server, ugc_bridge, local_storage, callback_results_server, callbacks_server);
     steam_gameserver_apps = new Steam_Apps(settings_server, callback_results_server, callbacks_server);
-    steam_gameserver_networking_sockets = new Steam_Networking_Sockets(settings_server, network, callback_results_server, callbacks_server, run_every_runcb, steam_networking_sockets->get_shared_between_client_server());
+    steam_gameserver_networking_sockets = new Steam_Networking_Sockets(settings_server, local_storage, network, callback_results_server, callbacks_server, run_every_runcb, steam_networking_sockets->get_shared_between_client_server());
     steam_gameserver_networking_sockets_serialized = new Steam_Networking_Sockets_Serialized(settings_server, network, callback_results_server, callbacks_server, run_every_runcb);
     steam_gameserver_networking_messages = new Steam_Networking_Messages(settings_server, network, callback_results_server, callbacks_server, run_every_runcb);
     steam_gameserver_game_coordinator = new Steam_Game_Coordinator(settings_server, network, callback_results_server, callbacks_server, run_every_runcb);
@@ -246,11 +246,14 @@ bool Steam_Client::IsUserLogIn()
 
 void Steam_Client::serverShutdown()
 {
+    local_storage->flush();
     server_init = false;
 }
 
 void Steam_Client::clientShutdown()
 {
+    steam_user_stats->flush_stats();
+    local_storage->flush();
     user_logged_in = false;
 }
 
@@ -18,6 +18,8 @@
 #include "dll/steam_friends.h"
 
 #define SEND_FRIEND_RATE 4.0
+// ask another peer when a requested avatar doesn't arrive within this time
+#define AVATAR_REQUEST_TIMEOUT 10.0
 
 
 Friend* Steam_Friends::find_friend(CSteamID id)
@@ -52,78 +54,275 @@ bool Steam_Friends::is_appid_compatible(Friend *f)
     return settings->get_local_game_id().AppID() == f->appid();
 }
 
-struct Avatar_Numbers Steam_Friends::add_friend_avatars(CSteamID id)
+std::string Steam_Friends::find_avatar_file()
 {
-    uint64 steam_id = id.ConvertToUint64();
-    auto avatar_ids = avatars.find(steam_id);
-    if (avatar_ids != avatars.end()) {
-        return avatar_ids->second;
-    }
-
-    struct Avatar_Numbers avatar_numbers{};
-    std::string small_avatar(32 * 32 * 4, 0);
-    std::string medium_avatar(64 * 64 * 4, 0);
-    std::string large_avatar(184 * 184 * 4, 0);
-
     static const std::initializer_list<std::string> avatar_icons = {
         "account_avatar.png",
         "account_avatar.jpg",
         "account_avatar.jpeg",
     };
 
-    if (!settings->disable_account_avatar && (id == settings->get_local_steam_id())) {
-        std::string file_path{};
-        unsigned long long file_size{};
+    // try local location first, then try global location
+    for (const auto &settings_path : { Local_Storage::get_game_settings_path(), local_storage->get_global_settings_path() }) {
+        for (const auto &file_name : avatar_icons) {
+            std::string file_path = settings_path + file_name;
+            if (file_size_(file_path)) return file_path;
+        }
+    }
 
-        // try local location first, then try global location
-        for (const auto &settings_path : { Local_Storage::get_game_settings_path(), local_storage->get_global_settings_path() }) {
-            for (const auto &file_name : avatar_icons) {
-                file_path = settings_path + file_name;
-                file_size = file_size_(file_path);
-                if (file_size) break;
-            }
-            if (file_size) break;
+    return std::string();
+}
+
+// runs on a worker thread, mustn't touch anything but its arguments
+Steam_Friends::Avatar_Images Steam_Friends::load_avatar(std::string file_path, std::string data, bool raw_rgba)
+{
+    Avatar_Images images{};
+    if (raw_rgba) {
+        images.large = std::move(data);
+    } else {
+        if (file_path.size()) {
+            std::ifstream file(std::filesystem::u8path(file_path), std::ios::in | std::ios::binary);
+            data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
         }
 
-        // no else statement here for default otherwise this breaks default images for friends
-        if (file_size) {
-            small_avatar = Local_Storage::load_image_resized(file_path, "", 32);
-            medium_avatar = Local_Storage::load_image_resized(file_path, "", 64);
-            large_avatar = Local_Storage::load_image_resized(file_path, "", 184);
+        images.large = Local_Storage::decode_image_resized(data, 184);
+        if (images.large.empty()) return images;
+
+        // image files can be anything, peers get the avatar re-encoded at its final size
+        images.png = file_path.size() ? Local_Storage::encode_png(images.large, 184, 184) : std::move(data);
+        images.hash = common_helpers::fnv1a_64(images.png);
+    }
+
+    // each size is resized from the previous one
+    images.medium = Local_Storage::resize_image(images.large, 184, 184, 64);
+    images.small = Local_Storage::resize_image(images.medium, 64, 64, 32);
+    return images;
+}
+
+std::string Steam_Friends::avatar_cache_file(uint64 hash)
+{
+    char file_name[32]{};
+    snprintf(file_name, sizeof(file_name), "%016llx.png", (unsigned long long)hash);
+    return file_name;
+}
+
+const Steam_Friends::Avatar_Images& Steam_Friends::get_local_avatar()
+{
+    if (local_avatar_loaded) return local_avatar;
+    local_avatar_loaded = true;
+
+    std::string file_path = find_avatar_file();
+    if (file_path.empty()) return local_avatar;
+
+    // loaded synchronously like older builds did, games read it right after asking for it
+    local_avatar = load_avatar(file_path, "", false);
+    if (local_avatar.large.size()) {
+        avatar_hashes[settings->get_local_steam_id().ConvertToUint64()] = local_avatar.hash;
+        us.set_avatar_hash(local_avatar.hash);
+        resend_friend_data();
+    }
+
+    return local_avatar;
+}
+
+void Steam_Friends::decode_avatar(std::vector<uint64> steam_ids, uint64 hash, std::string data, bool store, uint64 sender)
+{
+    struct Avatar_Decode decode{};
+    decode.steam_ids = std::move(steam_ids);
+    decode.hash = hash;
+    decode.store = store;
+    decode.sender = sender;
+    decode.images = std::async(std::launch::async, &Steam_Friends::load_avatar, std::string(), std::move(data), false);
+    avatar_decodes.push_back(std::move(decode));
+}
+
+bool Steam_Friends::request_avatar(uint64 hash, struct Avatar_Request &request)
+{
+    // anyone showing this avatar can send it
+    for (uint64 steam_id : request.steam_ids) {
+        if (!find_friend(steam_id) || request.excluded.count(steam_id)) continue;
+
+        PRINT_DEBUG("requesting avatar %016llx from %llu", (unsigned long long)hash, (unsigned long long)steam_id);
+        Common_Message msg;
+        Friend_Messages *friend_messages = new Friend_Messages();
+        friend_messages->set_type(Friend_Messages::AVATAR_REQUEST);
+        friend_messages->set_avatar_hash(hash);
+        msg.set_allocated_friend_messages(friend_messages);
+        msg.set_source_id(settings->get_local_steam_id().ConvertToUint64());
+        msg.set_dest_id(steam_id);
+        network->sendTo(&msg, true);
+        request.last_sent = std::chrono::high_resolution_clock::now();
+        return true;
+    }
+
+    return false;
+}
+
+void Steam_Friends::fetch_avatar(uint64 steam_id, uint64 hash)
+{
+    avatar_hashes[steam_id] = hash;
+
+    // same image as ours, nothing to decode
+    if (local_avatar.large.size() && local_avatar.hash == hash) {
+        struct Avatar_Decode decode{};
+        decode.steam_ids.push_back(steam_id);
+        decode.hash = hash;
+        Avatar_Images images = local_avatar;
+        install_avatar(decode, images);
+        return;
+    }
+
+    std::string file_name = avatar_cache_file(hash);
+    unsigned int size = local_storage->file_size(Local_Storage::avatars_cache_folder, file_name);
+    if (size) {
+        std::string data(size, '\0');
+        if (local_storage->get_data(Local_Storage::avatars_cache_folder, file_name, &data[0], size) == static_cast<int>(size)) {
+            decode_avatar({ steam_id }, hash, std::move(data), false, 0);
+            return;
         }
-    } else if (!settings->disable_account_avatar) {
-        Friend *f = find_friend(id);
-        if (f && (large_avatar.compare(f->avatar()) != 0)) {
-            large_avatar = f->avatar();
-            medium_avatar = Local_Storage::load_image_resized("", f->avatar(), 64);
-            small_avatar = Local_Storage::load_image_resized("", f->avatar(), 32);
+    }
+
+    auto request = avatar_requests.find(hash);
+    if (request != avatar_requests.end()) {
+        // already asked someone with the same avatar
+        request->second.steam_ids.insert(steam_id);
+        return;
+    }
+
+    struct Avatar_Request &new_request = avatar_requests[hash];
+    new_request.steam_ids.insert(steam_id);
+    request_avatar(hash, new_request);
+}
+
+void Steam_Friends::install_avatar(struct Avatar_Decode &decode, Avatar_Images &images)
+{
+    if (images.large.empty() || images.hash != decode.hash) {
+        PRINT_DEBUG("dropping avatar %016llx, bad image or hash mismatch", (unsigned long long)decode.hash);
+        if (!decode.store) {
+            // the cached copy is damaged, get it from the peers again
+            local_storage->file_delete(Local_Storage::avatars_cache_folder, avatar_cache_file(decode.hash));
+            for (uint64 steam_id : decode.steam_ids) {
+                fetch_avatar(steam_id, decode.hash);
+            }
         } else {
-            std::string file_path{};
-            unsigned long long file_size{};
-
-            // try local location first, then try global location
-            for (const auto &settings_path : { Local_Storage::get_game_settings_path(), local_storage->get_global_settings_path() }) {
-                for (const auto &file_name : avatar_icons) {
-                    file_path = settings_path + file_name;
-                    file_size = file_size_(file_path);
-                    if (file_size) break;
-                }
-                if (file_size) break;
+            // ask the others showing it, check_avatar_decodes() sends the request or gives up
+            // and leaves them the default avatar once nobody is left
+            struct Avatar_Request &request = avatar_requests[decode.hash];
+            request.excluded.insert(decode.sender);
+            for (uint64 steam_id : decode.steam_ids) {
+                auto shown_hash = avatar_hashes.find(steam_id);
+                if (shown_hash != avatar_hashes.end() && shown_hash->second == decode.hash) request.steam_ids.insert(steam_id);
             }
 
-            if (file_size) {
-                small_avatar = Local_Storage::load_image_resized(file_path, "", 32);
-                medium_avatar = Local_Storage::load_image_resized(file_path, "", 64);
-                large_avatar = Local_Storage::load_image_resized(file_path, "", 184);
+            if (request.steam_ids.empty()) avatar_requests.erase(decode.hash);
+        }
+
+        return;
+    }
+
+    if (decode.store) {
+        local_storage->store_data(Local_Storage::avatars_cache_folder, avatar_cache_file(images.hash), &images.png[0], static_cast<unsigned int>(images.png.size()));
+    }
+
+    for (uint64 steam_id : decode.steam_ids) {
+        auto avatar_numbers = avatars.find(steam_id);
+        if (avatar_numbers == avatars.end()) continue;
+
+        auto shown_hash = avatar_hashes.find(steam_id);
+        // the user switched to another avatar while this one was being decoded
+        if (shown_hash == avatar_hashes.end() || shown_hash->second != decode.hash) continue;
+
+        // the handles stay the same, some games endlessly allocate stuff otherwise
+        settings->set_image(avatar_numbers->second.smallest, images.small);
+        settings->set_image(avatar_numbers->second.medium, images.medium);
+        settings->set_image(avatar_numbers->second.large, images.large);
+        avatars_loading.erase(steam_id);
+
+        AvatarImageLoaded_t data{};
+        data.m_steamID = steam_id;
+        data.m_iImage = avatar_numbers->second.large;
+        data.m_iWide = 184;
+        data.m_iTall = 184;
+        callbacks->addCBResult(data.k_iCallback, &data, sizeof(data));
+        persona_change(steam_id, k_EPersonaChangeAvatar);
+    }
+}
+
+void Steam_Friends::check_avatar_decodes()
+{
+    // installing can start new decodes, take the finished ones out first
+    std::vector<struct Avatar_Decode> finished{};
+    for (auto it = avatar_decodes.begin(); it != avatar_decodes.end();) {
+        if (it->images.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            finished.push_back(std::move(*it));
+            it = avatar_decodes.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (auto &decode : finished) {
+        Avatar_Images images = decode.images.get();
+        install_avatar(decode, images);
+    }
+
+    for (auto it = avatar_requests.begin(); it != avatar_requests.end();) {
+        if (check_timedout(it->second.last_sent, AVATAR_REQUEST_TIMEOUT) && !request_avatar(it->first, it->second)) {
+            // nobody left to ask, they keep the default avatar
+            for (uint64 steam_id : it->second.steam_ids) {
+                auto shown_hash = avatar_hashes.find(steam_id);
+                if (shown_hash != avatar_hashes.end() && shown_hash->second == it->first) avatars_loading.erase(steam_id);
             }
+
+            it = avatar_requests.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+struct Avatar_Numbers Steam_Friends::add_friend_avatars(CSteamID id)
+{
+    uint64 steam_id = id.ConvertToUint64();
+    auto avatar_ids = avatars.find(steam_id);
+    if (avatar_ids != avatars.end()) {
+        return avatar_ids->second;
+    }
+
+    Avatar_Images images{};
+    Friend *f = nullptr;
+    if (!settings->disable_account_avatar) {
+        f = (id == settings->get_local_steam_id()) ? nullptr : find_friend(id);
+        if (f && !f->avatar_hash() && f->avatar().size() == 184 * 184 * 4) {
+            // older peers send the raw pixels
+            images = load_avatar("", f->avatar(), true);
+        } else {
+            // our own avatar, also the default one for friends without any or until theirs is fetched
+            const Avatar_Images &local = get_local_avatar();
+            images.large = local.large;
+            images.medium = local.medium;
+            images.small = local.small;
         }
     }
 
-    avatar_numbers.smallest = settings->add_image(small_avatar, 32, 32);
-    avatar_numbers.medium = settings->add_image(medium_avatar, 64, 64);
-    avatar_numbers.large = settings->add_image(large_avatar, 184, 184);
+    if (images.large.empty()) {
+        images.large.assign(184 * 184 * 4, 0);
+        images.medium.assign(64 * 64 * 4, 0);
+        images.small.assign(32 * 32 * 4, 0);
+    }
 
+    struct Avatar_Numbers avatar_numbers{};
+    avatar_numbers.smallest = settings->add_image(images.small, 32, 32);
+    avatar_numbers.medium = settings->add_image(images.medium, 64, 64);
+    avatar_numbers.large = settings->add_image(images.large, 184, 184);
     avatars[steam_id] = avatar_numbers;
+
+    // the fetched pixels are written into these same images
+    if (f && f->avatar_hash()) {
+        avatars_loading.insert(steam_id);
+        fetch_avatar(steam_id, f->avatar_hash());
+    }
+
     return avatar_numbers;
 }
 
@@ -722,6 +921,7 @@ int Steam_Friends::GetLargeFriendAvatar( CSteamID steamIDFriend )
     PRINT_DEBUG_ENTRY();
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
     struct Avatar_Numbers numbers = add_friend_avatars(steamIDFriend);
+    if (avatars_loading.count(steamIDFriend.ConvertToUint64())) return -1;
     return numbers.large;
 }
 
@@ -1242,6 +1442,8 @@ void Steam_Friends::RunCallbacks()
         resend_friend_data();
     }
 
+    check_avatar_decodes();
+
     if (modified) {
 	    PRINT_DEBUG("sending modified data");
         Common_Message msg;
@@ -1252,7 +1454,10 @@ void Steam_Friends::RunCallbacks()
         f->set_appid(settings->get_local_game_id().AppID());
         f->set_lobby_id(settings->get_lobby().ConvertToUint64());
         msg.set_allocated_friend_(f);
-        network->sendToAllIndividuals(&msg, true);
+        network->sendToAllIndividuals(&msg, true, PEER_FEATURE_AVATAR_HASHES);
+        // older peers only know the raw pixels
+        if (local_avatar.large.size()) f->set_avatar(local_avatar.large);
+        network->sendToAllIndividuals(&msg, true, 0, PEER_FEATURE_AVATAR_HASHES);
         modified = false;
         last_sent_friends = std::chrono::high_resolution_clock::now();
     }
@@ -1277,14 +1482,18 @@ void Steam_Friends::Callback(Common_Message *msg)
             Common_Message msg_;
             msg_.set_source_id(settings->get_local_steam_id().ConvertToUint64());
             msg_.set_dest_id(msg->source_id());
+            // only the hash of our avatar is sent, the peer asks for the image when it isn't cached
+            add_friend_avatars(settings->get_local_steam_id());
             Friend *f = new Friend(us);
             f->set_id(settings->get_local_steam_id().ConvertToUint64());
             f->set_name(settings->get_local_name());
             f->set_appid(settings->get_local_game_id().AppID());
             f->set_lobby_id(settings->get_lobby().ConvertToUint64());
-            int avatar_number = GetLargeFriendAvatar(settings->get_local_steam_id());
-            if (settings->images[avatar_number].data.length() > 0) f->set_avatar(settings->images[avatar_number].data);
-            else f->set_avatar("");
+            // older peers only know the raw pixels
+            if (local_avatar.large.size() && !(network->get_peer_features((uint64)msg->source_id()) & PEER_FEATURE_AVATAR_HASHES)) {
+                f->set_avatar(local_avatar.large);
+            }
+
             msg_.set_allocated_friend_(f);
             network->sendTo(&msg_, true);
         }
@@ -1313,6 +1522,14 @@ void Steam_Friends::Callback(Common_Message *msg)
             //TODO: callbacks?
             *f = msg->friend_();
         }
+
+        // avatar changed, or a friend which reconnected and already has its images
+        uint64 friend_id = msg->friend_().id();
+        uint64 hash = msg->friend_().avatar_hash();
+        auto shown_hash = avatar_hashes.find(friend_id);
+        if (hash && find_friend(friend_id) && avatars.count(friend_id) && (shown_hash == avatar_hashes.end() || shown_hash->second != hash)) {
+            fetch_avatar(friend_id, hash);
+        }
     }
 
     if (msg->has_friend_messages()) {
@@ -1359,5 +1576,31 @@ void Steam_Friends::Callback(Common_Message *msg)
                 callbacks->addCBResult(data.k_iCallback, &data, sizeof(data));
             }
         }
+
+        if (msg->friend_messages().type() == Friend_Messages::AVATAR_REQUEST) {
+            PRINT_DEBUG("Got Avatar Request");
+            if (local_avatar.png.size() && msg->friend_messages().avatar_hash() == us.avatar_hash()) {
+                Common_Message msg_;
+                Friend_Messages *friend_messages = new Friend_Messages();
+                friend_messages->set_type(Friend_Messages::AVATAR);
+                friend_messages->set_avatar_hash(us.avatar_hash());
+                friend_messages->set_avatar(local_avatar.png);
+                msg_.set_allocated_friend_messages(friend_messages);
+                msg_.set_source_id(settings->get_local_steam_id().ConvertToUint64());
+                msg_.set_dest_id(msg->source_id());
+                network->sendTo(&msg_, true);
+            }
+        }
+
+        if (msg->friend_messages().type() == Friend_Messages::AVATAR) {
+            PRINT_DEBUG("Got Avatar");
+            uint64 hash = msg->friend_messages().avatar_hash();
+            auto request = avatar_requests.find(hash);
+            if (request != avatar_requests.end()) {
+                std::vector<uint64> steam_ids(request->second.steam_ids.begin(), request->second.steam_ids.end());
+                avatar_requests.erase(request);
+                decode_avatar(std::move(steam_ids), hash, msg->friend_messages().avatar(), true, (uint64)msg->source_id());
+            }
+        }
     }
 }
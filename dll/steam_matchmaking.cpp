@@ -18,6 +18,9 @@
 #include "dll/steam_matchmaking.h"
 
 #define SEND_LOBBY_RATE 5.0
+// the whole lobby is sent at this rate, in between only the changes are
+// peers without PEER_FEATURE_LOBBY_DELTAS still get the whole lobby at SEND_LOBBY_RATE and on every change
+#define SEND_LOBBY_FULL_RATE 30.0
 
 #define PENDING_JOIN_TIMEOUT 10.0
 #define REQUEST_LOBBY_DATA_TIMEOUT 6.0
@@ -55,7 +58,318 @@ Lobby* Steam_Matchmaking::get_lobby(CSteamID id)
     return &(*lobby);
 }
 
-void Steam_Matchmaking::send_lobby_data()
+template<typename T>
+static bool lobby_filter_compare(const T &lobby_value, const T &filter_value, ELobbyComparison eComparisonType)
+{
+    switch (eComparisonType) {
+    case k_ELobbyComparisonEqualToOrLessThan: return lobby_value <= filter_value;
+    case k_ELobbyComparisonLessThan: return lobby_value < filter_value;
+    case k_ELobbyComparisonEqual: return lobby_value == filter_value;
+    case k_ELobbyComparisonGreaterThan: return lobby_value > filter_value;
+    case k_ELobbyComparisonEqualToOrGreaterThan: return lobby_value >= filter_value;
+    case k_ELobbyComparisonNotEqual: return lobby_value != filter_value;
+    default: PRINT_DEBUG("unknown compare type %i", (int)eComparisonType); return true;
+    }
+}
+
+void Steam_Matchmaking::lobby_search_invalidate(uint64 room_id)
+{
+    lobby_search_index.erase(room_id);
+}
+
+Lobby_Search_Entry &Steam_Matchmaking::lobby_search_entry(const Lobby &lobby)
+{
+    auto it = lobby_search_index.find(lobby.room_id());
+    if (lobby_search_index.end() != it) return it->second;
+
+    Lobby_Search_Entry &entry = lobby_search_index[lobby.room_id()];
+    for (auto const &v : lobby.values()) {
+        Lobby_Search_Value &value = entry.values[common_helpers::to_lower(v.first)];
+        value.value = v.second;
+        //TODO: check if this is how real steam behaves
+        if (value.value.empty()) {
+            value.is_number = true;
+        } else {
+            char *end = nullptr;
+            errno = 0;
+            value.number = std::strtoll(value.value.c_str(), &end, 0);
+            value.is_number = end != value.value.c_str() && errno != ERANGE;
+        }
+    }
+
+    return entry;
+}
+
+// the parts of the search not based on the lobby values, they're cheap and not indexed
+bool Steam_Matchmaking::lobby_search_usable(const Lobby &lobby) const
+{
+    if (!lobby.joinable() || lobby.deleted()) return false;
+    if (lobby.type() != k_ELobbyTypePublic && lobby.type() != k_ELobbyTypeInvisible && lobby.type() != k_ELobbyTypeFriendsOnly) return false;
+
+    // member_limit 0 = no limit
+    if (lobby.member_limit()) {
+        int slots = static_cast<int>(lobby.member_limit()) - lobby.members_size();
+        if (slots <= 0 || slots < active_search.slots_available) return false; // full lobbies are never returned
+    }
+
+    return true;
+}
+
+bool Steam_Matchmaking::lobby_search_matches(const Lobby_Search_Entry &entry) const
+{
+    for (auto const &f : active_search.filters) {
+        auto value = entry.values.find(f.key);
+        if (entry.values.end() == value) {
+            // the key isn't in the lobby, only "not equal" can match
+            if (f.eComparisonType != k_ELobbyComparisonNotEqual) return false;
+            continue;
+        }
+
+        if (f.is_int) {
+            if (!value->second.is_number) return false;
+            if (!lobby_filter_compare<int64>(value->second.number, f.value_int, f.eComparisonType)) return false;
+        } else {
+            if (!lobby_filter_compare<std::string>(value->second.value, f.value_string, f.eComparisonType)) return false;
+        }
+    }
+
+    return true;
+}
+
+// evaluates the lobbies that arrived or changed since the last run of this search
+void Steam_Matchmaking::lobby_search_run()
+{
+    for (auto & l: lobbies) {
+        Lobby_Search_Entry &entry = lobby_search_entry(l);
+        if (entry.search_id == active_search_id) continue;
+
+        entry.search_id = active_search_id;
+        bool use = lobby_search_usable(l) && lobby_search_matches(entry);
+        PRINT_DEBUG("Lobby " "%" PRIu64 " use %u", l.room_id(), use);
+
+        auto match = std::find(search_matches.begin(), search_matches.end(), (uint64)l.room_id());
+        if (use && search_matches.end() == match) {
+            search_matches.push_back(l.room_id());
+        } else if (!use && search_matches.end() != match) {
+            search_matches.erase(match);
+        }
+    }
+
+    // when the results must be ordered wait for the timeout, more lobbies might show up
+    if (active_search.near_values.empty() && search_matches.size() >= static_cast<size_t>(active_search.max_results)) {
+        lobby_search_finish();
+    }
+}
+
+void Steam_Matchmaking::lobby_search_finish()
+{
+    filtered_lobbies.clear();
+    std::vector<Lobby *> results{};
+    for (auto id : search_matches) {
+        Lobby *lobby = get_lobby(id);
+        // these can change without the lobby values changing
+        if (lobby && lobby_search_usable(*lobby)) results.push_back(lobby);
+    }
+
+    if (active_search.near_values.size()) {
+        std::stable_sort(results.begin(), results.end(), [this](Lobby *lhs, Lobby *rhs) {
+            const Lobby_Search_Entry &lhs_entry = lobby_search_entry(*lhs);
+            const Lobby_Search_Entry &rhs_entry = lobby_search_entry(*rhs);
+            for (auto const &near : active_search.near_values) {
+                // lobbies without the key go last
+                auto distance = [&near](const Lobby_Search_Entry &entry) {
+                    auto value = entry.values.find(near.first);
+                    if (entry.values.end() == value || !value->second.is_number) return std::numeric_limits<uint64>::max();
+                    int64 number = value->second.number;
+                    return number < near.second ? static_cast<uint64>(near.second) - static_cast<uint64>(number) : static_cast<uint64>(number) - static_cast<uint64>(near.second);
+                };
+
+                uint64 lhs_distance = distance(lhs_entry);
+                uint64 rhs_distance = distance(rhs_entry);
+                if (lhs_distance != rhs_distance) return lhs_distance < rhs_distance;
+            }
+
+            return false;
+        });
+    }
+
+    for (auto lobby : results) {
+        if (filtered_lobbies.size() >= static_cast<size_t>(active_search.max_results)) break;
+        filtered_lobbies.push_back((uint64)lobby->room_id());
+    }
+
+    PRINT_DEBUG("returning lobby search results, count=%zu", filtered_lobbies.size());
+    searching = false;
+    search_matches.clear();
+    LobbyMatchList_t data{};
+    data.m_nLobbiesMatching = static_cast<uint32>(filtered_lobbies.size());
+    callback_results->addCallResult(search_call_api_id, data.k_iCallback, &data, sizeof(data));
+    callbacks->addCBResult(data.k_iCallback, &data, sizeof(data));
+    search_call_api_id = 0;
+}
+
+// returns null if nothing changed between the two states
+Lobby_Delta *Steam_Matchmaking::make_lobby_delta(const Lobby &from, const Lobby &to)
+{
+    Lobby_Delta delta{};
+    bool changed = from.owner() != to.owner() || from.appid() != to.appid() ||
+        from.member_limit() != to.member_limit() || from.type() != to.type() || from.joinable() != to.joinable();
+
+    for (auto const &v : to.values()) {
+        auto old = from.values().find(v.first);
+        if (old == from.values().end() || old->second != v.second) {
+            (*delta.mutable_values())[v.first] = v.second;
+        }
+    }
+
+    for (auto const &v : from.values()) {
+        if (!to.values().count(v.first)) delta.add_removed_values(v.first);
+    }
+
+    for (auto const &m : to.members()) {
+        auto old = std::find_if(from.members().begin(), from.members().end(), [&m](Lobby_Member const& item) { return item.id() == m.id(); });
+        if (old == from.members().end()) {
+            Lobby_Delta_Member *member = delta.add_members();
+            member->set_id(m.id());
+            *member->mutable_values() = m.values();
+            continue;
+        }
+
+        Lobby_Delta_Member member{};
+        for (auto const &v : m.values()) {
+            auto old_value = old->values().find(v.first);
+            if (old_value == old->values().end() || old_value->second != v.second) {
+                (*member.mutable_values())[v.first] = v.second;
+            }
+        }
+
+        for (auto const &v : old->values()) {
+            if (!m.values().count(v.first)) member.add_removed_values(v.first);
+        }
+
+        if (member.values_size() || member.removed_values_size()) {
+            member.set_id(m.id());
+            *delta.add_members() = std::move(member);
+        }
+    }
+
+    for (auto const &m : from.members()) {
+        auto current = std::find_if(to.members().begin(), to.members().end(), [&m](Lobby_Member const& item) { return item.id() == m.id(); });
+        if (current == to.members().end()) delta.add_removed_members(m.id());
+    }
+
+    if (!protobuf_message_equal(from.gameserver(), to.gameserver())) {
+        *delta.mutable_gameserver() = to.gameserver();
+        changed = true;
+    }
+
+    changed = changed || delta.values_size() || delta.removed_values_size() || delta.members_size() || delta.removed_members_size();
+    if (!changed) return nullptr;
+
+    delta.set_room_id(to.room_id());
+    delta.set_owner(to.owner());
+    delta.set_appid(to.appid());
+    delta.set_base_version(from.version());
+    delta.set_member_limit(to.member_limit());
+    delta.set_type(to.type());
+    delta.set_joinable(to.joinable());
+    return new Lobby_Delta(std::move(delta));
+}
+
+void Steam_Matchmaking::apply_lobby_delta(Lobby *lobby, const Lobby_Delta &delta)
+{
+    lobby->set_owner(delta.owner());
+    lobby->set_appid(delta.appid());
+    lobby->set_version(delta.version());
+    lobby->set_member_limit(delta.member_limit());
+    lobby->set_type(delta.type());
+    lobby->set_joinable(delta.joinable());
+
+    for (auto const &v : delta.values()) {
+        (*lobby->mutable_values())[v.first] = v.second;
+    }
+
+    for (auto const &key : delta.removed_values()) {
+        lobby->mutable_values()->erase(key);
+    }
+
+    for (auto id : delta.removed_members()) {
+        leave_lobby(lobby, (uint64)id);
+    }
+
+    for (auto const &m : delta.members()) {
+        Lobby_Member *member = get_lobby_member(lobby, (uint64)m.id());
+        if (!member) {
+            member = lobby->add_members();
+            member->set_id(m.id());
+        }
+
+        for (auto const &v : m.values()) {
+            (*member->mutable_values())[v.first] = v.second;
+        }
+
+        for (auto const &key : m.removed_values()) {
+            member->mutable_values()->erase(key);
+        }
+    }
+
+    if (delta.has_gameserver()) {
+        *lobby->mutable_gameserver() = delta.gameserver();
+    }
+}
+
+void Steam_Matchmaking::send_lobby_update(Lobby *lobby, bool full_snapshot, CSteamID dest)
+{
+    Common_Message msg = Common_Message();
+    msg.set_source_id(settings->get_local_steam_id().ConvertToUint64());
+
+    if (dest.IsValid()) {
+        // catch the others up first, so the snapshot carries a version they know
+        send_lobby_update(lobby, false);
+        msg.set_dest_id(dest.ConvertToUint64());
+        msg.set_allocated_lobby(new Lobby(*lobby));
+        network->sendTo(&msg, true);
+        return;
+    }
+
+    auto &replicated = replicated_lobbies[lobby->room_id()];
+    if (replicated.room_id() == lobby->room_id() && replicated.version() == lobby->version()) {
+        Lobby_Delta *delta = make_lobby_delta(replicated, *lobby);
+        if (!delta && !full_snapshot) return; // nothing changed
+
+        if (delta) lobby->set_version(lobby->version() + 1);
+        if (delta && !full_snapshot) {
+            PRINT_DEBUG("lobby " "%" PRIu64 " delta version %" PRIu64 "", lobby->room_id(), lobby->version());
+            delta->set_version(lobby->version());
+            msg.set_allocated_lobby_delta(delta);
+            network->sendToAllIndividuals(&msg, true, PEER_FEATURE_LOBBY_DELTAS);
+            replicated = *lobby;
+            send_full_lobby_to_legacy_peers(lobby);
+            return;
+        }
+
+        delete delta;
+    } else {
+        // never sent, or the lobby was owned by someone else meanwhile
+        lobby->set_version(lobby->version() + 1);
+    }
+
+    PRINT_DEBUG("lobby " "%" PRIu64 " full version %" PRIu64 "", lobby->room_id(), lobby->version());
+    msg.set_allocated_lobby(new Lobby(*lobby));
+    network->sendToAllIndividuals(&msg, true);
+    replicated = *lobby;
+}
+
+// peers running an older build drop the deltas
+void Steam_Matchmaking::send_full_lobby_to_legacy_peers(Lobby *lobby)
+{
+    Common_Message msg = Common_Message();
+    msg.set_source_id(settings->get_local_steam_id().ConvertToUint64());
+    msg.set_allocated_lobby(new Lobby(*lobby));
+    network->sendToAllIndividuals(&msg, true, 0, PEER_FEATURE_LOBBY_DELTAS);
+}
+
+void Steam_Matchmaking::send_lobby_data(bool full_snapshot)
 {
     if (lobbies.size()) {
         PRINT_DEBUG("lobbies %zu", lobbies.size());
@@ -63,11 +377,10 @@ void Steam_Matchmaking::send_lobby_data()
 
     for(auto & l: lobbies) {
         if (get_lobby_member(&l, settings->get_local_steam_id()) && l.owner() == settings->get_local_steam_id().ConvertToUint64() && !l.deleted()) {
-            PRINT_DEBUG("lobby " "%" PRIu64 "", l.room_id());
-            Common_Message msg = Common_Message();
-            msg.set_source_id(settings->get_local_steam_id().ConvertToUint64());
-            msg.set_allocated_lobby(new Lobby(l));
-            network->sendToAllIndividuals(&msg, true);
+            uint64 version = l.version();
+            send_lobby_update(&l, full_snapshot);
+            // nothing was sent, the older peers still expect the lobby at SEND_LOBBY_RATE
+            if (l.version() == version) send_full_lobby_to_legacy_peers(&l);
         }
     }
 }
@@ -91,11 +404,8 @@ void Steam_Matchmaking::trigger_lobby_dataupdate(CSteamID lobby, CSteamID member
     Lobby *l = get_lobby(lobby);
     if (l && l->owner() == settings->get_local_steam_id().ConvertToUint64()) {
         if (send_changed_lobby) {
-            PRINT_DEBUG("resending new data");
-            Common_Message msg = Common_Message();
-            msg.set_source_id(settings->get_local_steam_id().ConvertToUint64());
-            msg.set_allocated_lobby(new Lobby(*l));
-            network->sendToAllIndividuals(&msg, true);
+            PRINT_DEBUG("sending changed data");
+            send_lobby_update(l, false);
         }
     }
 }
@@ -266,7 +576,7 @@ Steam_Matchmaking::Steam_Matchmaking(class Settings *settings, class Local_Stora
     this->callbacks = callbacks;
     this->run_every_runcb = run_every_runcb;
     
-    this->filter_max_results = FILTER_MAX_DEFAULT;
+    this->search_filters.max_results = FILTER_MAX_DEFAULT;
     search_call_api_id = 0;
     searching = false;
 
@@ -474,11 +784,12 @@ SteamAPICall_t Steam_Matchmaking::RequestLobbyList()
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
 
     filtered_lobbies.clear();
+    search_matches.clear();
     lobby_last_search = std::chrono::high_resolution_clock::now();
-    filter_values_copy = filter_values;
-    filter_max_results_copy = filter_max_results;
-    filter_values.clear();
-    filter_max_results = FILTER_MAX_DEFAULT;
+    active_search = std::move(search_filters);
+    search_filters = Lobby_Search();
+    search_filters.max_results = FILTER_MAX_DEFAULT;
+    ++active_search_id;
     searching = true;
     if (search_call_api_id) callback_results->rmCallBack(search_call_api_id, NULL);
     search_call_api_id = callback_results->reserveCallResult();
@@ -497,15 +808,15 @@ void Steam_Matchmaking::RequestLobbyList_OLD()
 void Steam_Matchmaking::AddRequestLobbyListStringFilter( const char *pchKeyToMatch, const char *pchValueToMatch, ELobbyComparison eComparisonType )
 {
     PRINT_DEBUG("'%s'=='%s' %i", pchKeyToMatch, pchValueToMatch, eComparisonType);
-    if (!pchValueToMatch) return;
+    if (!pchKeyToMatch || !pchValueToMatch) return;
 
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
     struct Filter_Values fv;
-    fv.key = std::string(pchKeyToMatch);
+    fv.key = common_helpers::to_lower(pchKeyToMatch);
     fv.value_string = std::string(pchValueToMatch);
     fv.is_int = false;
     fv.eComparisonType = eComparisonType;
-    filter_values.push_back(fv);
+    search_filters.filters.push_back(fv);
 
 }
 
@@ -513,13 +824,15 @@ void Steam_Matchmaking::AddRequestLobbyListStringFilter( const char *pchKeyToMat
 void Steam_Matchmaking::AddRequestLobbyListNumericalFilter( const char *pchKeyToMatch, int nValueToMatch, ELobbyComparison eComparisonType )
 {
     PRINT_DEBUG("'%s'==%i %i", pchKeyToMatch, nValueToMatch, eComparisonType);
+    if (!pchKeyToMatch) return;
+
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
     struct Filter_Values fv;
-    fv.key = std::string(pchKeyToMatch);
+    fv.key = common_helpers::to_lower(pchKeyToMatch);
     fv.value_int = nValueToMatch;
     fv.is_int = true;
     fv.eComparisonType = eComparisonType;
-    filter_values.push_back(fv);
+    search_filters.filters.push_back(fv);
 
 }
 
@@ -527,9 +840,10 @@ void Steam_Matchmaking::AddRequestLobbyListNumericalFilter( const char *pchKeyTo
 void Steam_Matchmaking::AddRequestLobbyListNearValueFilter( const char *pchKeyToMatch, int nValueToBeCloseTo )
 {
     PRINT_DEBUG("'%s'==%u", pchKeyToMatch, nValueToBeCloseTo);
-    std::lock_guard<std::recursive_mutex> lock(global_mutex);
+    if (!pchKeyToMatch) return;
 
-    
+    std::lock_guard<std::recursive_mutex> lock(global_mutex);
+    search_filters.near_values.emplace_back(common_helpers::to_lower(pchKeyToMatch), nValueToBeCloseTo);
 }
 
 // returns only lobbies with the specified number of slots available
@@ -537,8 +851,7 @@ void Steam_Matchmaking::AddRequestLobbyListFilterSlotsAvailable( int nSlotsAvail
 {
     PRINT_DEBUG("%i", nSlotsAvailable);
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
-
-    
+    search_filters.slots_available = nSlotsAvailable;
 }
 
 // sets the distance for which we should search for lobbies (based on users IP address to location map on the Steam backed)
@@ -546,8 +859,7 @@ void Steam_Matchmaking::AddRequestLobbyListDistanceFilter( ELobbyDistanceFilter
 {
     PRINT_DEBUG("%i", eLobbyDistanceFilter);
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
-
-    
+    // every lobby we know about is on the LAN/reachable peers, any distance includes them
 }
 
 // sets how many results to return, the lower the count the faster it is to download the lobby results & details to the client
@@ -555,7 +867,7 @@ void Steam_Matchmaking::AddRequestLobbyListResultCountFilter( int cMaxResults )
 {
     PRINT_DEBUG("%i", cMaxResults);
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
-    filter_max_results = cMaxResults;
+    search_filters.max_results = cMaxResults;
     
 }
 
@@ -580,9 +892,8 @@ void Steam_Matchmaking::AddRequestLobbyListNumericalFilter( const char *pchKeyTo
 
 void Steam_Matchmaking::AddRequestLobbyListSlotsAvailableFilter()
 {
-    PRINT_DEBUG_TODO();
-    std::lock_guard<std::recursive_mutex> lock(global_mutex);
-
+    PRINT_DEBUG_ENTRY();
+    AddRequestLobbyListFilterSlotsAvailable(1);
 }
 
 // returns the CSteamID of a lobby, as retrieved by a RequestLobbyList call
@@ -831,6 +1142,8 @@ bool Steam_Matchmaking::SetLobbyData( CSteamID steamIDLobby, const char *pchKey,
             if (result->second == std::string(pchValue)) changed = false;
             (*lobby->mutable_values())[result->first] = pchValue;
         }
+
+        if (changed) lobby_search_invalidate(lobby->room_id());
     }
 
     if (changed)
@@ -897,6 +1210,7 @@ bool Steam_Matchmaking::DeleteLobbyData( CSteamID steamIDLobby, const char *pchK
     }
 
     lobby->mutable_values()->erase(pchKey);
+    lobby_search_invalidate(lobby->room_id());
     trigger_lobby_dataupdate(steamIDLobby, steamIDLobby, true);
     
     return true;
@@ -1250,6 +1564,8 @@ void Steam_Matchmaking::remove_lobbies()
         if (g->members().size() == 0 || (g->deleted() && (g->time_deleted() + LOBBY_DELETED_TIMEOUT < current_time))) {
             PRINT_DEBUG("LOBBY " "%" PRIu64 "", g->room_id());
             self_lobby_member_data.erase(g->room_id());
+            replicated_lobbies.erase(g->room_id());
+            lobby_search_invalidate(g->room_id());
             g = lobbies.erase(g);
         } else {
             ++g;
@@ -1315,8 +1631,10 @@ void Steam_Matchmaking::run_background()
     create_pending_lobbies();
 
     if (check_timedout(last_sent_lobbies, SEND_LOBBY_RATE)) {
-        send_lobby_data();
+        bool full_snapshot = check_timedout(last_full_lobbies, SEND_LOBBY_FULL_RATE);
+        send_lobby_data(full_snapshot);
         last_sent_lobbies = std::chrono::high_resolution_clock::now();
+        if (full_snapshot) last_full_lobbies = last_sent_lobbies;
     }
 }
 
@@ -1326,84 +1644,12 @@ void Steam_Matchmaking::RunCallbacks()
 
     if (searching) {
         PRINT_DEBUG("for lobbies %zu", lobbies.size());
-        for(auto & l: lobbies) {
-            bool use = l.joinable() && (l.type() == k_ELobbyTypePublic || l.type() == k_ELobbyTypeInvisible || l.type() == k_ELobbyTypeFriendsOnly) && !l.deleted();
-            PRINT_DEBUG("use lobby: %u, filters: %zu, joinable: %u, type: %u, deleted: %u", use, filter_values_copy.size(), l.joinable(), l.type(), l.deleted());
-            for (auto & f : filter_values_copy) {
-                PRINT_DEBUG("'%s':'%s'/%i %u %i", f.key.c_str(), f.value_string.c_str(), f.value_int, f.is_int, f.eComparisonType);
-                auto value = caseinsensitive_find(l.values(), f.key);
-                if (value != l.values().end()) {
-                    //TODO: eComparisonType
-                    if (!f.is_int) {
-                        PRINT_DEBUG("Compare Values %s %s", value->second.c_str(), f.value_string.c_str());
-                        if (f.eComparisonType == k_ELobbyComparisonEqual) {
-                            if (value->second == f.value_string) {
-                                PRINT_DEBUG("Equal (non-int)");
-                                //use = use;
-                            } else {
-                                PRINT_DEBUG("Not Equal (non-int)");
-                                use = false;
-                            }
-                        } else {
-                            PRINT_DEBUG("TODO UNSUPPORTED compare type (non-int) %i", (int)f.eComparisonType);
-                        }
-                    } else {
-                        try {
-                            PRINT_DEBUG("%s", value->second.c_str());
-                            int compare_to = 0;
-                            //TODO: check if this is how real steam behaves
-                            if (value->second.size()) {
-                                compare_to = static_cast<int>(std::stoll(value->second, 0, 0));
-                            }
-                            PRINT_DEBUG("Compare Values %i %i", compare_to, f.value_int);
-                            if (f.eComparisonType == k_ELobbyComparisonEqual) {
-                                if (compare_to == f.value_int) {
-                                    PRINT_DEBUG("Equal (int)");
-                                    //use = use;
-                                } else {
-                                    PRINT_DEBUG("Not Equal (int)");
-                                    use = false;
-                                }
-                            } else {
-                                PRINT_DEBUG("TODO UNSUPPORTED compare type (int) %i", (int)f.eComparisonType);
-                            }
-                        } catch (...) {
-                            //Same case as if the key is not in the lobby?
-                            use = false;
-                        }
-                        //TODO: add more comparisons
-                    }
-                } else {
-                    PRINT_DEBUG("Compare Key not in lobby");
-                    if (f.eComparisonType == k_ELobbyComparisonEqual) {
-                        //If the key is not in the lobby do we take it into account?
-                        use = false;
-                    }
-                }
-            }
-
-            PRINT_DEBUG("Lobby " "%" PRIu64 " use %u", l.room_id(), use);
-            if (use) PUSH_BACK_IF_NOT_IN(filtered_lobbies, (uint64)l.room_id());
-            if (filtered_lobbies.size() >= filter_max_results_copy) {
-                PRINT_DEBUG("returning lobby search results, count=%zu", filtered_lobbies.size());
-                searching = false;
-                LobbyMatchList_t data{};
-                data.m_nLobbiesMatching = static_cast<uint32>(filtered_lobbies.size());
-                callback_results->addCallResult(search_call_api_id, data.k_iCallback, &data, sizeof(data));
-                callbacks->addCBResult(data.k_iCallback, &data, sizeof(data));
-                search_call_api_id = 0;
-            }
-        }
+        lobby_search_run();
     }
 
     if (searching && check_timedout(lobby_last_search, LOBBY_SEARCH_TIMEOUT)) {
-        PRINT_DEBUG("LOBBY_SEARCH_TIMEOUT %zu", filtered_lobbies.size());
-        LobbyMatchList_t data{};
-        data.m_nLobbiesMatching = static_cast<uint32>(filtered_lobbies.size());
-        callback_results->addCallResult(search_call_api_id, data.k_iCallback, &data, sizeof(data));
-        callbacks->addCBResult(data.k_iCallback, &data, sizeof(data));
-        searching = false;
-        search_call_api_id = 0;
+        PRINT_DEBUG("LOBBY_SEARCH_TIMEOUT %zu", search_matches.size());
+        lobby_search_finish();
     }
 
     auto g = std::begin(pending_joins);
@@ -1473,94 +1719,123 @@ void Steam_Matchmaking::RunCallbacks()
 
 
 
-void Steam_Matchmaking::Callback(Common_Message *msg)
+// a new state of a lobby we don't own, either received whole or patched from a delta
+void Steam_Matchmaking::on_lobby_state(Lobby *new_lobby)
 {
-    if (msg->has_lobby()) {
-        PRINT_DEBUG("GOT A LOBBY appid: %u " "%" PRIu64 "", msg->lobby().appid(), msg->lobby().owner());
-        if (msg->lobby().owner() != settings->get_local_steam_id().ConvertToUint64() && msg->lobby().appid() == settings->get_local_game_id().AppID()) {
-            Lobby *lobby = get_lobby((uint64)msg->lobby().room_id());
-            if (!lobby) {
-                size_t old_size = lobbies.size();
-                lobbies.resize(old_size + 1);
-                lobbies[old_size].set_room_id(msg->lobby().room_id());
-                lobby = &(lobbies[old_size]);
-            }
+    Lobby *lobby = get_lobby((uint64)new_lobby->room_id());
+    if (!lobby) {
+        size_t old_size = lobbies.size();
+        lobbies.resize(old_size + 1);
+        lobbies[old_size].set_room_id(new_lobby->room_id());
+        lobby = &(lobbies[old_size]);
+    }
 
-            if (!lobby->deleted()) {
-                if (!protobuf_message_equal(*lobby, msg->lobby())) {
-                    bool we_are_in_lobby = !!get_lobby_member(lobby, settings->get_local_steam_id());
-                    if (we_are_in_lobby) trigger_lobby_dataupdate((uint64)lobby->room_id(), (uint64)lobby->room_id(), true);
+    if (!lobby->deleted()) {
+        if (!protobuf_message_equal(*lobby, *new_lobby)) {
+            bool we_are_in_lobby = !!get_lobby_member(lobby, settings->get_local_steam_id());
+            if (we_are_in_lobby) trigger_lobby_dataupdate((uint64)lobby->room_id(), (uint64)lobby->room_id(), true);
 
-                    for (auto & m : lobby->members()) {
-                        int count = 0;
-                        Lobby_Member *member = get_lobby_member(msg->mutable_lobby(), (uint64)m.id());
+            for (auto & m : lobby->members()) {
+                int count = 0;
+                Lobby_Member *member = get_lobby_member(new_lobby, (uint64)m.id());
 
-                        if (we_are_in_lobby) {
-                            if (!member) {
-                                trigger_lobby_member_join_leave((uint64)lobby->room_id(), (uint64)m.id(), true, true, 0.2);
-                            } else if (!protobuf_message_equal(*member, m)) {
-                                trigger_lobby_dataupdate((uint64)lobby->room_id(), (uint64)m.id(), true);
-                            }
-                        }
+                if (we_are_in_lobby) {
+                    if (!member) {
+                        trigger_lobby_member_join_leave((uint64)lobby->room_id(), (uint64)m.id(), true, true, 0.2);
+                    } else if (!protobuf_message_equal(*member, m)) {
+                        trigger_lobby_dataupdate((uint64)lobby->room_id(), (uint64)m.id(), true);
                     }
+                }
+            }
 
-                    bool joined = false;
-                    for (auto & m : msg->lobby().members()) {
-                        Lobby_Member *member = get_lobby_member(lobby, (uint64)m.id());
-                        if (!member) {
-                            if (m.id() == settings->get_local_steam_id().ConvertToUint64()) {
-                                CSteamID id((uint64)lobby->room_id());
-                                auto pd = pending_joins.begin();
-                                while (pd != pending_joins.end()) {
-                                    if (pd->lobby_id == id) {
-                                        bool success = true;
-                                        LobbyEnter_t data;
-                                        data.m_ulSteamIDLobby = lobby->room_id();
-                                        data.m_rgfChatPermissions = 0; //Unused - Always 0
-                                        data.m_bLocked = false;
-                                        data.m_EChatRoomEnterResponse = success ? k_EChatRoomEnterResponseSuccess : k_EChatRoomEnterResponseError;
-                                        callback_results->addCallResult(pd->api_id, data.k_iCallback, &data, sizeof(data));
-                                        callbacks->addCBResult(data.k_iCallback, &data, sizeof(data));
-                                        pd = pending_joins.erase(pd);
-                                        joined = true;
-                                    } else {
-                                        ++pd;
-                                    }
-                                }
-                                if (joined) {
-                                    on_self_enter_leave_lobby((uint64)lobby->room_id(), lobby->type(), false);
-                                    trigger_lobby_dataupdate((uint64)lobby->room_id(), (uint64)lobby->room_id(), true);
-                                }
+            bool joined = false;
+            for (auto & m : new_lobby->members()) {
+                Lobby_Member *member = get_lobby_member(lobby, (uint64)m.id());
+                if (!member) {
+                    if (m.id() == settings->get_local_steam_id().ConvertToUint64()) {
+                        CSteamID id((uint64)lobby->room_id());
+                        auto pd = pending_joins.begin();
+                        while (pd != pending_joins.end()) {
+                            if (pd->lobby_id == id) {
+                                bool success = true;
+                                LobbyEnter_t data;
+                                data.m_ulSteamIDLobby = lobby->room_id();
+                                data.m_rgfChatPermissions = 0; //Unused - Always 0
+                                data.m_bLocked = false;
+                                data.m_EChatRoomEnterResponse = success ? k_EChatRoomEnterResponseSuccess : k_EChatRoomEnterResponseError;
+                                callback_results->addCallResult(pd->api_id, data.k_iCallback, &data, sizeof(data));
+                                callbacks->addCBResult(data.k_iCallback, &data, sizeof(data));
+                                pd = pending_joins.erase(pd);
+                                joined = true;
                             } else {
-                                if (we_are_in_lobby) trigger_lobby_member_join_leave((uint64)lobby->room_id(), (uint64)m.id(), false, true);
+                                ++pd;
                             }
                         }
-                    }
-
-                    if (joined) {
-                        for (auto & m : msg->lobby().members()) {
-                            if (m.id() != settings->get_local_steam_id().ConvertToUint64()) {
-                                //TODO: is this good?
-                                //trigger_lobby_member_join_leave((uint64)lobby->room_id(), (uint64)m.id(), false, true);
-                                if (m.values().size()) {
-                                    //TODO: check if this is what steam does
-                                    //trigger_lobby_dataupdate((uint64)lobby->room_id(), (uint64)m.id(), true);
-                                }
-                            }
+                        if (joined) {
+                            on_self_enter_leave_lobby((uint64)lobby->room_id(), lobby->type(), false);
+                            trigger_lobby_dataupdate((uint64)lobby->room_id(), (uint64)lobby->room_id(), true);
                         }
+                    } else {
+                        if (we_are_in_lobby) trigger_lobby_member_join_leave((uint64)lobby->room_id(), (uint64)m.id(), false, true);
                     }
+                }
+            }
 
-                    if ((joined && msg->lobby().gameserver().num_update()) || (we_are_in_lobby && (lobby->gameserver().num_update() != msg->lobby().gameserver().num_update()))) {
-                        send_gameservercreated_cb(lobby->room_id(), msg->lobby().gameserver().id(), msg->lobby().gameserver().ip(), msg->lobby().gameserver().port());
-                        trigger_lobby_dataupdate((uint64)lobby->room_id(), (uint64)lobby->room_id(), true);
+            if (joined) {
+                for (auto & m : new_lobby->members()) {
+                    if (m.id() != settings->get_local_steam_id().ConvertToUint64()) {
+                        //TODO: is this good?
+                        //trigger_lobby_member_join_leave((uint64)lobby->room_id(), (uint64)m.id(), false, true);
+                        if (m.values().size()) {
+                            //TODO: check if this is what steam does
+                            //trigger_lobby_dataupdate((uint64)lobby->room_id(), (uint64)m.id(), true);
+                        }
                     }
-
-                    *lobby = msg->lobby();
                 }
             }
+
+            if ((joined && new_lobby->gameserver().num_update()) || (we_are_in_lobby && (lobby->gameserver().num_update() != new_lobby->gameserver().num_update()))) {
+                send_gameservercreated_cb(lobby->room_id(), new_lobby->gameserver().id(), new_lobby->gameserver().ip(), new_lobby->gameserver().port());
+                trigger_lobby_dataupdate((uint64)lobby->room_id(), (uint64)lobby->room_id(), true);
+            }
+
+            *lobby = *new_lobby;
+            lobby_search_invalidate(lobby->room_id());
         }
     }
+}
 
+void Steam_Matchmaking::Callback(Common_Message *msg)
+{
+    if (msg->has_lobby()) {
+        PRINT_DEBUG("GOT A LOBBY appid: %u " "%" PRIu64 "", msg->lobby().appid(), msg->lobby().owner());
+        if (msg->lobby().owner() != settings->get_local_steam_id().ConvertToUint64() && msg->lobby().appid() == settings->get_local_game_id().AppID()) {
+            on_lobby_state(msg->mutable_lobby());
+        }
+    }
+
+    if (msg->has_lobby_delta()) {
+        const Lobby_Delta &delta = msg->lobby_delta();
+        PRINT_DEBUG("GOT A LOBBY DELTA appid: %u " "%" PRIu64 " version %" PRIu64 "", delta.appid(), delta.owner(), delta.version());
+        if (delta.owner() != settings->get_local_steam_id().ConvertToUint64() && delta.appid() == settings->get_local_game_id().AppID()) {
+            Lobby *lobby = get_lobby((uint64)delta.room_id());
+            if (!lobby || lobby->version() != delta.base_version()) {
+                // we missed an update (or never got the lobby), ask the owner for the whole thing
+                PRINT_DEBUG("lobby delta doesn't apply, have version %" PRIu64 " need %" PRIu64 "", lobby ? lobby->version() : 0, delta.base_version());
+                Common_Message request{};
+                request.set_source_id(settings->get_local_steam_id().ConvertToUint64());
+                request.set_dest_id(msg->source_id());
+                Lobby_Messages *message = request.mutable_lobby_messages();
+                message->set_type(Lobby_Messages::STATE_REQUEST);
+                message->set_id(delta.room_id());
+                network->sendTo(&request, true);
+            } else if (!lobby->deleted()) {
+                Lobby patched(*lobby);
+                apply_lobby_delta(&patched, delta);
+                on_lobby_state(&patched);
+            }
+        }
+    }
 
     if (msg->has_lobby_messages()) {
         PRINT_DEBUG("LOBBY MESSAGE %u " "%" PRIu64 "", msg->lobby_messages().type(), msg->lobby_messages().id());
@@ -1575,6 +1850,11 @@ void Steam_Matchmaking::Callback(Common_Message *msg)
                     }
                 }
 
+                if (msg->lobby_messages().type() == Lobby_Messages::STATE_REQUEST) {
+                    PRINT_DEBUG("LOBBY MESSAGE: STATE_REQUEST from=%llu", (uint64)msg->source_id());
+                    send_lobby_update(lobby, true, (uint64)msg->source_id());
+                }
+
                 if (msg->lobby_messages().type() == Lobby_Messages::MEMBER_DATA) {
                     PRINT_DEBUG("LOBBY MESSAGE: MEMBER_DATA");
                     Lobby_Member *member = get_lobby_member(lobby, (uint64)msg->source_id());
@@ -1628,7 +1908,12 @@ void Steam_Matchmaking::Callback(Common_Message *msg)
 
     if (msg->has_low_level()) {
         if (msg->low_level().type() == Low_Level::CONNECT) {
-            
+            // a peer that just showed up has none of our lobbies, the others only get deltas
+            for (auto & l: lobbies) {
+                if (l.owner() == settings->get_local_steam_id().ConvertToUint64() && !l.deleted() && get_lobby_member(&l, settings->get_local_steam_id())) {
+                    send_lobby_update(&l, true, (uint64)msg->source_id());
+                }
+            }
         }
 
         if (msg->low_level().type() == Low_Level::DISCONNECT) {
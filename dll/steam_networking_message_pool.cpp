@@ -0,0 +1,115 @@
+/* Copyright (C) 2019 Mr Goldberg
+   This file is part of the Goldberg Emulator
+
+   The Goldberg Emulator is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   The Goldberg Emulator is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the Goldberg Emulator; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include "dll/steam_networking_message_pool.h"
+
+std::mutex Steam_Networking_Message_Pool::free_mutex{};
+Steam_Networking_Message_Pool::Pooled_Message *Steam_Networking_Message_Pool::free_list{};
+size_t Steam_Networking_Message_Pool::free_count{};
+
+Steam_Networking_Message_Pool::Pooled_Message *Steam_Networking_Message_Pool::take()
+{
+    {
+        std::lock_guard<std::mutex> lock(free_mutex);
+        if (free_list) {
+            Pooled_Message *msg = free_list;
+            free_list = msg->next_free;
+            msg->next_free = nullptr;
+            --free_count;
+            return msg;
+        }
+    }
+
+    return new Pooled_Message();
+}
+
+void Steam_Networking_Message_Pool::free_payload(SteamNetworkingMessage_t *pMsg)
+{
+    Pooled_Message *msg = static_cast<Pooled_Message *>(pMsg);
+    if (msg->payload.capacity() > MAX_KEPT_PAYLOAD) {
+        std::string().swap(msg->payload);
+    } else {
+        msg->payload.clear();
+    }
+
+    pMsg->m_pData = nullptr;
+}
+
+void Steam_Networking_Message_Pool::release_message(SteamNetworkingMessage_t *pMsg)
+{
+    // the game is allowed to replace m_pData/m_pfnFreeData with its own buffer
+    if (pMsg->m_pfnFreeData) pMsg->m_pfnFreeData(pMsg);
+
+    Pooled_Message *msg = static_cast<Pooled_Message *>(pMsg);
+    free_payload(msg);
+    *static_cast<SteamNetworkingMessage_t *>(msg) = SteamNetworkingMessage_t();
+
+    {
+        std::lock_guard<std::mutex> lock(free_mutex);
+        if (free_count < MAX_FREE_MESSAGES) {
+            msg->next_free = free_list;
+            free_list = msg;
+            ++free_count;
+            return;
+        }
+    }
+
+    delete msg;
+}
+
+SteamNetworkingMessage_t *Steam_Networking_Message_Pool::allocate(int cbAllocateBuffer)
+{
+    Pooled_Message *msg = take();
+    msg->m_pfnRelease = &release_message;
+    if (cbAllocateBuffer > 0) {
+        msg->payload.resize(static_cast<size_t>(cbAllocateBuffer));
+        msg->m_pData = &msg->payload[0];
+        msg->m_cbSize = cbAllocateBuffer;
+        msg->m_pfnFreeData = &free_payload;
+    }
+
+    return msg;
+}
+
+SteamNetworkingMessage_t *Steam_Networking_Message_Pool::allocate(std::string &payload)
+{
+    Pooled_Message *msg = take();
+    msg->payload.swap(payload);
+    payload.clear();
+    msg->m_pfnRelease = &release_message;
+    msg->m_pfnFreeData = &free_payload;
+    msg->m_pData = msg->payload.empty() ? nullptr : &msg->payload[0];
+    msg->m_cbSize = static_cast<int>(msg->payload.size());
+    return msg;
+}
+
+void Steam_Networking_Message_Pool::take_payload(SteamNetworkingMessage_t *pMsg, std::string &data)
+{
+    size_t size = pMsg->m_cbSize > 0 && pMsg->m_pData ? static_cast<size_t>(pMsg->m_cbSize) : 0;
+    if (pMsg->m_pfnRelease == &release_message) {
+        Pooled_Message *msg = static_cast<Pooled_Message *>(pMsg);
+        if (size && pMsg->m_pData == &msg->payload[0] && size <= msg->payload.size()) {
+            msg->payload.resize(size);
+            data.swap(msg->payload);
+            msg->payload.clear();
+            pMsg->m_pData = nullptr;
+            return;
+        }
+    }
+
+    data.assign(static_cast<const char *>(pMsg->m_pData), size);
+}
@@ -37,18 +37,6 @@ void Steam_Networking_Messages::steam_run_every_runcb(void *object)
     steam_networking_messages->RunCallbacks();
 }
 
-void Steam_Networking_Messages::free_steam_message_data(SteamNetworkingMessage_t *pMsg)
-{
-    free(pMsg->m_pData);
-    pMsg->m_pData = NULL;
-}
-
-void Steam_Networking_Messages::delete_steam_message(SteamNetworkingMessage_t *pMsg)
-{
-    if (pMsg->m_pfnFreeData) pMsg->m_pfnFreeData(pMsg);
-    delete pMsg;
-}
-
 void Steam_Networking_Messages::end_connection(CSteamID steam_id)
 {
     auto conn = connections.find(steam_id);
@@ -220,11 +208,7 @@ int Steam_Networking_Messages::ReceiveMessagesOnChannel( int nLocalChannel, Stea
         auto chan = conn.second.data.find(nLocalChannel);
         if (chan != conn.second.data.end()) {
             while (!chan->second.empty() && message_counter < nMaxMessages) {
-                SteamNetworkingMessage_t *pMsg = new SteamNetworkingMessage_t(); //TODO size is wrong
-                unsigned long size = static_cast<unsigned long>(chan->second.front().size());
-                pMsg->m_pData = malloc(size);
-                pMsg->m_cbSize = size;
-                memcpy(pMsg->m_pData, chan->second.front().data(), size);
+                SteamNetworkingMessage_t *pMsg = Steam_Networking_Message_Pool::allocate(chan->second.front());
                 pMsg->m_conn = conn.second.id;
                 pMsg->m_identityPeer = conn.second.remote_identity;
                 pMsg->m_nConnUserData = -1;
@@ -233,8 +217,6 @@ int Steam_Networking_Messages::ReceiveMessagesOnChannel( int nLocalChannel, Stea
                 // pMsg->m_nMessageNumber = connect_socket->second.packet_receive_counter;
                 // ++connect_socket->second.packet_receive_counter;
 
-                pMsg->m_pfnFreeData = &free_steam_message_data;
-                pMsg->m_pfnRelease = &delete_steam_message;
                 pMsg->m_nChannel = nLocalChannel;
                 ppOutMessages[message_counter] = pMsg;
                 ++message_counter;
@@ -363,7 +345,7 @@ void Steam_Networking_Messages::RunCallbacks()
         auto conn = connections.find(source_id);
         if (conn != connections.end()) {
             if (conn->second.remote_id == msg->networking_messages().id_from())
-                conn->second.data[msg->networking_messages().channel()].push(msg->networking_messages().data());
+                conn->second.data[msg->networking_messages().channel()].push(std::move(*msg->mutable_networking_messages()->mutable_data()));
         }
 
         msg = incoming_data.erase(msg);
@@ -38,37 +38,310 @@ SteamNetworkingMessage_t* Steam_Networking_Sockets::get_steam_message_connection
 {
     auto connect_socket = sbcs->connect_sockets.find(hConn);
     if (connect_socket == sbcs->connect_sockets.end()) return NULL;
-    if (connect_socket->second.data.empty()) return NULL;
-    SteamNetworkingMessage_t *pMsg = new SteamNetworkingMessage_t();
-    unsigned long size = static_cast<unsigned long>(connect_socket->second.data.top().data().size());
-    pMsg->m_pData = malloc(size);
-    pMsg->m_cbSize = size;
-    memcpy(pMsg->m_pData, connect_socket->second.data.top().data().data(), size);
+    return pop_steam_message(connect_socket->second, hConn);
+}
+
+SteamNetworkingMessage_t* Steam_Networking_Sockets::pop_steam_message(struct Connect_Socket &connect_socket, HSteamNetConnection hConn)
+{
+    if (connect_socket.data.empty()) return NULL;
+    SteamNetworkingMessage_t *pMsg = connect_socket.data.pop();
+    pMsg->m_identityPeer = connect_socket.remote_identity;
+    pMsg->m_nConnUserData = connect_socket.user_data;
+    PRINT_DEBUG("pop_steam_message %u %i, %llu", hConn, pMsg->m_cbSize, pMsg->m_nMessageNumber);
+    return pMsg;
+}
+
+// the payload is moved out of the network message, the game gets it without another copy
+void Steam_Networking_Sockets::queue_steam_message(struct Connect_Socket &connect_socket, HSteamNetConnection hConn, std::string *data, uint64 message_number, uint16 lane)
+{
+    SteamNetworkingMessage_t *pMsg = Steam_Networking_Message_Pool::allocate(*data);
     pMsg->m_conn = hConn;
-    pMsg->m_identityPeer = connect_socket->second.remote_identity;
-    pMsg->m_nConnUserData = connect_socket->second.user_data;
     pMsg->m_usecTimeReceived = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - created).count();
     //TODO: check where messagenumber starts
-    pMsg->m_nMessageNumber = connect_socket->second.data.top().message_number();
-
-    pMsg->m_pfnFreeData = &free_steam_message_data;
-    pMsg->m_pfnRelease = &delete_steam_message;
+    pMsg->m_nMessageNumber = message_number;
     pMsg->m_nChannel = 0;
-    connect_socket->second.data.pop();
-    PRINT_DEBUG("get_steam_message_connection %u %lu, %llu", hConn, size, pMsg->m_nMessageNumber);
-    return pMsg;
+    pMsg->m_idxLane = lane;
+    connect_socket.data.push(pMsg);
+
+    if (connect_socket.poll_group != k_HSteamNetPollGroup_Invalid) {
+        auto group = sbcs->poll_groups.find(connect_socket.poll_group);
+        if (group != sbcs->poll_groups.end()) {
+            group->second.ready.emplace_back(hConn, &connect_socket);
+        }
+    }
+}
+
+void Steam_Networking_Sockets::leave_poll_group(HSteamNetConnection hConn, struct Connect_Socket &connect_socket)
+{
+    if (connect_socket.poll_group == k_HSteamNetPollGroup_Invalid) return;
+
+    auto group = sbcs->poll_groups.find(connect_socket.poll_group);
+    if (group != sbcs->poll_groups.end()) {
+        group->second.connections.remove(hConn);
+        auto &ready = group->second.ready;
+        ready.erase(std::remove_if(ready.begin(), ready.end(), [hConn](const std::pair<HSteamNetConnection, struct Connect_Socket *> &entry){ return entry.first == hConn; }), ready.end());
+    }
+
+    connect_socket.poll_group = k_HSteamNetPollGroup_Invalid;
+}
+
+void Steam_Networking_Sockets::queue_steam_messages(struct Connect_Socket &connect_socket, HSteamNetConnection hConn, Networking_Sockets *data)
+{
+    connect_socket.telemetry.packets_in += 1;
+    connect_socket.telemetry.bytes_in += data->ByteSizeLong();
+    connect_socket.telemetry.messages_in += data->messages_size() ? data->messages_size() : 1;
+    if (data->messages_size()) {
+        for (auto &message : *data->mutable_messages()) {
+            queue_steam_message(connect_socket, hConn, message.mutable_data(), message.message_number(), static_cast<uint16>(message.lane()));
+        }
+    } else {
+        queue_steam_message(connect_socket, hConn, data->mutable_data(), data->message_number(), static_cast<uint16>(data->lane()));
+    }
+}
+
+// puts a message on its lane, it is only sent by send_queued_messages()
+EResult Steam_Networking_Sockets::queue_send_message(HSteamNetConnection hConn, std::string &data, int nSendFlags, uint16 lane, int64 *pOutMessageNumber)
+{
+    auto connect_socket = sbcs->connect_sockets.find(hConn);
+    if (connect_socket == sbcs->connect_sockets.end()) return k_EResultInvalidParam;
+    if (connect_socket->second.status == CONNECT_SOCKET_CLOSED) return k_EResultNoConnection;
+    if (connect_socket->second.status == CONNECT_SOCKET_TIMEDOUT) return k_EResultNoConnection;
+    if (connect_socket->second.status != CONNECT_SOCKET_CONNECTED && connect_socket->second.status != CONNECT_SOCKET_CONNECTING) return k_EResultInvalidState;
+    if (data.size() > static_cast<size_t>(k_cbMaxSteamNetworkingSocketsMessageSizeSend)) return k_EResultInvalidParam;
+    // NoDelay messages are dropped rather than waiting for the connection to be established
+    if ((nSendFlags & k_nSteamNetworkingSend_NoDelay) && !(nSendFlags & k_nSteamNetworkingSend_Reliable) && connect_socket->second.status != CONNECT_SOCKET_CONNECTED) return k_EResultIgnored;
+    if (lane >= connect_socket->second.lanes.size()) return k_EResultInvalidParam;
+
+    Connection_Lane &conn_lane = connect_socket->second.lanes[lane];
+    Outgoing_Socket_Message out{};
+    out.data.swap(data);
+    out.message_number = connect_socket->second.packet_send_counter;
+    out.lane = lane;
+    out.reliable = !!(nSendFlags & k_nSteamNetworkingSend_Reliable);
+    // +1 so that empty messages still advance the lane
+    out.finish = std::max(conn_lane.last_finish, connect_socket->second.lanes_virtual_time) + static_cast<double>(out.data.size() + 1) / conn_lane.weight;
+    conn_lane.last_finish = out.finish;
+    connect_socket->second.packet_send_counter += 1;
+
+    if (pOutMessageNumber) *pOutMessageNumber = static_cast<int64>(out.message_number);
+    connect_socket->second.queued_send_size += out.data.size();
+    conn_lane.queue.push_back(std::move(out));
+    return k_EResultOK;
+}
+
+// drains the lanes of a connection: strict priority order, lanes sharing a priority get
+// served by weight. Consecutive messages of the same reliability are packed into one frame,
+// frames go out in that same order so the priorities hold on the wire too
+bool Steam_Networking_Sockets::send_queued_messages(HSteamNetConnection hConn)
+{
+    auto connect_socket = sbcs->connect_sockets.find(hConn);
+    if (connect_socket == sbcs->connect_sockets.end()) return false;
+    connect_socket->second.queued_send_size = 0;
+    connect_socket->second.nagle_pending = false;
+
+    // older peers only read the plain fields, they get one message per frame
+    bool batches = !!(network->get_peer_features(CSteamID(static_cast<uint64>(connect_socket->second.remote_identity.GetSteamID64()))) & PEER_FEATURE_SOCKETS_BATCHES);
+    Networking_Sockets frame{};
+    size_t frame_size{};
+    bool frame_reliable{};
+    bool sent = true;
+    while (true) {
+        Connection_Lane *next = nullptr;
+        for (auto &lane : connect_socket->second.lanes) {
+            if (lane.queue.empty()) continue;
+            if (!next || lane.priority < next->priority || (lane.priority == next->priority && lane.queue.front().finish < next->queue.front().finish)) {
+                next = &lane;
+            }
+        }
+
+        if (!next) break;
+
+        Outgoing_Socket_Message &out = next->queue.front();
+        connect_socket->second.lanes_virtual_time = out.finish;
+        if (frame.messages_size() && (!batches || frame_reliable != out.reliable || frame_size + out.data.size() > SNS_FRAME_MAX_SIZE)) {
+            sent = send_data_frame(hConn, connect_socket->second, &frame, frame_reliable) && sent;
+            frame.Clear();
+            frame_size = 0;
+        }
+
+        Networking_Sockets::Message *message = frame.add_messages();
+        frame_size += out.data.size();
+        frame_reliable = out.reliable;
+        message->mutable_data()->swap(out.data);
+        message->set_message_number(out.message_number);
+        message->set_lane(out.lane);
+        next->queue.pop_front();
+    }
+
+    if (frame.messages_size()) {
+        sent = send_data_frame(hConn, connect_socket->second, &frame, frame_reliable) && sent;
+    }
+
+    return sent;
+}
+
+// Nagle: small messages wait up to networking_sockets_nagle_time_us for more to share their frame,
+// a flush or enough queued data to fill a frame sends them right away
+bool Steam_Networking_Sockets::schedule_queued_messages(HSteamNetConnection hConn, bool flush)
+{
+    auto connect_socket = sbcs->connect_sockets.find(hConn);
+    if (connect_socket == sbcs->connect_sockets.end()) return false;
+    // games sending every frame don't have to wait for the next RunCallbacks() to get the older messages out
+    if (settings->networking_sockets_nagle_time_us) send_overdue_messages(std::chrono::steady_clock::now());
+    bool empty = std::all_of(connect_socket->second.lanes.begin(), connect_socket->second.lanes.end(), [](const Connection_Lane &lane){ return lane.queue.empty(); });
+    if (empty) return true;
+
+    if (flush || settings->networking_sockets_nagle_time_us == 0 || connect_socket->second.queued_send_size >= SNS_FRAME_MAX_SIZE) {
+        return send_queued_messages(hConn);
+    }
+
+    if (!connect_socket->second.nagle_pending) {
+        connect_socket->second.nagle_pending = true;
+        connect_socket->second.nagle_deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(settings->networking_sockets_nagle_time_us);
+    }
+
+    return true;
+}
+
+// connections whose Nagle deadline passed, checked by the send path and RunCallbacks()
+void Steam_Networking_Sockets::send_overdue_messages(std::chrono::steady_clock::time_point now)
+{
+    for (auto &conn : sbcs->connect_sockets) {
+        if (conn.second.nagle_pending && now >= conn.second.nagle_deadline) {
+            send_queued_messages(conn.first);
+        }
+    }
 }
 
-void Steam_Networking_Sockets::free_steam_message_data(SteamNetworkingMessage_t *pMsg)
+bool Steam_Networking_Sockets::send_data_frame(HSteamNetConnection hConn, struct Connect_Socket &connect_socket, Networking_Sockets *frame, bool reliable)
 {
-    free(pMsg->m_pData);
-    pMsg->m_pData = NULL;
+    Common_Message msg;
+    msg.set_source_id(connect_socket.created_by.ConvertToUint64());
+    msg.set_dest_id(connect_socket.remote_identity.GetSteamID64());
+    Networking_Sockets *data = new Networking_Sockets;
+    msg.set_allocated_networking_sockets(data);
+    // a lone message uses the plain fields
+    if (frame->messages_size() == 1) {
+        Networking_Sockets::Message *message = frame->mutable_messages(0);
+        data->mutable_data()->swap(*message->mutable_data());
+        data->set_message_number(message->message_number());
+        data->set_lane(message->lane());
+    } else {
+        data->mutable_messages()->Swap(frame->mutable_messages());
+    }
+
+    data->set_type(Networking_Sockets::DATA);
+    data->set_virtual_port(connect_socket.virtual_port);
+    data->set_real_port(connect_socket.real_port);
+    data->set_connection_id_from(hConn);
+    data->set_connection_id(connect_socket.remote_id);
+
+    connect_socket.telemetry.packets_out += 1;
+    connect_socket.telemetry.bytes_out += msg.ByteSizeLong();
+    connect_socket.telemetry.messages_out += data->messages_size() ? data->messages_size() : 1;
+    return network->sendTo(&msg, reliable);
+}
+
+void Steam_Networking_Sockets::update_telemetry(struct Connect_Socket &connect_socket, std::chrono::steady_clock::time_point now)
+{
+    Connection_Telemetry &telemetry = connect_socket.telemetry;
+    double elapsed = std::chrono::duration<double>(now - telemetry.window_start).count();
+    if (elapsed < SNS_TELEMETRY_INTERVAL) return;
+
+    // first window of the connection, start counting from here
+    if (telemetry.window_start == std::chrono::steady_clock::time_point{}) {
+        elapsed = 0;
+    }
+
+    if (elapsed > 0) {
+        telemetry.out_packets_per_sec = static_cast<float>((telemetry.packets_out - telemetry.window_packets_out) / elapsed);
+        telemetry.out_bytes_per_sec = static_cast<float>((telemetry.bytes_out - telemetry.window_bytes_out) / elapsed);
+        telemetry.in_packets_per_sec = static_cast<float>((telemetry.packets_in - telemetry.window_packets_in) / elapsed);
+        telemetry.in_bytes_per_sec = static_cast<float>((telemetry.bytes_in - telemetry.window_bytes_in) / elapsed);
+    }
+
+    telemetry.window_packets_out = telemetry.packets_out;
+    telemetry.window_bytes_out = telemetry.bytes_out;
+    telemetry.window_packets_in = telemetry.packets_in;
+    telemetry.window_bytes_in = telemetry.bytes_in;
+    telemetry.window_start = now;
 }
 
-void Steam_Networking_Sockets::delete_steam_message(SteamNetworkingMessage_t *pMsg)
+// bytes still waiting on the lanes, lane -1 means all of them
+void Steam_Networking_Sockets::get_pending_bytes(const struct Connect_Socket &connect_socket, int lane, int *unreliable, int *reliable)
 {
-    if (pMsg->m_pfnFreeData) pMsg->m_pfnFreeData(pMsg);
-    delete pMsg;
+    size_t pending[2]{};
+    for (size_t i = 0; i < connect_socket.lanes.size(); ++i) {
+        if (lane >= 0 && static_cast<size_t>(lane) != i) continue;
+        for (const auto &out : connect_socket.lanes[i].queue) {
+            pending[out.reliable] += out.data.size();
+        }
+    }
+
+    if (unreliable) *unreliable = static_cast<int>(pending[0]);
+    if (reliable) *reliable = static_cast<int>(pending[1]);
+}
+
+// how long newly queued data would wait before being sent
+SteamNetworkingMicroseconds Steam_Networking_Sockets::get_queue_time(const struct Connect_Socket &connect_socket)
+{
+    if (!connect_socket.nagle_pending) return 0;
+
+    auto now = std::chrono::steady_clock::now();
+    if (connect_socket.nagle_deadline <= now) return 0;
+    return std::chrono::duration_cast<std::chrono::microseconds>(connect_socket.nagle_deadline - now).count();
+}
+
+int Steam_Networking_Sockets::get_ping(const struct Connect_Socket &connect_socket)
+{
+    int ping = network->get_ping(CSteamID(static_cast<uint64>(connect_socket.remote_identity.GetSteamID64())));
+    // not measured yet
+    if (ping < 0) ping = 10;
+    return ping;
+}
+
+void Steam_Networking_Sockets::dump_stats()
+{
+    nlohmann::json stats = nlohmann::json::object();
+    auto &connections = stats["connections"] = nlohmann::json::array();
+    for (auto &conn : sbcs->connect_sockets) {
+        const Connection_Telemetry &telemetry = conn.second.telemetry;
+        int pending_unreliable = 0, pending_reliable = 0;
+        get_pending_bytes(conn.second, -1, &pending_unreliable, &pending_reliable);
+
+        nlohmann::json entry = nlohmann::json::object();
+        entry["connection"] = conn.first;
+        entry["remote_steam_id"] = conn.second.remote_identity.GetSteamID64();
+        entry["state"] = convert_status(conn.second.status);
+        entry["ping_ms"] = network->get_ping(CSteamID(static_cast<uint64>(conn.second.remote_identity.GetSteamID64())));
+        entry["lanes"] = conn.second.lanes.size();
+        entry["out_packets_per_sec"] = telemetry.out_packets_per_sec;
+        entry["out_bytes_per_sec"] = telemetry.out_bytes_per_sec;
+        entry["in_packets_per_sec"] = telemetry.in_packets_per_sec;
+        entry["in_bytes_per_sec"] = telemetry.in_bytes_per_sec;
+        entry["packets_out"] = telemetry.packets_out;
+        entry["bytes_out"] = telemetry.bytes_out;
+        entry["messages_out"] = telemetry.messages_out;
+        entry["packets_in"] = telemetry.packets_in;
+        entry["bytes_in"] = telemetry.bytes_in;
+        entry["messages_in"] = telemetry.messages_in;
+        entry["pending_unreliable"] = pending_unreliable;
+        entry["pending_reliable"] = pending_reliable;
+        entry["queue_time_us"] = get_queue_time(conn.second);
+        entry["received_not_read"] = conn.second.data.size();
+        connections.push_back(std::move(entry));
+    }
+
+    // socket work of the whole networking layer, to tell a busy connection from a busy emulator
+    Networking_IO_Stats io_stats = network->get_io_stats();
+    auto &io = stats["network_io"] = nlohmann::json::object();
+    io["ticks"] = io_stats.ticks;
+    io["syscalls_total"] = io_stats.syscalls_total;
+    io["syscalls_last_tick"] = io_stats.syscalls_last_tick;
+    io["watched_sockets"] = io_stats.watched_sockets;
+    io["ready_sockets_last_tick"] = io_stats.ready_sockets_last_tick;
+
+    local_storage->write_json_file("", SNS_STATS_FILE, stats);
 }
 
 unsigned long Steam_Networking_Sockets::get_socket_id()
@@ -214,9 +487,10 @@ void Steam_Networking_Sockets::launch_callback(HSteamNetConnection m_hConn, enum
 }
 
 
-Steam_Networking_Sockets::Steam_Networking_Sockets(class Settings *settings, class Networking *network, class SteamCallResults *callback_results, class SteamCallBacks *callbacks, class RunEveryRunCB *run_every_runcb, shared_between_client_server *sbcs)
+Steam_Networking_Sockets::Steam_Networking_Sockets(class Settings *settings, class Local_Storage *local_storage, class Networking *network, class SteamCallResults *callback_results, class SteamCallBacks *callbacks, class RunEveryRunCB *run_every_runcb, shared_between_client_server *sbcs)
 {
     this->settings = settings;
+    this->local_storage = local_storage;
     this->network = network;
     this->run_every_runcb = run_every_runcb;
     this->callback_results = callback_results;
@@ -545,6 +819,9 @@ bool Steam_Networking_Sockets::CloseConnection( HSteamNetConnection hPeer, int n
     if (connect_socket == sbcs->connect_sockets.end()) return false;
 
     if (connect_socket->second.status != CONNECT_SOCKET_CLOSED && connect_socket->second.status != CONNECT_SOCKET_TIMEDOUT) {
+        // whatever is still waiting on the Nagle timer goes out before the end of the connection
+        send_queued_messages(connect_socket->first);
+
         //TODO send/nReason and pszDebug
         Common_Message msg;
         msg.set_source_id(connect_socket->second.created_by.ConvertToUint64());
@@ -558,6 +835,11 @@ bool Steam_Networking_Sockets::CloseConnection( HSteamNetConnection hPeer, int n
         network->sendTo(&msg, true);
     }
 
+    leave_poll_group(connect_socket->first, connect_socket->second);
+    while (!connect_socket->second.data.empty()) {
+        connect_socket->second.data.pop()->Release();
+    }
+
     sbcs->connect_sockets.erase(connect_socket);
     return true;
 }
@@ -723,34 +1005,11 @@ EResult Steam_Networking_Sockets::SendMessageToConnection( HSteamNetConnection h
     PRINT_DEBUG("%u, len %u, flags %i", hConn, cbData, nSendFlags);
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
 
-    auto connect_socket = sbcs->connect_sockets.find(hConn);
-    if (connect_socket == sbcs->connect_sockets.end()) return k_EResultInvalidParam;
-    if (connect_socket->second.status == CONNECT_SOCKET_CLOSED) return k_EResultNoConnection;
-    if (connect_socket->second.status == CONNECT_SOCKET_TIMEDOUT) return k_EResultNoConnection;
-    if (connect_socket->second.status != CONNECT_SOCKET_CONNECTED && connect_socket->second.status != CONNECT_SOCKET_CONNECTING) return k_EResultInvalidState;
-
-    Common_Message msg;
-    msg.set_source_id(connect_socket->second.created_by.ConvertToUint64());
-    msg.set_dest_id(connect_socket->second.remote_identity.GetSteamID64());
-    msg.set_allocated_networking_sockets(new Networking_Sockets);
-    msg.mutable_networking_sockets()->set_type(Networking_Sockets::DATA);
-    msg.mutable_networking_sockets()->set_virtual_port(connect_socket->second.virtual_port);
-    msg.mutable_networking_sockets()->set_real_port(connect_socket->second.real_port);
-    msg.mutable_networking_sockets()->set_connection_id_from(connect_socket->first);
-    msg.mutable_networking_sockets()->set_connection_id(connect_socket->second.remote_id);
-    msg.mutable_networking_sockets()->set_data(pData, cbData);
-    uint64 message_number = connect_socket->second.packet_send_counter;
-    msg.mutable_networking_sockets()->set_message_number(message_number);
-    connect_socket->second.packet_send_counter += 1;
-
-    bool reliable = false;
-    if (nSendFlags & k_nSteamNetworkingSend_Reliable) reliable = true;
-    if (network->sendTo(&msg, reliable)) {
-        if (pOutMessageNumber) *pOutMessageNumber = message_number;
-        return k_EResultOK;
-    }
-
-    return k_EResultFail;
+    std::string data(static_cast<const char *>(pData), pData ? cbData : 0);
+    EResult result = queue_send_message(hConn, data, nSendFlags, 0, pOutMessageNumber);
+    if (result != k_EResultOK) return result;
+    if (!schedule_queued_messages(hConn, !!(nSendFlags & (k_nSteamNetworkingSend_NoNagle | k_nSteamNetworkingSend_NoDelay)))) return k_EResultFail;
+    return k_EResultOK;
 }
 
 EResult Steam_Networking_Sockets::SendMessageToConnection( HSteamNetConnection hConn, const void *pData, uint32 cbData, int nSendFlags )
@@ -795,9 +1054,23 @@ void Steam_Networking_Sockets::SendMessages( int nMessages, SteamNetworkingMessa
 {
     PRINT_DEBUG_ENTRY();
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
+    // connection, flush
+    std::vector<std::pair<HSteamNetConnection, bool>> touched{};
     for (int i = 0; i < nMessages; ++i) {
         int64 out_number = 0;
-        int result = SendMessageToConnection(pMessages[i]->m_conn, pMessages[i]->m_pData, pMessages[i]->m_cbSize, pMessages[i]->m_nFlags, &out_number);
+        std::string data{};
+        Steam_Networking_Message_Pool::take_payload(pMessages[i], data);
+        EResult result = queue_send_message(pMessages[i]->m_conn, data, pMessages[i]->m_nFlags, pMessages[i]->m_idxLane, &out_number);
+        if (result == k_EResultOK) {
+            bool flush = !!(pMessages[i]->m_nFlags & (k_nSteamNetworkingSend_NoNagle | k_nSteamNetworkingSend_NoDelay));
+            auto conn = std::find_if(touched.begin(), touched.end(), [&](const std::pair<HSteamNetConnection, bool> &t){ return t.first == pMessages[i]->m_conn; });
+            if (conn == touched.end()) {
+                touched.emplace_back(pMessages[i]->m_conn, flush);
+            } else {
+                conn->second = conn->second || flush;
+            }
+        }
+
         if (pOutMessageNumberOrResult) {
             if (result == k_EResultOK) {
                 pOutMessageNumberOrResult[i] = out_number;
@@ -806,9 +1079,13 @@ void Steam_Networking_Sockets::SendMessages( int nMessages, SteamNetworkingMessa
             }
         }
 
-        pMessages[i]->m_pfnFreeData(pMessages[i]);
         pMessages[i]->Release();
     }
+
+    // everything is queued first so that each connection gets its messages in as few frames as possible, in lane order
+    for (auto &conn : touched) {
+        schedule_queued_messages(conn.first, conn.second);
+    }
 }
 
 
@@ -820,8 +1097,12 @@ void Steam_Networking_Sockets::SendMessages( int nMessages, SteamNetworkingMessa
 /// on the next transmission time (often that means right now).
 EResult Steam_Networking_Sockets::FlushMessagesOnConnection( HSteamNetConnection hConn )
 {
-    PRINT_DEBUG_TODO();
+    PRINT_DEBUG("%u", hConn);
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
+    auto connect_socket = sbcs->connect_sockets.find(hConn);
+    if (connect_socket == sbcs->connect_sockets.end()) return k_EResultInvalidParam;
+    if (connect_socket->second.status == CONNECT_SOCKET_CLOSED || connect_socket->second.status == CONNECT_SOCKET_TIMEDOUT) return k_EResultNoConnection;
+    if (!send_queued_messages(hConn)) return k_EResultFail;
     return k_EResultOK;
 }
 
@@ -928,25 +1209,34 @@ EResult Steam_Networking_Sockets::GetConnectionRealTimeStatus( HSteamNetConnecti
     auto connect_socket = sbcs->connect_sockets.find(hConn);
     if (connect_socket == sbcs->connect_sockets.end()) return k_EResultNoConnection;
 
+    if (nLanes < 0 || (nLanes && !pLanes) || static_cast<size_t>(nLanes) > connect_socket->second.lanes.size()) return k_EResultInvalidParam;
+
+    const Connection_Telemetry &telemetry = connect_socket->second.telemetry;
     if (pStatus) {
         pStatus->m_eState = convert_status(connect_socket->second.status);
-        pStatus->m_nPing = 10; //TODO: calculate real numbers?
+        pStatus->m_nPing = get_ping(connect_socket->second);
         pStatus->m_flConnectionQualityLocal = 1.0;
         pStatus->m_flConnectionQualityRemote = 1.0;
-        //TODO: rest
-        pStatus->m_flOutPacketsPerSec = 0.0;
-        pStatus->m_flOutBytesPerSec = 0.0;
-        pStatus->m_flInPacketsPerSec = 0.0;
-        pStatus->m_flInBytesPerSec = 0.0;
+        pStatus->m_flOutPacketsPerSec = telemetry.out_packets_per_sec;
+        pStatus->m_flOutBytesPerSec = telemetry.out_bytes_per_sec;
+        pStatus->m_flInPacketsPerSec = telemetry.in_packets_per_sec;
+        pStatus->m_flInBytesPerSec = telemetry.in_bytes_per_sec;
+        get_pending_bytes(connect_socket->second, -1, &pStatus->m_cbPendingUnreliable, &pStatus->m_cbPendingReliable);
+        // reliable data is handed to TCP or the reliable UDP channel right away, there is nothing unacked to report here
         pStatus->m_cbSentUnackedReliable = 0;
-        pStatus->m_usecQueueTime = 0;
+        pStatus->m_usecQueueTime = get_queue_time(connect_socket->second);
 
         //Note some games (volcanoids) might not allocate a struct the whole size of SteamNetworkingQuickConnectionStatus
         //keep this in mind in future interface updates
         //NOTE: need to implement GetQuickConnectionStatus seperately if this changes.
     }
 
-    //TODO: lanes
+    for (int i = 0; i < nLanes; ++i) {
+        get_pending_bytes(connect_socket->second, i, &pLanes[i].m_cbPendingUnreliable, &pLanes[i].m_cbPendingReliable);
+        pLanes[i].m_cbSentUnackedReliable = 0;
+        pLanes[i].m_usecQueueTime = get_queue_time(connect_socket->second);
+    }
+
     return k_EResultOK;
 }
 
@@ -1020,9 +1310,37 @@ bool Steam_Networking_Sockets::GetQuickConnectionStatus( HSteamNetConnection hCo
 /// >0 Your buffer was either nullptr, or it was too small and the text got truncated.  Try again with a buffer of at least N bytes.
 int Steam_Networking_Sockets::GetDetailedConnectionStatus( HSteamNetConnection hConn, char *pszBuf, int cbBuf )
 {
-    PRINT_DEBUG_TODO();
+    PRINT_DEBUG("%u %p %i", hConn, pszBuf, cbBuf);
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
-    return -1;
+    auto connect_socket = sbcs->connect_sockets.find(hConn);
+    if (connect_socket == sbcs->connect_sockets.end()) return -1;
+
+    const Connection_Telemetry &telemetry = connect_socket->second.telemetry;
+    int pending_unreliable = 0, pending_reliable = 0;
+    get_pending_bytes(connect_socket->second, -1, &pending_unreliable, &pending_reliable);
+
+    std::stringstream ss{};
+    ss << "Connection " << hConn << " to steamid " << connect_socket->second.remote_identity.GetSteamID64() << "\n"
+       << "State: " << convert_status(connect_socket->second.status) << "\n"
+       << "Ping: " << get_ping(connect_socket->second) << "ms\n"
+       << "Lanes: " << connect_socket->second.lanes.size() << "\n"
+       << "Sent: " << telemetry.out_packets_per_sec << " pkts/sec, " << telemetry.out_bytes_per_sec << " bytes/sec, total "
+       << telemetry.packets_out << " pkts, " << telemetry.bytes_out << " bytes, " << telemetry.messages_out << " msgs\n"
+       << "Received: " << telemetry.in_packets_per_sec << " pkts/sec, " << telemetry.in_bytes_per_sec << " bytes/sec, total "
+       << telemetry.packets_in << " pkts, " << telemetry.bytes_in << " bytes, " << telemetry.messages_in << " msgs\n"
+       << "Pending: " << pending_unreliable << " unreliable, " << pending_reliable << " reliable bytes, queue time " << get_queue_time(connect_socket->second) << "us\n"
+       << "Received not read: " << connect_socket->second.data.size() << " msgs\n";
+    std::string text = ss.str();
+
+    int needed = static_cast<int>(text.size() + 1);
+    if (pszBuf && cbBuf > 0) {
+        size_t copy = std::min(text.size(), static_cast<size_t>(cbBuf - 1));
+        memcpy(pszBuf, text.data(), copy);
+        pszBuf[copy] = '\0';
+    }
+
+    if (!pszBuf || cbBuf < needed) return needed;
+    return 0;
 }
 
 /// Returns local IP and port that a listen socket created using CreateListenSocketIP is bound to.
@@ -1184,11 +1502,28 @@ bool Steam_Networking_Sockets::CreateSocketPair( HSteamNetConnection *pOutConnec
 /// SteamNetworkingMessage_t::m_idxLane
 EResult Steam_Networking_Sockets::ConfigureConnectionLanes( HSteamNetConnection hConn, int nNumLanes, const int *pLanePriorities, const uint16 *pLaneWeights )
 {
-    PRINT_DEBUG_TODO();
+    PRINT_DEBUG("%u %i %p %p", hConn, nNumLanes, pLanePriorities, pLaneWeights);
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
     auto connect_socket = sbcs->connect_sockets.find(hConn);
     if (connect_socket == sbcs->connect_sockets.end()) return k_EResultNoConnection;
-    //TODO
+    if (connect_socket->second.status == CONNECT_SOCKET_CLOSED || connect_socket->second.status == CONNECT_SOCKET_TIMEDOUT) return k_EResultInvalidState;
+    if (nNumLanes < 1 || nNumLanes > SNS_MAX_LANES) return k_EResultInvalidParam;
+    if (static_cast<size_t>(nNumLanes) < connect_socket->second.lanes.size()) return k_EResultInvalidParam;
+    if (pLaneWeights) {
+        for (int i = 0; i < nNumLanes; ++i) {
+            if (pLaneWeights[i] == 0) return k_EResultInvalidParam;
+        }
+    }
+
+    connect_socket->second.lanes.resize(nNumLanes);
+    for (int i = 0; i < nNumLanes; ++i) {
+        Connection_Lane &lane = connect_socket->second.lanes[i];
+        lane.priority = pLanePriorities ? pLanePriorities[i] : 0;
+        lane.weight = pLaneWeights ? pLaneWeights[i] : 1;
+        // restart bandwidth sharing
+        lane.last_finish = connect_socket->second.lanes_virtual_time;
+    }
+
     return k_EResultOK;
 }
 
@@ -1262,7 +1597,7 @@ HSteamNetPollGroup Steam_Networking_Sockets::CreatePollGroup()
     ++poll_group_counter;
 
     HSteamNetPollGroup poll_group_number = poll_group_counter;
-    sbcs->poll_groups[poll_group_number] = std::list<HSteamNetConnection>();
+    sbcs->poll_groups[poll_group_number] = Poll_Group();
     return poll_group_number;
 }
 
@@ -1280,7 +1615,7 @@ bool Steam_Networking_Sockets::DestroyPollGroup( HSteamNetPollGroup hPollGroup )
         return false;
     }
 
-    for (auto c : group->second) {
+    for (auto c : group->second.connections) {
         auto connect_socket = sbcs->connect_sockets.find(c);
         if (connect_socket != sbcs->connect_sockets.end()) {
             connect_socket->second.poll_group = k_HSteamNetPollGroup_Invalid;
@@ -1319,20 +1654,18 @@ bool Steam_Networking_Sockets::SetConnectionPollGroup( HSteamNetConnection hConn
         return false;
     }
 
-    HSteamNetPollGroup old_poll_group = connect_socket->second.poll_group;
-    if (old_poll_group != k_HSteamNetPollGroup_Invalid) {
-        auto group = sbcs->poll_groups.find(hPollGroup);
-        if (group != sbcs->poll_groups.end()) {
-            group->second.remove(hConn);
-        }
+    leave_poll_group(hConn, connect_socket->second);
+    if (hPollGroup == k_HSteamNetPollGroup_Invalid) {
+        return true;
     }
 
     connect_socket->second.poll_group = hPollGroup;
-    if (hPollGroup == k_HSteamNetPollGroup_Invalid) {
-        return true;
+    group->second.connections.push_back(hConn);
+    // messages already pending go after the ones the group has queued
+    for (size_t i = 0; i < connect_socket->second.data.size(); ++i) {
+        group->second.ready.emplace_back(hConn, &connect_socket->second);
     }
 
-    group->second.push_back(hConn);
     return true;
 }
 
@@ -1360,14 +1693,21 @@ int Steam_Networking_Sockets::ReceiveMessagesOnPollGroup( HSteamNetPollGroup hPo
         return 0;
     }
 
-    SteamNetworkingMessage_t *msg = NULL;
+    if (!ppOutMessages || !nMaxMessages) return 0;
+
     int messages = 0;
+    auto &ready = group->second.ready;
+    while (messages < nMaxMessages && !ready.empty()) {
+        HSteamNetConnection hConn = ready.front().first;
+        struct Connect_Socket *connect_socket = ready.front().second;
+        ready.pop_front();
 
-    for (auto c : group->second) {
-        while (messages < nMaxMessages && (msg = get_steam_message_connection(c))) {
-            ppOutMessages[messages] = msg;
-            ++messages;
-        }
+        // the entry only says a message arrived, the connection still hands them out in message number order
+        SteamNetworkingMessage_t *msg = pop_steam_message(*connect_socket, hConn);
+        if (!msg) continue;
+
+        ppOutMessages[messages] = msg;
+        ++messages;
     }
 
     PRINT_DEBUG("out %i", messages);
@@ -2009,8 +2349,17 @@ void Steam_Networking_Sockets::RunCallbacks()
             socket_conn->second.connect_requests_sent += 1;
         }
 
+        update_telemetry(socket_conn->second, current_time);
+
         ++socket_conn;
     }
+
+    send_overdue_messages(current_time);
+
+    if (settings->networking_sockets_stats_dump && std::chrono::duration<double>(current_time - sbcs->last_stats_dump).count() >= SNS_STATS_DUMP_INTERVAL) {
+        sbcs->last_stats_dump = current_time;
+        dump_stats();
+    }
 }
 
 
@@ -2074,14 +2423,14 @@ void Steam_Networking_Sockets::Callback(Common_Message *msg)
             auto connect_socket = sbcs->connect_sockets.find(static_cast<HSteamNetConnection>(msg->networking_sockets().connection_id()));
             if (connect_socket != sbcs->connect_sockets.end()) {
                 if (connect_socket->second.remote_identity.GetSteamID64() == msg->source_id() && (connect_socket->second.status == CONNECT_SOCKET_CONNECTED)) {
-                    PRINT_DEBUG("got data len %zu, num " "%" PRIu64 " on connection %u", msg->networking_sockets().data().size(), msg->networking_sockets().message_number(), connect_socket->first);
-                    connect_socket->second.data.push(msg->networking_sockets());
+                    PRINT_DEBUG("got data len %zu, num " "%" PRIu64 ", batched %i on connection %u", msg->networking_sockets().data().size(), msg->networking_sockets().message_number(), msg->networking_sockets().messages_size(), connect_socket->first);
+                    queue_steam_messages(connect_socket->second, connect_socket->first, msg->mutable_networking_sockets());
                 }
             } else {
                 connect_socket = std::find_if(sbcs->connect_sockets.begin(), sbcs->connect_sockets.end(), [msg](const auto &in) {return in.second.remote_identity.GetSteamID64() == msg->source_id() && (in.second.status == CONNECT_SOCKET_NOT_ACCEPTED || in.second.status == CONNECT_SOCKET_CONNECTED) && in.second.remote_id == msg->networking_sockets().connection_id_from();});
                 if (connect_socket != sbcs->connect_sockets.end()) {
-                    PRINT_DEBUG("got data len %zu, num " "%" PRIu64 " on not accepted connection %u", msg->networking_sockets().data().size(), msg->networking_sockets().message_number(), connect_socket->first);
-                    connect_socket->second.data.push(msg->networking_sockets());
+                    PRINT_DEBUG("got data len %zu, num " "%" PRIu64 ", batched %i on not accepted connection %u", msg->networking_sockets().data().size(), msg->networking_sockets().message_number(), msg->networking_sockets().messages_size(), connect_socket->first);
+                    queue_steam_messages(connect_socket->second, connect_socket->first, msg->mutable_networking_sockets());
                 }
             }
         } else if (msg->networking_sockets().type() == Networking_Sockets::CONNECTION_END) {
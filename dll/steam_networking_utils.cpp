@@ -51,18 +51,6 @@ Steam_Networking_Utils::~Steam_Networking_Utils()
     this->run_every_runcb->remove(&Steam_Networking_Utils::steam_run_every_runcb, this);
 }
 
-void Steam_Networking_Utils::free_steam_message_data(SteamNetworkingMessage_t *pMsg)
-{
-    free(pMsg->m_pData);
-    pMsg->m_pData = NULL;
-}
-
-void Steam_Networking_Utils::delete_steam_message(SteamNetworkingMessage_t *pMsg)
-{
-    if (pMsg->m_pfnFreeData) pMsg->m_pfnFreeData(pMsg);
-    delete pMsg;
-}
-
 /// Allocate and initialize a message object.  Usually the reason
 /// you call this is to pass it to ISteamNetworkingSockets::SendMessages.
 /// The returned object will have all of the relevant fields cleared to zero.
@@ -86,18 +74,7 @@ SteamNetworkingMessage_t* Steam_Networking_Utils::AllocateMessage( int cbAllocat
 {
     PRINT_DEBUG_ENTRY();
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
-    SteamNetworkingMessage_t *pMsg = new SteamNetworkingMessage_t();
-    pMsg->m_pfnFreeData = &free_steam_message_data;
-    pMsg->m_pfnRelease = &delete_steam_message;
-    if (cbAllocateBuffer < 0)
-        cbAllocateBuffer = 0;
-
-    pMsg->m_pData = nullptr;
-    if (cbAllocateBuffer)
-        pMsg->m_pData = malloc(cbAllocateBuffer);
-
-    pMsg->m_cbSize = cbAllocateBuffer;
-    return pMsg;
+    return Steam_Networking_Message_Pool::allocate(cbAllocateBuffer);
 }
 
 bool Steam_Networking_Utils::InitializeRelayAccess()
@@ -247,7 +247,8 @@ bool Steam_Remote_Storage::FileWriteStreamClose( UGCFileWriteStreamHandle_t writ
 
     local_storage->store_data(Local_Storage::remote_storage_folder, request->file_name, request->file_data.data(), static_cast<unsigned int>(request->file_data.size()));
     stream_writes.erase(request);
-    return true;
+    // closing a write stream is a durability point, the file must be on disk when we return
+    return local_storage->flush();
 }
 
 bool Steam_Remote_Storage::FileWriteStreamCancel( UGCFileWriteStreamHandle_t writeHandle )
@@ -112,30 +112,312 @@ bool achievement_trigger::should_indicate_progress(int32 stat) const
 
 void Steam_User_Stats::load_achievements_db()
 {
+    nlohmann::json defined_achievements = nlohmann::json::object();
     std::string file_path = Local_Storage::get_game_settings_path() + achievements_user_file;
     local_storage->load_json(file_path, defined_achievements);
+
+    for (auto &it : defined_achievements) {
+        std::string name{};
+        try {
+            name = static_cast<std::string const&>(it["name"]);
+        } catch(...) {
+            continue;
+        }
+
+        int id = static_cast<int>(achievements.size());
+        achievements.ids.emplace(common_helpers::ascii_to_lowercase(name), id); // the first definition wins
+        sorted_achievement_names.push_back(name);
+
+        achievement_trigger trig{};
+        try {
+            trig.name = name;
+            trig.value_operation = static_cast<std::string const&>(it["progress"]["value"]["operation"]);
+            std::string stat_name = common_helpers::ascii_to_lowercase(static_cast<std::string const&>(it["progress"]["value"]["operand1"]));
+            trig.min_value = static_cast<std::string const&>(it["progress"]["min_val"]);
+            trig.max_value = static_cast<std::string const&>(it["progress"]["max_val"]);
+            achievement_stat_trigger[stat_name].push_back(trig);
+        } catch(...) {}
+
+        bool schema_progress = it.contains("progress");
+        uint32 progress_min = 0;
+        try {
+            if (schema_progress) progress_min = std::stoul(it["progress"].value("min_val", std::string("0")));
+        } catch(...) {}
+        // only achievements unlocked by a stat start with a progress
+        uint32 progress_max = 0;
+        try {
+            std::stoul(trig.min_value);
+            progress_max = std::stoul(trig.max_value);
+        } catch(...) {}
+
+        std::string hidden{};
+        try {
+            hidden = std::to_string(it["hidden"].get<int>());
+        } catch(...) {
+            try {
+                hidden = it["hidden"].get<std::string>();
+            } catch(...) {}
+        }
+
+        std::string icon{};
+        std::string icon_gray{};
+        try {
+            icon = it.value("icon", std::string());
+            icon_gray = it.value("icon_gray", std::string());
+            if (icon_gray.empty()) icon_gray = it.value("icongray", std::string()); // old format
+        } catch(...) {}
+
+        achievements.name.push_back(name);
+        achievements.display_name.push_back(get_value_for_language(it, "displayName", settings->get_language()));
+        achievements.description.push_back(get_value_for_language(it, "description", settings->get_language()));
+        achievements.hidden.push_back(hidden);
+        achievements.icon.push_back(icon);
+        achievements.icon_gray.push_back(icon_gray);
+        achievements.schema_progress.push_back(schema_progress);
+        achievements.progress_min.push_back(progress_min);
+        achievements.progress_max.push_back(progress_max);
+    }
+
+    size_t count = achievements.size();
+    achievements.earned.assign(count, false);
+    achievements.earned_time.assign(count, 0);
+    achievements.has_progress.assign(count, false);
+    achievements.progress.assign(count, 0);
+    achievements.max_progress.assign(count, 0);
+
+    //TODO: not sure if the sort is actually case insensitive, ach names seem to be treated by steam as case insensitive so I assume they are.
+    //need to find a game with achievements of different case names to confirm
+    std::sort(sorted_achievement_names.begin(), sorted_achievement_names.end(), [](const std::string lhs, const std::string rhs){
+        const auto result = std::mismatch(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(), [](const unsigned char lhs, const unsigned char rhs){return std::tolower(lhs) == std::tolower(rhs);});
+        return result.second != rhs.cend() && (result.first == lhs.cend() || std::tolower(*result.first) < std::tolower(*result.second));}
+    );
 }
 
-void Steam_User_Stats::load_achievements()
+void Steam_User_Stats::load_user_achievements()
 {
+    user_achievements_loaded = true;
     local_storage->load_json_file("", achievements_user_file, user_achievements);
+
+    for (size_t id = 0; id < achievements.size(); ++id) {
+        try {
+            // default initial values, will only be added if they don't exist already
+            auto &user_ach = user_achievements[achievements.name[id]]; // this will create a new json entry if the key didn't exist already
+            user_ach.emplace("earned", false);
+            user_ach.emplace("earned_time", static_cast<uint32>(0));
+            // achievements with no progress don't have these values
+            if (achievements.progress_max[id]) {
+                user_ach.emplace("progress", achievements.progress_min[id]);
+                user_ach.emplace("max_progress", achievements.progress_max[id]);
+            }
+        } catch(...) {}
+    }
+}
+
+void Steam_User_Stats::load_achievements()
+{
+    load_user_achievements();
+
+    for (size_t id = 0; id < achievements.size(); ++id) {
+        try {
+            const auto &user_ach = user_achievements[achievements.name[id]];
+            achievements.earned[id] = user_ach.value("earned", false);
+            achievements.earned_time[id] = user_ach.value("earned_time", static_cast<uint32>(0));
+
+            auto it_progress = user_ach.find("progress");
+            auto it_max_progress = user_ach.find("max_progress");
+            if (user_ach.end() != it_progress && user_ach.end() != it_max_progress) {
+                achievements.has_progress[id] = true;
+                for (auto [it_value, value] : { std::make_pair(it_progress, &achievements.progress[id]), std::make_pair(it_max_progress, &achievements.max_progress[id]) }) {
+                    try {
+                        if (it_value->is_number()) {
+                            *value = it_value->get<float>();
+                        } else {
+                            auto s_ptr = it_value->get_ptr<const std::string*>();
+                            if (s_ptr) *value = std::stof(*s_ptr);
+                        }
+                    } catch(...) {}
+                }
+            }
+        } catch(...) {}
+    }
+}
+
+nlohmann::json &Steam_User_Stats::get_user_achievements()
+{
+    if (!user_achievements_loaded) load_user_achievements();
+
+    return user_achievements;
 }
 
 void Steam_User_Stats::save_achievements()
 {
-    local_storage->write_json_file("", achievements_user_file, user_achievements);
+    snapshot_current = false;
+    local_storage->write_json_file("", achievements_user_file, get_user_achievements());
+}
+
+void Steam_User_Stats::load_stats()
+{
+    nlohmann::json stats_json = nlohmann::json::object();
+    bool has_file = local_storage->load_json_file("", stats_user_file, stats_json) && stats_json.is_object();
+    if (has_file) {
+        for (auto &stat : stats_json.items()) {
+            try {
+                std::string stat_name(common_helpers::ascii_to_lowercase(stat.key()));
+                const auto &value = stat.value();
+                if (value.is_array()) { // avgrate: average, count, session length
+                    stats_cache_float[stat_name] = value.at(0).get<float>();
+                    stats_avgrate_totals[stat_name] = { value.at(1).get<float>(), value.at(2).get<double>() };
+                } else if (value.is_number_integer()) {
+                    stats_cache_int[stat_name] = value.get<int32>();
+                } else if (value.is_number()) {
+                    stats_cache_float[stat_name] = value.get<float>();
+                } else {
+                    continue;
+                }
+
+                stats_stored.insert(stat_name);
+            } catch(...) {}
+        }
+
+        return;
+    }
+
+    // first run with the single file, bring over the stats saved by older builds
+    // anything not found here (stats added later, unknown stats) is still looked up in the old files on first use
+    for (const auto &stat : settings->getStats()) {
+        std::string stat_name(common_helpers::ascii_to_lowercase(stat.first));
+        load_legacy_stat(stat_name, stat.second.type);
+    }
+
+    if (stats_dirty) {
+        PRINT_DEBUG("migrated %zu stats to '%s'", stats_stored.size(), stats_user_file);
+        save_stats();
+    }
+}
+
+// reads a stat saved in its own file by older builds, the result is kept for the next save
+bool Steam_User_Stats::load_legacy_stat(const std::string &stat_name, GameServerStats_Messages::StatInfo::Stat_Type type)
+{
+    switch (type) {
+    case GameServerStats_Messages::StatInfo::STAT_TYPE_INT: {
+        int32 data = 0;
+        if (local_storage->get_data(Local_Storage::stats_storage_folder, stat_name, (char *)&data, sizeof(data)) != sizeof(data)) return false;
+        stats_cache_int[stat_name] = data;
+    }
+    break;
+
+    case GameServerStats_Messages::StatInfo::STAT_TYPE_FLOAT: {
+        float data = 0;
+        if (local_storage->get_data(Local_Storage::stats_storage_folder, stat_name, (char *)&data, sizeof(data)) != sizeof(data)) return false;
+        stats_cache_float[stat_name] = data;
+    }
+    break;
+
+    case GameServerStats_Messages::StatInfo::STAT_TYPE_AVGRATE: {
+        // average, count, session length
+        char data[sizeof(float) + sizeof(float) + sizeof(double)];
+        int read_data = local_storage->get_data(Local_Storage::stats_storage_folder, stat_name, data, sizeof(data));
+        float average = 0, count = 0;
+        double session_length = 0;
+        if (read_data == sizeof(data)) {
+            memcpy(&average, data, sizeof(average));
+            memcpy(&count, data + sizeof(float), sizeof(count));
+            memcpy(&session_length, data + sizeof(float) + sizeof(float), sizeof(session_length));
+        } else if (read_data == sizeof(float)) { // set with SetStat()
+            memcpy(&average, data, sizeof(average));
+        } else {
+            return false;
+        }
+
+        stats_cache_float[stat_name] = average;
+        stats_avgrate_totals[stat_name] = { count, session_length };
+    }
+    break;
+
+    default: return false;
+    }
+
+    mark_stat_changed(stat_name);
+    return true;
 }
 
+void Steam_User_Stats::mark_stat_changed(const std::string &stat_name)
+{
+    snapshot_current = false;
+    stats_stored.insert(stat_name);
+    if (!stats_dirty) {
+        stats_dirty = true;
+        stats_dirty_since = std::chrono::steady_clock::now();
+    }
+}
 
-nlohmann::detail::iter_impl<nlohmann::json> Steam_User_Stats::defined_achievements_find(const std::string &key)
+void Steam_User_Stats::save_stats()
 {
-    return std::find_if(
-        defined_achievements.begin(), defined_achievements.end(),
-        [&key](const nlohmann::json& item) {
-            const std::string &name = static_cast<const std::string &>( item.value("name", std::string()) );
-            return common_helpers::str_cmp_insensitive(key, name);
+    if (!stats_dirty) return;
+
+    nlohmann::json stats_json = nlohmann::json::object();
+    for (const auto &stat_name : stats_stored) {
+        auto int_stat = stats_cache_int.find(stat_name);
+        if (stats_cache_int.end() != int_stat) {
+            stats_json[stat_name] = int_stat->second;
+            continue;
         }
-    );
+
+        auto float_stat = stats_cache_float.find(stat_name);
+        if (stats_cache_float.end() == float_stat) continue;
+
+        auto totals = stats_avgrate_totals.find(stat_name);
+        if (stats_avgrate_totals.end() != totals) {
+            stats_json[stat_name] = nlohmann::json::array({ float_stat->second, totals->second.first, totals->second.second });
+        } else {
+            stats_json[stat_name] = float_stat->second;
+        }
+    }
+
+    std::string data(stats_json.dump());
+    if (local_storage->store_data("", stats_user_file, &data[0], static_cast<unsigned int>(data.size())) == static_cast<int>(data.size())) {
+        stats_dirty = false;
+    }
+}
+
+void Steam_User_Stats::flush_stats()
+{
+    std::lock_guard<std::recursive_mutex> lock(global_mutex);
+    save_stats();
+    if (settings->stats_snapshot && !snapshot_current) save_snapshot();
+
+    // store_data() only queues the write, whether it reached the disk is known after the flush
+    if (!local_storage->flush()) {
+        PRINT_DEBUG("stats couldn't be written, saving them again later");
+        if (!stats_dirty) {
+            stats_dirty = true;
+            stats_dirty_since = std::chrono::steady_clock::now();
+        }
+
+        snapshot_current = false;
+    }
+}
+
+
+int Steam_User_Stats::find_achievement(const std::string &name) const
+{
+    auto it = achievements.ids.find(common_helpers::ascii_to_lowercase(name));
+    if (achievements.ids.end() == it) return -1;
+
+    return it->second;
+}
+
+nlohmann::json &Steam_User_Stats::update_user_achievement(int id)
+{
+    auto &user_ach = get_user_achievements()[achievements.name[id]];
+    user_ach["earned"] = static_cast<bool>(achievements.earned[id]);
+    user_ach["earned_time"] = achievements.earned_time[id];
+    if (achievements.has_progress[id]) {
+        user_ach["progress"] = static_cast<uint32>(achievements.progress[id]);
+        user_ach["max_progress"] = static_cast<uint32>(achievements.max_progress[id]);
+    }
+
+    return user_ach;
 }
 
 std::string Steam_User_Stats::get_value_for_language(const nlohmann::json &json, std::string_view key, std::string_view language)
@@ -399,7 +681,7 @@ bool Steam_User_Stats::clear_stats_internal()
 
             stats_cache_int[stat_name] = data;
             
-            if (needs_disk_write) local_storage->store_data(Local_Storage::stats_storage_folder, stat_name, (char *)&data, sizeof(data));
+            if (needs_disk_write) mark_stat_changed(stat_name);
         }
         break;
 
@@ -415,8 +697,12 @@ bool Steam_User_Stats::clear_stats_internal()
             }
 
             stats_cache_float[stat_name] = data;
+            if (stat.second.type == GameServerStats_Messages::StatInfo::STAT_TYPE_AVGRATE) {
+                needs_disk_write = needs_disk_write || stats_avgrate_totals.count(stat_name);
+                stats_avgrate_totals.erase(stat_name);
+            }
             
-            if (needs_disk_write) local_storage->store_data(Local_Storage::stats_storage_folder, stat_name, (char *)&data, sizeof(data));
+            if (needs_disk_write) mark_stat_changed(stat_name);
         }
         break;
         
@@ -469,18 +755,13 @@ Steam_User_Stats::InternalSetResult<int32> Steam_User_Stats::set_stat_internal(
                 bool indicate_progress = true;
                 // appid 1482380 needs that otherwise it will spam progress indications while driving
                 if (settings->save_only_higher_stat_achievement_progress) {
-                    try {
-                        auto user_ach_it =  user_achievements.find(t.name);
-                        if (user_achievements.end() != user_ach_it) {
-                            auto user_progress_it = user_ach_it->find("progress");
-                            if (user_ach_it->end() != user_progress_it) {
-                                int32 user_progress = *user_progress_it;
-                                if (nData <= user_progress) {
-                                    indicate_progress = false;
-                                }
-                            }
+                    int ach_id = find_achievement(t.name);
+                    if (ach_id >= 0 && achievements.has_progress[ach_id]) {
+                        int32 user_progress = static_cast<int32>(achievements.progress[ach_id]);
+                        if (nData <= user_progress) {
+                            indicate_progress = false;
                         }
-                    } catch(...){}
+                    }
                 }
 
                 if (indicate_progress) {
@@ -490,13 +771,10 @@ Steam_User_Stats::InternalSetResult<int32> Steam_User_Stats::set_stat_internal(
         }
     }
 
-    if (local_storage->store_data(Local_Storage::stats_storage_folder, stat_name, (char* )&nData, sizeof(nData)) == sizeof(nData)) {
-        stats_cache_int[stat_name] = nData;
-        result.success = true;
-        result.notify_server = !settings->disable_sharing_stats_with_gameserver;
-        return result;
-    }
-
+    stats_cache_int[stat_name] = nData;
+    mark_stat_changed(stat_name);
+    result.success = true;
+    result.notify_server = !settings->disable_sharing_stats_with_gameserver;
     return result;
 }
 
@@ -543,18 +821,13 @@ Steam_User_Stats::InternalSetResult<std::pair<GameServerStats_Messages::StatInfo
                 bool indicate_progress = true;
                 // appid 1482380 needs that otherwise it will spam progress indications while driving
                 if (settings->save_only_higher_stat_achievement_progress) {
-                    try {
-                        auto user_ach_it =  user_achievements.find(t.name);
-                        if (user_achievements.end() != user_ach_it) {
-                            auto user_progress_it = user_ach_it->find("progress");
-                            if (user_ach_it->end() != user_progress_it) {
-                                float user_progress = *user_progress_it;
-                                if (fData <= user_progress) {
-                                    indicate_progress = false;
-                                }
-                            }
+                    int ach_id = find_achievement(t.name);
+                    if (ach_id >= 0 && achievements.has_progress[ach_id]) {
+                        float user_progress = static_cast<float>(achievements.progress[ach_id]);
+                        if (fData <= user_progress) {
+                            indicate_progress = false;
                         }
-                    } catch(...){}
+                    }
                 }
 
                 if (indicate_progress) {
@@ -564,13 +837,10 @@ Steam_User_Stats::InternalSetResult<std::pair<GameServerStats_Messages::StatInfo
         }
     }
 
-    if (local_storage->store_data(Local_Storage::stats_storage_folder, stat_name, (char* )&fData, sizeof(fData)) == sizeof(fData)) {
-        stats_cache_float[stat_name] = fData;
-        result.success = true;
-        result.notify_server = !settings->disable_sharing_stats_with_gameserver;
-        return result;
-    }
-
+    stats_cache_float[stat_name] = fData;
+    mark_stat_changed(stat_name);
+    result.success = true;
+    result.notify_server = !settings->disable_sharing_stats_with_gameserver;
     return result;
 }
 
@@ -597,33 +867,23 @@ Steam_User_Stats::InternalSetResult<std::pair<GameServerStats_Messages::StatInfo
 
     result.internal_name = stat_name;
 
-    char data[sizeof(float) + sizeof(float) + sizeof(double)];
-    int read_data = local_storage->get_data(Local_Storage::stats_storage_folder, stat_name, (char* )data, sizeof(*data));
-    float oldcount = 0;
-    double oldsessionlength = 0;
-    if (read_data == sizeof(data)) {
-        memcpy(&oldcount, data + sizeof(float), sizeof(oldcount));
-        memcpy(&oldsessionlength, data + sizeof(float) + sizeof(float), sizeof(oldsessionlength));
+    if (!stats_avgrate_totals.count(stat_name) && !stats_stored.count(stat_name)) {
+        load_legacy_stat(stat_name, stats_data->second.type);
     }
 
-    oldcount += flCountThisSession;
-    oldsessionlength += dSessionLength;
+    auto &totals = stats_avgrate_totals[stat_name];
+    totals.first += flCountThisSession;
+    totals.second += dSessionLength;
 
-    float average = static_cast<float>(oldcount / oldsessionlength);
-    memcpy(data, &average, sizeof(average));
-    memcpy(data + sizeof(float), &oldcount, sizeof(oldcount));
-    memcpy(data + sizeof(float) * 2, &oldsessionlength, sizeof(oldsessionlength));
+    float average = static_cast<float>(totals.first / totals.second);
 
     result.current_val.first = stats_data->second.type;
     result.current_val.second = average;
 
-    if (local_storage->store_data(Local_Storage::stats_storage_folder, stat_name, data, sizeof(data)) == sizeof(data)) {
-        stats_cache_float[stat_name] = average;
-        result.success = true;
-        result.notify_server = !settings->disable_sharing_stats_with_gameserver;
-        return result;
-    }
-
+    stats_cache_float[stat_name] = average;
+    mark_stat_changed(stat_name);
+    result.success = true;
+    result.notify_server = !settings->disable_sharing_stats_with_gameserver;
     return result;
 }
 
@@ -650,35 +910,28 @@ Steam_User_Stats::InternalSetResult<bool> Steam_User_Stats::set_achievement_inte
         return result;
     }
 
-    nlohmann::detail::iter_impl<nlohmann::json> it = defined_achievements.end();
-    try {
-        it = defined_achievements_find(org_name);
-    } catch(...) { }
-    if (defined_achievements.end() == it) return result;
+    int id = find_achievement(org_name);
+    if (id < 0) return result;
 
+    const std::string &internal_name = achievements.name[id];
     result.current_val = true;
-    result.internal_name = org_name;
+    result.internal_name = internal_name;
     result.success = true;
 
-    try {
-        std::string internal_name = it->value("name", std::string());
-
-        result.internal_name = internal_name;
-
-        auto ach = user_achievements.find(internal_name);
-        if (user_achievements.end() == ach || ach->value("earned", false) == false) {
-            user_achievements[internal_name]["earned"] = true;
-            user_achievements[internal_name]["earned_time"] =
-                std::chrono::duration_cast<std::chrono::duration<uint32>>(std::chrono::system_clock::now().time_since_epoch()).count();
+    if (!achievements.earned[id]) {
+        achievements.earned[id] = true;
+        achievements.earned_time[id] =
+            std::chrono::duration_cast<std::chrono::duration<uint32>>(std::chrono::system_clock::now().time_since_epoch()).count();
 
+        try {
+            auto &user_ach = update_user_achievement(id);
             save_achievements();
 
             result.notify_server = !settings->disable_sharing_stats_with_gameserver;
 
-            overlay->AddAchievementNotification(internal_name, user_achievements[internal_name], false);
-
-        }
-    } catch (...) {}
+            overlay->AddAchievementNotification(internal_name, user_ach, false);
+        } catch (...) {}
+    }
 
     auto &trig = store_stats_trigger[common_helpers::to_lower(org_name)];
     trig.m_bGroupAchievement = false;
@@ -701,38 +954,27 @@ Steam_User_Stats::InternalSetResult<bool> Steam_User_Stats::clear_achievement_in
 
     std::string org_name(pchName);
 
-    nlohmann::detail::iter_impl<nlohmann::json> it = defined_achievements.end();
-    try {
-        it = defined_achievements_find(org_name);
-    } catch(...) { }
-    if (defined_achievements.end() == it) return result;
+    int id = find_achievement(org_name);
+    if (id < 0) return result;
 
+    const std::string &internal_name = achievements.name[id];
     result.current_val = false;
-    result.internal_name = org_name;
+    result.internal_name = internal_name;
     result.success = true;
 
-    try {
-        std::string internal_name = it->value("name", std::string());
-
-        result.internal_name = internal_name;
+    if (achievements.earned[id]) {
+        achievements.earned[id] = false;
+        achievements.earned_time[id] = 0;
 
-        auto ach = user_achievements.find(internal_name);
-        // assume "earned" is true in case the json obj exists, but the key is absent
-        // assume "earned_time" is UINT32_MAX in case the json obj exists, but the key is absent
-        if (user_achievements.end() == ach ||
-            ach->value("earned", true) == true ||
-            ach->value("earned_time", static_cast<uint32>(UINT32_MAX)) == UINT32_MAX) {
-            
-            user_achievements[internal_name]["earned"] = false;
-            user_achievements[internal_name]["earned_time"] = static_cast<uint32>(0);
+        try {
+            auto &user_ach = update_user_achievement(id);
             save_achievements();
 
             result.notify_server = !settings->disable_sharing_stats_with_gameserver;
 
-            overlay->AddAchievementNotification(internal_name, user_achievements[internal_name], false);
-
-        }
-    } catch (...) {}
+            overlay->AddAchievementNotification(internal_name, user_ach, false);
+        } catch (...) {}
+    }
 
     store_stats_trigger.erase(common_helpers::to_lower(org_name));
     
@@ -779,67 +1021,19 @@ Steam_User_Stats::Steam_User_Stats(Settings *settings, class Networking *network
     local_storage(local_storage),
     callback_results(callback_results),
     callbacks(callbacks),
-    defined_achievements(nlohmann::json::object()),
     user_achievements(nlohmann::json::object()),
     run_every_runcb(run_every_runcb),
     overlay(overlay)
 {
-    load_achievements_db(); // achievements db
-    load_achievements(); // achievements per user
-
-    auto x = defined_achievements.begin();
-    while (x != defined_achievements.end()) {
-        if (!x->contains("name")) {
-            x = defined_achievements.erase(x);
-        } else {
-            ++x;
-        }
-    }
-
-    for (auto & it : defined_achievements) {
-        try {
-            std::string name = static_cast<std::string const&>(it["name"]);
-            sorted_achievement_names.push_back(name);
-
-            achievement_trigger trig{};
-            try {
-                trig.name = name;
-                trig.value_operation = static_cast<std::string const&>(it["progress"]["value"]["operation"]);
-                std::string stat_name = common_helpers::ascii_to_lowercase(static_cast<std::string const&>(it["progress"]["value"]["operand1"]));
-                trig.min_value = static_cast<std::string const&>(it["progress"]["min_val"]);
-                trig.max_value = static_cast<std::string const&>(it["progress"]["max_val"]);
-                achievement_stat_trigger[stat_name].push_back(trig);
-            } catch(...) {}
-            
-            // default initial values, will only be added if they don't exist already
-            auto &user_ach = user_achievements[name]; // this will create a new json entry if the key didn't exist already
-            user_ach.emplace("earned", false);
-            user_ach.emplace("earned_time", static_cast<uint32>(0));
-            // they will throw an exception for achievements with no progress
-            try {
-                uint32 progress_min = std::stoul(trig.min_value);
-                uint32 progress_max = std::stoul(trig.max_value);
-                // if the above lines didn't throw exception then add the values
-                user_ach.emplace("progress", progress_min);
-                user_ach.emplace("max_progress", progress_max);
-            } catch(...) {}
-        } catch(...) {}
-
-        try {
-            it["hidden"] = std::to_string(it["hidden"].get<int>());
-        } catch(...) {}
+    if (!settings->stats_snapshot || !load_snapshot()) {
+        load_achievements_db(); // achievements db
+        load_achievements(); // achievements per user
+        load_stats(); // stats per user
 
-        it["displayName"] = get_value_for_language(it, "displayName", settings->get_language());
-        it["description"] = get_value_for_language(it, "description", settings->get_language());
+        // regenerate it now, the json sources changed or there was none
+        if (settings->stats_snapshot) save_snapshot();
     }
 
-    //TODO: not sure if the sort is actually case insensitive, ach names seem to be treated by steam as case insensitive so I assume they are.
-    //need to find a game with achievements of different case names to confirm
-    std::sort(sorted_achievement_names.begin(), sorted_achievement_names.end(), [](const std::string lhs, const std::string rhs){
-        const auto result = std::mismatch(lhs.cbegin(), lhs.cend(), rhs.cbegin(), rhs.cend(), [](const unsigned char lhs, const unsigned char rhs){return std::tolower(lhs) == std::tolower(rhs);});
-        return result.second != rhs.cend() && (result.first == lhs.cend() || std::tolower(*result.first) < std::tolower(*result.second));}
-    );
-    
     if (!settings->disable_sharing_stats_with_gameserver) {
         this->network->setCallback(CALLBACK_ID_GAMESERVER_STATS, settings->get_local_steam_id(), &Steam_User_Stats::steam_user_stats_network_stats, this);
     }
@@ -905,11 +1099,8 @@ bool Steam_User_Stats::GetStat( const char *pchName, int32 *pData )
         return true;
     }
 
-    int32 output = 0;
-    int read_data = local_storage->get_data(Local_Storage::stats_storage_folder, stat_name, (char* )&output, sizeof(output));
-    if (read_data == sizeof(int32)) {
-        stats_cache_int[stat_name] = output;
-        if (pData) *pData = output;
+    if (load_legacy_stat(stat_name, stats_data->second.type)) {
+        if (pData) *pData = stats_cache_int[stat_name];
         return true;
     }
 
@@ -944,11 +1135,8 @@ bool Steam_User_Stats::GetStat( const char *pchName, float *pData )
         return true;
     }
 
-    float output = 0.0;
-    int read_data = local_storage->get_data(Local_Storage::stats_storage_folder, stat_name, (char* )&output, sizeof(output));
-    if (read_data == sizeof(float)) {
-        stats_cache_float[stat_name] = output;
-        if (pData) *pData = output;
+    if (load_legacy_stat(stat_name, stats_data->second.type)) {
+        if (pData) *pData = stats_cache_float[stat_name];
         return true;
     }
 
@@ -1019,24 +1207,12 @@ bool Steam_User_Stats::GetAchievement( const char *pchName, bool *pbAchieved )
 
     if (!pchName) return false;
 
-    nlohmann::detail::iter_impl<nlohmann::json> it = defined_achievements.end();
-    try {
-        it = defined_achievements_find(pchName);
-    } catch(...) { }
-    if (defined_achievements.end() == it) return false;
+    int id = find_achievement(pchName);
+    if (id < 0) return false;
 
     // according to docs, the function returns true if the achievement was found,
     // regardless achieved or not 
-    if (!pbAchieved) return true;
-
-    *pbAchieved = false;
-    try {
-        std::string pch_name = it->value("name", std::string());
-        auto ach = user_achievements.find(pch_name);
-        if (user_achievements.end() != ach) {
-            *pbAchieved = ach->value("earned", false);
-        }
-    } catch (...) { }
+    if (pbAchieved) *pbAchieved = achievements.earned[id];
 
     return true;
 }
@@ -1084,23 +1260,11 @@ bool Steam_User_Stats::GetAchievementAndUnlockTime( const char *pchName, bool *p
 
     if (!pchName) return false;
 
-    nlohmann::detail::iter_impl<nlohmann::json> it = defined_achievements.end();
-    try {
-        it = defined_achievements_find(pchName);
-    } catch(...) { }
-    if (defined_achievements.end() == it) return false;
+    int id = find_achievement(pchName);
+    if (id < 0) return false;
 
-    if (pbAchieved) *pbAchieved = false;
-    if (punUnlockTime) *punUnlockTime = 0;
-    
-    try {
-        std::string pch_name = it->value("name", std::string());
-        auto ach = user_achievements.find(pch_name);
-        if (user_achievements.end() != ach) {
-            if (pbAchieved) *pbAchieved = ach->value("earned", false);
-            if (punUnlockTime) *punUnlockTime = ach->value("earned_time", static_cast<uint32>(0));
-        }
-    } catch (...) {}
+    if (pbAchieved) *pbAchieved = achievements.earned[id];
+    if (punUnlockTime) *punUnlockTime = achievements.earned_time[id];
 
     return true;
 }
@@ -1123,6 +1287,7 @@ bool Steam_User_Stats::StoreStats()
     data.m_eResult = k_EResultOK;
     data.m_nGameID = settings->get_local_game_id().ToUint64();
     callbacks->addCBResult(data.k_iCallback, &data, sizeof(data), 0.01);
+    save_stats();
 
     for (auto &kv : store_stats_trigger) {
         callbacks->addCBResult(kv.second.k_iCallback, &kv.second, sizeof(kv.second));
@@ -1141,12 +1306,30 @@ bool Steam_User_Stats::StoreStats()
 // specified achievement.
 int Steam_User_Stats::GetAchievementIcon( const char *pchName )
 {
-    PRINT_DEBUG_TODO();
+    PRINT_DEBUG("'%s'", pchName);
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
     if (!pchName) return 0;
 
-    // callbacks->addCBResult(data.k_iCallback, &data, sizeof(data));
-    return 0;
+    int id = find_achievement(pchName);
+    if (id < 0) return 0;
+
+    const std::string &icon_name = achievements.earned[id] ? achievements.icon[id] : achievements.icon_gray[id];
+    if (icon_name.empty()) return 0;
+
+    auto icon_image = achievement_icon_images.find(icon_name);
+    if (achievement_icon_images.end() != icon_image && settings->get_image(icon_image->second)) {
+        return icon_image->second;
+    }
+
+    std::string file_path(Local_Storage::get_game_settings_path() + icon_name);
+    if (!file_size_(file_path)) return 0;
+
+    std::string img(Local_Storage::load_image_resized(file_path, "", 64));
+    if (img.empty()) return 0;
+
+    int image = settings->add_image(img, 64, 64, false);
+    achievement_icon_images[icon_name] = image;
+    return image;
 }
 
 std::string Steam_User_Stats::get_achievement_icon_name( const char *pchName, bool pbAchieved )
@@ -1154,21 +1337,12 @@ std::string Steam_User_Stats::get_achievement_icon_name( const char *pchName, bo
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
     if (!pchName) return "";
 
-    nlohmann::detail::iter_impl<nlohmann::json> it = defined_achievements.end();
-    try {
-        it = defined_achievements_find(pchName);
-    } catch(...) { }
-    if (defined_achievements.end() == it) return "";
+    int id = find_achievement(pchName);
+    if (id < 0) return "";
 
-    try {
-        if (pbAchieved) return it.value()["icon"].get<std::string>();
-        
-        std::string locked_icon = it.value().value("icon_gray", std::string());
-        if (locked_icon.size()) return locked_icon;
-        else return it.value().value("icongray", std::string()); // old format
-    } catch (...) {}
+    if (pbAchieved) return achievements.icon[id];
 
-    return "";
+    return achievements.icon_gray[id];
 }
 
 
@@ -1182,24 +1356,15 @@ const char * Steam_User_Stats::GetAchievementDisplayAttribute( const char *pchNa
 
     if (!pchName || !pchKey || !pchKey[0]) return "";
 
-    nlohmann::detail::iter_impl<nlohmann::json> it = defined_achievements.end();
-    try {
-        it = defined_achievements_find(pchName);
-    } catch(...) { }
-    if (defined_achievements.end() == it) return "";
+    int id = find_achievement(pchName);
+    if (id < 0) return "";
 
     if (strncmp(pchKey, "name", sizeof("name")) == 0) {
-        try {
-            return it.value()["displayName"].get_ptr<std::string*>()->c_str();
-        } catch (...) {}
+        return achievements.display_name[id].c_str();
     } else if (strncmp(pchKey, "desc", sizeof("desc")) == 0) {
-        try {
-            return it.value()["description"].get_ptr<std::string*>()->c_str();
-        } catch (...) {}
+        return achievements.description[id].c_str();
     } else if (strncmp(pchKey, "hidden", sizeof("hidden")) == 0) {
-        try {
-            return it.value()["hidden"].get_ptr<std::string*>()->c_str();
-        } catch (...) {}
+        return achievements.hidden[id].c_str();
     }
 
     return "";
@@ -1219,43 +1384,25 @@ bool Steam_User_Stats::IndicateAchievementProgress( const char *pchName, uint32
     std::string ach_name(pchName);
 
     // find in achievements.json
-    nlohmann::detail::iter_impl<nlohmann::json> it = defined_achievements.end();
-    try {
-        it = defined_achievements_find(ach_name);
-    } catch(...) { }
-    if (defined_achievements.end() == it) return false;
-
-    // get actual name from achievements.json
-    std::string actual_ach_name{};
-    try {
-        actual_ach_name = it->value("name", std::string());
-    } catch (...) { }
-    if (actual_ach_name.empty()) { // fallback
-        actual_ach_name = ach_name;
-    }
+    int id = find_achievement(ach_name);
+    if (id < 0) return false;
 
     // check if already achieved
-    bool achieved = false;
-    try {
-        auto ach = user_achievements.find(actual_ach_name);
-        if (ach != user_achievements.end()) {
-            achieved = ach->value("earned", false);
-        }
-    } catch (...) { }
-    if (achieved) return false;
+    if (achievements.earned[id]) return false;
 
     // save new progress
-    try {
-        auto old_progress = user_achievements.value(actual_ach_name, nlohmann::json{}).value("progress", ~nCurProgress);
-        if (old_progress != nCurProgress) {
-            user_achievements[actual_ach_name]["progress"] = nCurProgress;
-            user_achievements[actual_ach_name]["max_progress"] = nMaxProgress;
-            
+    if (!achievements.has_progress[id] || static_cast<uint32>(achievements.progress[id]) != nCurProgress) {
+        achievements.has_progress[id] = true;
+        achievements.progress[id] = static_cast<float>(nCurProgress);
+        achievements.max_progress[id] = static_cast<float>(nMaxProgress);
+
+        try {
+            auto &user_ach = update_user_achievement(id);
             save_achievements();
-            
-            overlay->AddAchievementNotification(actual_ach_name, user_achievements[actual_ach_name], true);
-        }
-    } catch (...) {}
+
+            overlay->AddAchievementNotification(achievements.name[id], user_ach, true);
+        } catch (...) {}
+    }
 
     {
         UserStatsStored_t data{};
@@ -1285,7 +1432,7 @@ uint32 Steam_User_Stats::GetNumAchievements()
 {
     PRINT_DEBUG_ENTRY();
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
-    return (uint32)defined_achievements.size();
+    return (uint32)achievements.size();
 }
 
 // Get achievement name iAchievement in [0,GetNumAchievements)
@@ -1425,7 +1572,7 @@ bool Steam_User_Stats::ResetAllStats( bool bAchievementsToo )
 
     if (bAchievementsToo) {
         bool needs_disk_write = false;
-        for (auto &kv : user_achievements.items()) {
+        for (auto &kv : get_user_achievements().items()) {
             try {
                 auto &name = kv.key();
                 auto &item = kv.value();
@@ -1435,20 +1582,15 @@ bool Steam_User_Stats::ResetAllStats( bool bAchievementsToo )
                 item["earned"] = false;
                 item["earned_time"] = static_cast<uint32>(0);
 
-                try {
-                    auto defined_ach_it = defined_achievements_find(name);
-                    if (defined_achievements.end() != defined_ach_it) {
-                        auto defined_progress_it = defined_ach_it->find("progress");
-                        if (defined_ach_it->end() != defined_progress_it) { // if the schema had "progress"
-                            uint32 val = 0;
-                            try {
-                                auto defined_min_val = defined_progress_it->value("min_val", std::string("0"));
-                                val = std::stoul(defined_min_val);
-                            } catch(...){}
-                            item["progress"] = val;
-                        }
+                int id = find_achievement(name);
+                if (id >= 0) {
+                    achievements.earned[id] = false;
+                    achievements.earned_time[id] = 0;
+                    if (achievements.schema_progress[id]) {
+                        item["progress"] = achievements.progress_min[id];
+                        if (achievements.has_progress[id]) achievements.progress[id] = static_cast<float>(achievements.progress_min[id]);
                     }
-                }catch(...){}
+                }
                 
                 // this won't actually trigger a notification, just updates the data
                 overlay->AddAchievementNotification(name, item, false);
@@ -1883,7 +2025,7 @@ int Steam_User_Stats::GetNextMostAchievedAchievementInfo( int iIteratorPrevious,
     if (iIteratorPrevious < 0) return -1;
     
     unsigned iIteratorCurrent = static_cast<unsigned>(iIteratorPrevious + 1);
-    if (iIteratorCurrent >= defined_achievements.size()) return -1;
+    if (iIteratorCurrent >= achievements.size()) return -1;
 
     std::string name(GetAchievementName(iIteratorCurrent));
     if (name.empty()) return -1;
@@ -1894,7 +2036,7 @@ int Steam_User_Stats::GetNextMostAchievedAchievementInfo( int iIteratorPrevious,
     }
 
     if (pflPercent) {
-        *pflPercent = (float)(90 * (defined_achievements.size() - iIteratorCurrent) / defined_achievements.size());
+        *pflPercent = (float)(90 * (achievements.size() - iIteratorCurrent) / achievements.size());
     }
     if (pbAchieved) {
         bool achieved = false;
@@ -1912,12 +2054,13 @@ bool Steam_User_Stats::GetAchievementAchievedPercent( const char *pchName, float
     PRINT_DEBUG("'%s'", pchName);
     std::lock_guard<std::recursive_mutex> lock(global_mutex);
 
-    auto it = defined_achievements_find(pchName);
-    if (defined_achievements.end() == it) return false;
+    if (!pchName) return false;
+
+    int id = find_achievement(pchName);
+    if (id < 0) return false;
 
-    size_t idx = it - defined_achievements.begin();
     if (pflPercent) {
-        *pflPercent = (float)(90 * (defined_achievements.size() - idx) / defined_achievements.size());
+        *pflPercent = (float)(90 * (achievements.size() - id) / achievements.size());
     }
     
     return true;
@@ -2001,54 +2144,16 @@ bool Steam_User_Stats::GetAchievementProgressLimits( const char *pchName, float
 
     if (!pchName) return false;
 
-    auto it = defined_achievements.end();
-    try {
-        it = defined_achievements_find(pchName);
-    }
-    catch (...) {}
-    if (defined_achievements.end() == it) return false;
+    int id = find_achievement(pchName);
+    if (id < 0) return false;
 
     if (pfMinProgress) *pfMinProgress = 0;
     if (pfMaxProgress) *pfMaxProgress = 0;
+    if (!achievements.has_progress[id]) return false;
 
-    try {
-        std::string pch_name = it->value("name", std::string());
-        auto ach = user_achievements.find(pch_name);
-        if (user_achievements.end() != ach) {
-            auto it_progress = ach->find("progress");
-            auto it_max_progress = ach->find("max_progress");
-            if (ach->end() == it_progress || ach->end() == it_max_progress) return false;
-
-            if (pfMinProgress) {
-                try {
-                    if (it_progress->is_number()) {
-                        *pfMinProgress = it_progress->get<float>();
-                    } else {
-                        auto s_ptr = it_progress->get_ptr<std::string*>();
-                        if (s_ptr) {
-                            *pfMinProgress  = std::stof(*s_ptr);
-                        }
-                    }
-                }catch(...){}
-            }
-            if (pfMaxProgress) {
-                try {
-                    if (it_max_progress->is_number()) {
-                        *pfMaxProgress = it_max_progress->get<float>();
-                    } else {
-                        auto s_ptr = it_max_progress->get_ptr<std::string*>();
-                        if (s_ptr) {
-                            *pfMaxProgress  = std::stof(*s_ptr);
-                        }
-                    }
-                }catch(...){}
-            }
-            return true;
-        }
-    }
-    catch (...) {}
-
-    return false;
+    if (pfMinProgress) *pfMinProgress = achievements.progress[id];
+    if (pfMaxProgress) *pfMaxProgress = achievements.max_progress[id];
+    return true;
 }
 
 
@@ -2084,6 +2189,10 @@ void Steam_User_Stats::send_updated_stats()
 void Steam_User_Stats::steam_run_callback()
 {
     send_updated_stats();
+
+    if (stats_dirty && std::chrono::duration<double>(std::chrono::steady_clock::now() - stats_dirty_since).count() >= stats_save_interval) {
+        save_stats();
+    }
 }
 
 
@@ -2134,14 +2243,11 @@ void Steam_User_Stats::network_stats_initial(Common_Message *msg)
 
     // get all achievements
     auto &achievements_map = *all_stats_msg->mutable_user_achievements();
-    for (const auto &ach : defined_achievements) {
-        const std::string &name = static_cast<const std::string &>( ach.value("name", std::string()) );
-        auto &this_ach = achievements_map[name];
+    for (size_t id = 0; id < achievements.size(); ++id) {
+        auto &this_ach = achievements_map[achievements.name[id]];
 
         // achieved or not
-        bool achieved = false;
-        GetAchievement(name.c_str(), &achieved);
-        this_ach.set_achieved(achieved);
+        this_ach.set_achieved(achievements.earned[id]);
     }
 
     auto initial_stats_msg = new GameServerStats_Messages::InitialAllStats();
@@ -0,0 +1,342 @@
+/* Copyright (C) 2019 Mr Goldberg
+   This file is part of the Goldberg Emulator
+
+   The Goldberg Emulator is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 3 of the License, or (at your option) any later version.
+
+   The Goldberg Emulator is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the Goldberg Emulator; if not, see
+   <http://www.gnu.org/licenses/>.  */
+
+#include "dll/steam_user_stats.h"
+
+// layout of stats_snapshot.bin, native byte order since it never leaves this machine:
+//   header : magic (u32), version (u32), sources (4 x u64), payload size (u64), payload hash (u64)
+//   payload: the compiled achievements table with the user state, the sorted names,
+//            the stat triggers and the stored stats, defaults are left to the stat definitions
+// strings are a u32 length followed by the bytes, every list starts with a u32 count
+
+// hash of a source file which doesn't exist, anything but the hash of an empty file
+static constexpr uint64 SNAPSHOT_MISSING_SOURCE = 1;
+
+static uint64 snapshot_hash(const char *data, size_t size, uint64 hash = common_helpers::FNV1A_64_SEED)
+{
+    return common_helpers::fnv1a_64(std::string_view(data, size), hash);
+}
+
+class Snapshot_Writer {
+    std::string &out;
+
+public:
+    Snapshot_Writer(std::string &out): out(out) {}
+
+    template<typename T>
+    void put(T value)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+    }
+
+    void put(const std::string &str)
+    {
+        put(static_cast<uint32>(str.size()));
+        out.append(str);
+    }
+};
+
+// throws on truncated/corrupted data
+class Snapshot_Reader {
+    const std::string &in;
+    size_t pos{};
+
+public:
+    Snapshot_Reader(const std::string &in, size_t pos = 0): in(in), pos(pos) {}
+
+    size_t position() const { return pos; }
+
+    template<typename T>
+    T get()
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (in.size() - pos < sizeof(T)) throw std::out_of_range("snapshot truncated");
+
+        T value{};
+        memcpy(&value, in.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    }
+
+    std::string get_str()
+    {
+        uint32 size = get<uint32>();
+        if (in.size() - pos < size) throw std::out_of_range("snapshot truncated");
+
+        std::string str(in, pos, size);
+        pos += size;
+        return str;
+    }
+
+    uint32 get_count()
+    {
+        uint32 count = get<uint32>();
+        // every item takes at least one byte, rejects garbage counts before allocating anything
+        if (in.size() - pos < count) throw std::out_of_range("snapshot count out of range");
+
+        return count;
+    }
+};
+
+bool Steam_User_Stats::Snapshot_Sources::operator==(const Snapshot_Sources &other) const
+{
+    return schema == other.schema && achievements == other.achievements && stats == other.stats && stat_definitions == other.stat_definitions;
+}
+
+Steam_User_Stats::Snapshot_Sources Steam_User_Stats::get_snapshot_sources()
+{
+    Snapshot_Sources sources{};
+
+    // the display strings are compiled for the current language
+    const std::string &language = settings->get_language();
+    sources.schema = snapshot_hash(language.data(), language.size());
+    std::ifstream schema_file(std::filesystem::u8path(Local_Storage::get_game_settings_path() + achievements_user_file), std::ios::in | std::ios::binary);
+    if (schema_file) {
+        char buffer[16 * 1024];
+        while (schema_file.read(buffer, sizeof(buffer)) || schema_file.gcount() > 0) {
+            sources.schema = snapshot_hash(buffer, static_cast<size_t>(schema_file.gcount()), sources.schema);
+        }
+    } else {
+        sources.schema ^= SNAPSHOT_MISSING_SOURCE;
+    }
+
+    for (auto [file, hash] : { std::make_pair(achievements_user_file, &sources.achievements), std::make_pair(stats_user_file, &sources.stats) }) {
+        if (!local_storage->file_exists("", file)) {
+            *hash = SNAPSHOT_MISSING_SOURCE;
+            continue;
+        }
+
+        std::string data(local_storage->file_size("", file), '\0');
+        int read = data.size() ? local_storage->get_data("", file, &data[0], static_cast<unsigned int>(data.size())) : 0;
+        *hash = snapshot_hash(data.data(), read > 0 ? static_cast<size_t>(read) : 0);
+    }
+
+    // the achievement triggers and avgrate stats depend on them
+    if (!snapshot_stat_definitions) {
+        snapshot_stat_definitions = common_helpers::FNV1A_64_SEED;
+        for (const auto &stat : settings->getStats()) {
+            auto type = static_cast<uint32>(stat.second.type);
+            int32 default_value = stat.second.default_value_int; // same bytes for float stats
+            snapshot_stat_definitions = snapshot_hash(stat.first.data(), stat.first.size() + 1, snapshot_stat_definitions);
+            snapshot_stat_definitions = snapshot_hash(reinterpret_cast<const char *>(&type), sizeof(type), snapshot_stat_definitions);
+            snapshot_stat_definitions = snapshot_hash(reinterpret_cast<const char *>(&default_value), sizeof(default_value), snapshot_stat_definitions);
+        }
+    }
+
+    sources.stat_definitions = snapshot_stat_definitions;
+    return sources;
+}
+
+bool Steam_User_Stats::load_snapshot()
+{
+    unsigned int size = local_storage->file_size("", snapshot_user_file);
+    if (!size) return false;
+
+    std::string data(size, '\0');
+    if (local_storage->get_data("", snapshot_user_file, &data[0], size) != static_cast<int>(size)) return false;
+
+    try {
+        Snapshot_Reader header(data);
+        if (header.get<uint32>() != snapshot_magic) return false;
+        if (header.get<uint32>() != snapshot_version) {
+            PRINT_DEBUG("ignoring snapshot of another version");
+            return false;
+        }
+
+        Snapshot_Sources sources{};
+        sources.schema = header.get<uint64>();
+        sources.achievements = header.get<uint64>();
+        sources.stats = header.get<uint64>();
+        sources.stat_definitions = header.get<uint64>();
+        uint64 payload_size = header.get<uint64>();
+        uint64 payload_hash = header.get<uint64>();
+        if (payload_size != data.size() - header.position() ||
+            payload_hash != snapshot_hash(data.data() + header.position(), data.size() - header.position())) {
+            PRINT_DEBUG("snapshot is corrupted");
+            return false;
+        }
+
+        if (!(sources == get_snapshot_sources())) {
+            PRINT_DEBUG("snapshot is outdated");
+            return false;
+        }
+
+        // decode into locals so a bad snapshot can't leave a half loaded state behind
+        Achievement_Table table{};
+        std::vector<std::string> sorted_names{};
+        std::map<std::string, std::vector<achievement_trigger>> triggers{};
+        std::map<std::string, int32> cache_int{};
+        std::map<std::string, float> cache_float{};
+        std::map<std::string, std::pair<float, double>> avgrate_totals{};
+        std::set<std::string> stored{};
+
+        Snapshot_Reader in(data, header.position());
+        for (uint32 count = in.get_count(); count; --count) {
+            std::string name(in.get_str());
+            table.ids.emplace(common_helpers::ascii_to_lowercase(name), static_cast<int>(table.size())); // the first definition wins
+            table.name.push_back(std::move(name));
+            table.display_name.push_back(in.get_str());
+            table.description.push_back(in.get_str());
+            table.hidden.push_back(in.get_str());
+            table.icon.push_back(in.get_str());
+            table.icon_gray.push_back(in.get_str());
+            table.schema_progress.push_back(in.get<uint8>());
+            table.progress_min.push_back(in.get<uint32>());
+            table.progress_max.push_back(in.get<uint32>());
+            table.earned.push_back(in.get<uint8>());
+            table.earned_time.push_back(in.get<uint32>());
+            table.has_progress.push_back(in.get<uint8>());
+            table.progress.push_back(in.get<float>());
+            table.max_progress.push_back(in.get<float>());
+        }
+
+        for (uint32 count = in.get_count(); count; --count) {
+            sorted_names.push_back(in.get_str());
+        }
+
+        for (uint32 count = in.get_count(); count; --count) {
+            auto &stat_triggers = triggers[in.get_str()];
+            for (uint32 trigger_count = in.get_count(); trigger_count; --trigger_count) {
+                achievement_trigger trig{};
+                trig.name = in.get_str();
+                trig.value_operation = in.get_str();
+                trig.min_value = in.get_str();
+                trig.max_value = in.get_str();
+                stat_triggers.push_back(std::move(trig));
+            }
+        }
+
+        for (uint32 count = in.get_count(); count; --count) {
+            std::string name(in.get_str());
+            cache_int[name] = in.get<int32>();
+        }
+
+        for (uint32 count = in.get_count(); count; --count) {
+            std::string name(in.get_str());
+            cache_float[name] = in.get<float>();
+        }
+
+        for (uint32 count = in.get_count(); count; --count) {
+            std::string name(in.get_str());
+            float total_count = in.get<float>();
+            avgrate_totals[name] = { total_count, in.get<double>() };
+        }
+
+        for (uint32 count = in.get_count(); count; --count) {
+            stored.insert(in.get_str());
+        }
+
+        achievements = std::move(table);
+        sorted_achievement_names = std::move(sorted_names);
+        achievement_stat_trigger = std::move(triggers);
+        stats_cache_int = std::move(cache_int);
+        stats_cache_float = std::move(cache_float);
+        stats_avgrate_totals = std::move(avgrate_totals);
+        stats_stored = std::move(stored);
+    } catch (const std::exception &e) {
+        PRINT_DEBUG("failed to read snapshot: %s", e.what());
+        return false;
+    }
+
+    snapshot_current = true;
+    PRINT_DEBUG("loaded %zu achievements and %zu stats from the snapshot", achievements.size(), stats_stored.size());
+    return true;
+}
+
+void Steam_User_Stats::save_snapshot()
+{
+    std::string payload{};
+    Snapshot_Writer out(payload);
+
+    out.put(static_cast<uint32>(achievements.size()));
+    for (size_t id = 0; id < achievements.size(); ++id) {
+        out.put(achievements.name[id]);
+        out.put(achievements.display_name[id]);
+        out.put(achievements.description[id]);
+        out.put(achievements.hidden[id]);
+        out.put(achievements.icon[id]);
+        out.put(achievements.icon_gray[id]);
+        out.put(achievements.schema_progress[id]);
+        out.put(achievements.progress_min[id]);
+        out.put(achievements.progress_max[id]);
+        out.put(achievements.earned[id]);
+        out.put(achievements.earned_time[id]);
+        out.put(achievements.has_progress[id]);
+        out.put(achievements.progress[id]);
+        out.put(achievements.max_progress[id]);
+    }
+
+    out.put(static_cast<uint32>(sorted_achievement_names.size()));
+    for (const auto &name : sorted_achievement_names) {
+        out.put(name);
+    }
+
+    out.put(static_cast<uint32>(achievement_stat_trigger.size()));
+    for (const auto &stat : achievement_stat_trigger) {
+        out.put(stat.first);
+        out.put(static_cast<uint32>(stat.second.size()));
+        for (const auto &trig : stat.second) {
+            out.put(trig.name);
+            out.put(trig.value_operation);
+            out.put(trig.min_value);
+            out.put(trig.max_value);
+        }
+    }
+
+    // only the stats which were set, the caches also hold the defaults GetStat() filled in
+    auto put_stored = [&](const auto &cache, auto put_value) {
+        uint32 count = 0;
+        for (const auto &stat : cache) count += stats_stored.count(stat.first) ? 1 : 0;
+
+        out.put(count);
+        for (const auto &stat : cache) {
+            if (!stats_stored.count(stat.first)) continue;
+            out.put(stat.first);
+            put_value(stat.second);
+        }
+    };
+
+    put_stored(stats_cache_int, [&](int32 value){ out.put(value); });
+    put_stored(stats_cache_float, [&](float value){ out.put(value); });
+    put_stored(stats_avgrate_totals, [&](const std::pair<float, double> &totals){
+        out.put(totals.first);
+        out.put(totals.second);
+    });
+
+    out.put(static_cast<uint32>(stats_stored.size()));
+    for (const auto &name : stats_stored) {
+        out.put(name);
+    }
+
+    Snapshot_Sources sources = get_snapshot_sources();
+    std::string data{};
+    Snapshot_Writer header(data);
+    header.put(snapshot_magic);
+    header.put(snapshot_version);
+    header.put(sources.schema);
+    header.put(sources.achievements);
+    header.put(sources.stats);
+    header.put(sources.stat_definitions);
+    header.put(static_cast<uint64>(payload.size()));
+    header.put(snapshot_hash(payload.data(), payload.size()));
+    data.append(payload);
+
+    if (local_storage->store_data("", snapshot_user_file, &data[0], static_cast<unsigned int>(data.size())) == static_cast<int>(data.size())) {
+        snapshot_current = true;
+    }
+}
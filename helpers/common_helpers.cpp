@@ -229,6 +229,16 @@ std::string common_helpers::uint8_vector_to_hex_string(const std::vector<uint8_t
     return result;
 }
 
+uint64_t common_helpers::fnv1a_64(std::string_view data, uint64_t hash)
+{
+    for (char c : data) {
+        hash ^= static_cast<uint8_t>(c);
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
 bool common_helpers::str_cmp_insensitive(std::string_view str1, std::string_view str2)
 {
     if (str1.size() != str2.size()) return false;
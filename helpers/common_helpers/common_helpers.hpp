@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdlib>
+#include <cstdint>
 #include <string>
 #include <string_view>
 #include <fstream>
@@ -68,6 +69,10 @@ std::string string_strip(std::string_view str);
 
 std::string uint8_vector_to_hex_string(const std::vector<uint8_t> &v);
 
+// FNV-1a 64, pass the previous result as 'hash' to continue hashing over several chunks
+constexpr uint64_t FNV1A_64_SEED = 0xcbf29ce484222325ULL;
+uint64_t fnv1a_64(std::string_view data, uint64_t hash = FNV1A_64_SEED);
+
 bool str_cmp_insensitive(std::string_view str1, std::string_view str2);
 bool str_cmp_insensitive(std::wstring_view str1, std::wstring_view str2);
 
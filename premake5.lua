@@ -1221,6 +1221,405 @@ project "lib_game_overlay_renderer"
 -- End lib_game_overlay_renderer
 
 
+-- Project test_network_tcp_flood
+---------
+project "test_network_tcp_flood"
+    kind "ConsoleApp"
+    location "%{wks.location}/%{prj.name}"
+    targetdir("build/" .. os_iden .. "/%{_ACTION}/%{cfg.buildcfg}/tests/network")
+    targetname "test_network_tcp_flood_%{cfg.platform}"
+
+
+    -- include dir
+    ---------
+    -- x32 include dir
+    filter { "platforms:x32", }
+        includedirs {
+            x32_deps_include,
+        }
+
+    -- x64 include dir
+    filter { "platforms:x64", }
+        includedirs {
+            x64_deps_include,
+        }
+
+
+    -- common source & header files
+    ---------
+    filter {} -- reset the filter and remove all active keywords
+    files { -- added to all filters, later defines will be appended
+        'dll/network.cpp', 'dll/base.cpp',
+        'proto_gen/' .. os_iden .. '/**',
+        -- helpers
+        'helpers/common_helpers.cpp', 'helpers/common_helpers/**',
+        'helpers/dbg_log.cpp', 'helpers/dbg_log/**',
+        -- test files
+        'tests/network/loopback.hpp',
+        'tests/network/test_tcp_flood.cpp',
+    }
+    removefiles {
+        'post_build/**',
+        'build/deps/**',
+    }
+
+
+    -- libs to link
+    ---------
+    -- Windows libs to link
+    filter { "system:windows", }
+        links {
+            common_link_win,
+        }
+
+    -- Linux libs to link
+    filter { "system:not windows", }
+        links {
+            common_link_linux,
+        }
+
+
+    -- libs search dir
+    ---------
+    -- x32 libs search dir
+    filter { "platforms:x32", }
+        libdirs {
+            x32_deps_libdir,
+        }
+    -- x64 libs search dir
+    filter { "platforms:x64", }
+        libdirs {
+            x64_deps_libdir,
+        }
+
+
+    -- post build
+    ---------
+    filter {} -- reset the filter and remove all active keywords
+    postbuildcommands {
+        '%[%{!cfg.buildtarget.abspath}]',
+    }
+-- End test_network_tcp_flood
+
+
+-- Project test_callsystem_timers
+---------
+project "test_callsystem_timers"
+    kind "ConsoleApp"
+    location "%{wks.location}/%{prj.name}"
+    targetdir("build/" .. os_iden .. "/%{_ACTION}/%{cfg.buildcfg}/tests/callsystem")
+    targetname "test_callsystem_timers_%{cfg.platform}"
+
+
+    -- include dir
+    ---------
+    -- x32 include dir
+    filter { "platforms:x32", }
+        includedirs {
+            x32_deps_include,
+        }
+
+    -- x64 include dir
+    filter { "platforms:x64", }
+        includedirs {
+            x64_deps_include,
+        }
+
+
+    -- common source & header files
+    ---------
+    filter {} -- reset the filter and remove all active keywords
+    files { -- added to all filters, later defines will be appended
+        'dll/callsystem.cpp', 'dll/base.cpp',
+        -- helpers
+        'helpers/common_helpers.cpp', 'helpers/common_helpers/**',
+        'helpers/dbg_log.cpp', 'helpers/dbg_log/**',
+        -- test files
+        'tests/callsystem/test_call_result_timers.cpp',
+    }
+    removefiles {
+        'post_build/**',
+        'build/deps/**',
+    }
+
+
+    -- libs to link
+    ---------
+    -- Windows libs to link
+    filter { "system:windows", }
+        links {
+            common_link_win,
+        }
+
+    -- Linux libs to link
+    filter { "system:not windows", }
+        links {
+            common_link_linux,
+        }
+
+
+    -- libs search dir
+    ---------
+    -- x32 libs search dir
+    filter { "platforms:x32", }
+        libdirs {
+            x32_deps_libdir,
+        }
+    -- x64 libs search dir
+    filter { "platforms:x64", }
+        libdirs {
+            x64_deps_libdir,
+        }
+
+
+    -- post build
+    ---------
+    filter {} -- reset the filter and remove all active keywords
+    postbuildcommands {
+        '%[%{!cfg.buildtarget.abspath}]',
+    }
+-- End test_callsystem_timers
+
+
+-- Project test_callsystem_bench
+---------
+project "test_callsystem_bench"
+    kind "ConsoleApp"
+    location "%{wks.location}/%{prj.name}"
+    targetdir("build/" .. os_iden .. "/%{_ACTION}/%{cfg.buildcfg}/tests/callsystem")
+    targetname "test_callsystem_bench_%{cfg.platform}"
+
+
+    -- include dir
+    ---------
+    -- x32 include dir
+    filter { "platforms:x32", }
+        includedirs {
+            x32_deps_include,
+        }
+
+    -- x64 include dir
+    filter { "platforms:x64", }
+        includedirs {
+            x64_deps_include,
+        }
+
+
+    -- common source & header files
+    ---------
+    filter {} -- reset the filter and remove all active keywords
+    files { -- added to all filters, later defines will be appended
+        'dll/callsystem.cpp', 'dll/base.cpp',
+        -- helpers
+        'helpers/common_helpers.cpp', 'helpers/common_helpers/**',
+        'helpers/dbg_log.cpp', 'helpers/dbg_log/**',
+        -- test files
+        'tests/callsystem/test_call_results_bench.cpp',
+    }
+    removefiles {
+        'post_build/**',
+        'build/deps/**',
+    }
+
+
+    -- libs to link
+    ---------
+    -- Windows libs to link
+    filter { "system:windows", }
+        links {
+            common_link_win,
+        }
+
+    -- Linux libs to link
+    filter { "system:not windows", }
+        links {
+            common_link_linux,
+        }
+
+
+    -- libs search dir
+    ---------
+    -- x32 libs search dir
+    filter { "platforms:x32", }
+        libdirs {
+            x32_deps_libdir,
+        }
+    -- x64 libs search dir
+    filter { "platforms:x64", }
+        libdirs {
+            x64_deps_libdir,
+        }
+
+
+    -- post build
+    ---------
+    filter {} -- reset the filter and remove all active keywords
+    postbuildcommands {
+        '%[%{!cfg.buildtarget.abspath}]',
+    }
+-- End test_callsystem_bench
+
+
+-- Project test_callsystem_allocations
+---------
+project "test_callsystem_allocations"
+    kind "ConsoleApp"
+    location "%{wks.location}/%{prj.name}"
+    targetdir("build/" .. os_iden .. "/%{_ACTION}/%{cfg.buildcfg}/tests/callsystem")
+    targetname "test_callsystem_allocations_%{cfg.platform}"
+
+
+    -- include dir
+    ---------
+    -- x32 include dir
+    filter { "platforms:x32", }
+        includedirs {
+            x32_deps_include,
+        }
+
+    -- x64 include dir
+    filter { "platforms:x64", }
+        includedirs {
+            x64_deps_include,
+        }
+
+
+    -- common source & header files
+    ---------
+    filter {} -- reset the filter and remove all active keywords
+    files { -- added to all filters, later defines will be appended
+        'dll/callsystem.cpp', 'dll/base.cpp',
+        -- helpers
+        'helpers/common_helpers.cpp', 'helpers/common_helpers/**',
+        'helpers/dbg_log.cpp', 'helpers/dbg_log/**',
+        -- test files
+        'tests/callsystem/test_callbacks_allocations.cpp',
+    }
+    removefiles {
+        'post_build/**',
+        'build/deps/**',
+    }
+
+
+    -- libs to link
+    ---------
+    -- Windows libs to link
+    filter { "system:windows", }
+        links {
+            common_link_win,
+        }
+
+    -- Linux libs to link
+    filter { "system:not windows", }
+        links {
+            common_link_linux,
+        }
+
+
+    -- libs search dir
+    ---------
+    -- x32 libs search dir
+    filter { "platforms:x32", }
+        libdirs {
+            x32_deps_libdir,
+        }
+    -- x64 libs search dir
+    filter { "platforms:x64", }
+        libdirs {
+            x64_deps_libdir,
+        }
+
+
+    -- post build
+    ---------
+    filter {} -- reset the filter and remove all active keywords
+    postbuildcommands {
+        '%[%{!cfg.buildtarget.abspath}]',
+    }
+-- End test_callsystem_allocations
+
+
+-- Project test_network_reliable_udp_soak
+---------
+project "test_network_reliable_udp_soak"
+    kind "ConsoleApp"
+    location "%{wks.location}/%{prj.name}"
+    targetdir("build/" .. os_iden .. "/%{_ACTION}/%{cfg.buildcfg}/tests/network")
+    targetname "test_network_reliable_udp_soak_%{cfg.platform}"
+
+
+    -- include dir
+    ---------
+    -- x32 include dir
+    filter { "platforms:x32", }
+        includedirs {
+            x32_deps_include,
+        }
+
+    -- x64 include dir
+    filter { "platforms:x64", }
+        includedirs {
+            x64_deps_include,
+        }
+
+
+    -- common source & header files
+    ---------
+    filter {} -- reset the filter and remove all active keywords
+    files { -- added to all filters, later defines will be appended
+        'dll/network.cpp', 'dll/base.cpp',
+        'proto_gen/' .. os_iden .. '/**',
+        -- helpers
+        'helpers/common_helpers.cpp', 'helpers/common_helpers/**',
+        'helpers/dbg_log.cpp', 'helpers/dbg_log/**',
+        -- test files
+        'tests/network/loopback.hpp',
+        'tests/network/test_reliable_udp_soak.cpp',
+    }
+    removefiles {
+        'post_build/**',
+        'build/deps/**',
+    }
+
+
+    -- libs to link
+    ---------
+    -- Windows libs to link
+    filter { "system:windows", }
+        links {
+            common_link_win,
+        }
+
+    -- Linux libs to link
+    filter { "system:not windows", }
+        links {
+            common_link_linux,
+        }
+
+
+    -- libs search dir
+    ---------
+    -- x32 libs search dir
+    filter { "platforms:x32", }
+        libdirs {
+            x32_deps_libdir,
+        }
+    -- x64 libs search dir
+    filter { "platforms:x64", }
+        libdirs {
+            x64_deps_libdir,
+        }
+
+
+    -- post build
+    ---------
+    filter {} -- reset the filter and remove all active keywords
+    postbuildcommands {
+        '%[%{!cfg.buildtarget.abspath}]',
+    }
+-- End test_network_reliable_udp_soak
+
+
 
 -- WINDOWS ONLY TARGETS START
 if os.target() == "windows" then
@@ -0,0 +1,76 @@
+// callback results posted with a short timeout while the game runs the callbacks at 60 fps
+// each one must be delivered on one of the next frames, never after a whole round of the timer wheel
+
+#include "dll/callsystem.h"
+
+#include <iostream>
+#include <thread>
+
+constexpr int TEST_CALLBACK = 123;
+constexpr int RESULTS_COUNT = 40;
+constexpr double RESULT_TIMEOUT = 0.002;
+constexpr double FRAME_SECONDS = 1.0 / 60.0;
+// a few frames, the wheel takes SLOTS_COUNT * SLOT_SECONDS (2.56 s) to come back to a slot
+constexpr double MAX_LATENCY = 0.25;
+
+struct Test_Result {
+    int index{};
+};
+
+struct Test_Callback : CCallbackBase {
+    std::chrono::high_resolution_clock::time_point posted[RESULTS_COUNT]{};
+    double latency[RESULTS_COUNT]{};
+    int received = 0;
+
+    Test_Callback() { m_iCallback = TEST_CALLBACK; }
+
+    void Run(void *param) override { receive(param); }
+    void Run(void *param, bool io_failure, SteamAPICall_t api_call) override { receive(param); }
+    int GetCallbackSizeBytes() override { return sizeof(Test_Result); }
+
+    void receive(void *param)
+    {
+        int index = static_cast<Test_Result *>(param)->index;
+        latency[index] = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - posted[index]).count();
+        ++received;
+    }
+};
+
+int main()
+{
+    std::lock_guard<std::recursive_mutex> lock(global_mutex);
+    SteamCallResults results{};
+    SteamCallBacks callbacks(&results);
+    Test_Callback callback{};
+    callbacks.addCallBack(TEST_CALLBACK, &callback);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; callback.received < RESULTS_COUNT; ++frame) {
+        if (check_timedout(start, RESULTS_COUNT * FRAME_SECONDS + 5.0)) break;
+
+        if (frame < RESULTS_COUNT) {
+            Test_Result result{};
+            result.index = frame;
+            callback.posted[frame] = std::chrono::high_resolution_clock::now();
+            callbacks.addCBResult(TEST_CALLBACK, &result, sizeof(result), RESULT_TIMEOUT);
+        }
+
+        callbacks.runCallBacks();
+        results.runCallResults();
+        std::this_thread::sleep_for(std::chrono::duration<double>(FRAME_SECONDS));
+    }
+
+    double worst = 0;
+    for (int i = 0; i < callback.received && i < RESULTS_COUNT; ++i) {
+        worst = std::max(worst, callback.latency[i]);
+    }
+
+    std::cout << callback.received << "/" << RESULTS_COUNT << " results, worst latency " << worst * 1000.0 << " ms" << std::endl;
+    if (callback.received != RESULTS_COUNT || worst > MAX_LATENCY) {
+        std::cerr << "Failed!" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Success!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,77 @@
+// times 10k call results going through SteamCallResults::runCallResults(), and the cost
+// of the runs made while they are all waiting for their timeout
+
+#include "dll/callsystem.h"
+
+#include <iostream>
+#include <thread>
+
+constexpr int TEST_CALLBACK = 124;
+constexpr int RESULTS_COUNT = 10000;
+// long enough for the idle runs below to happen before any result is due
+constexpr double RESULT_TIMEOUT = 0.5;
+constexpr int IDLE_RUNS = 100;
+
+struct Test_Result {
+    int index{};
+};
+
+struct Test_Callback : CCallbackBase {
+    int received = 0;
+
+    Test_Callback() { m_iCallback = TEST_CALLBACK; }
+
+    void Run(void *param) override { ++received; }
+    void Run(void *param, bool io_failure, SteamAPICall_t api_call) override { ++received; }
+    int GetCallbackSizeBytes() override { return sizeof(Test_Result); }
+};
+
+static double seconds_since(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int main()
+{
+    std::lock_guard<std::recursive_mutex> lock(global_mutex);
+    SteamCallResults results{};
+    Test_Callback callback{};
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < RESULTS_COUNT; ++i) {
+        Test_Result result{};
+        result.index = i;
+        SteamAPICall_t api_call = results.addCallResult(TEST_CALLBACK, &result, sizeof(result), RESULT_TIMEOUT);
+        results.addCallBack(api_call, &callback);
+    }
+    double add_seconds = seconds_since(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < IDLE_RUNS; ++i) {
+        results.runCallResults();
+    }
+    double idle_seconds = seconds_since(start);
+    int received_early = callback.received;
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(RESULT_TIMEOUT + STEAM_CALLRESULT_WAIT_FOR_CB));
+
+    start = std::chrono::high_resolution_clock::now();
+    int runs = 0;
+    while (callback.received < RESULTS_COUNT && runs < 1000) {
+        results.runCallResults();
+        ++runs;
+    }
+    double run_seconds = seconds_since(start);
+
+    std::cout << "add " << RESULTS_COUNT << " call results: " << add_seconds * 1000.0 << " ms" << std::endl;
+    std::cout << "runCallResults() while they wait: " << (idle_seconds / IDLE_RUNS) * 1000000.0 << " us per run" << std::endl;
+    std::cout << "runCallResults() delivering them: " << run_seconds * 1000.0 << " ms in " << runs << " run(s)" << std::endl;
+
+    if (received_early || callback.received != RESULTS_COUNT) {
+        std::cerr << "Failed! " << received_early << " delivered early, " << callback.received << "/" << RESULTS_COUNT << " delivered" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Success!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,85 @@
+// posts and runs the same callbacks every frame and counts the heap allocations
+// once the buffers have grown, the steady state of a release build must not allocate at all
+
+#include "dll/callsystem.h"
+
+#include <iostream>
+#include <cstdlib>
+#include <new>
+
+constexpr int TEST_CALLBACK = 125;
+constexpr int WARMUP_FRAMES = 1000;
+constexpr int COUNTED_FRAMES = 1000;
+constexpr int RESULTS_PER_FRAME = 5;
+
+static bool counting_allocations = false;
+static unsigned long long allocations = 0;
+
+void *operator new(size_t size)
+{
+    if (counting_allocations) ++allocations;
+
+    void *ptr = malloc(size ? size : 1);
+    if (!ptr) throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) noexcept
+{
+    free(ptr);
+}
+
+struct Test_Result {
+    char data[8]{};
+};
+
+struct Test_Callback : CCallbackBase {
+    int received = 0;
+
+    Test_Callback() { m_iCallback = TEST_CALLBACK; }
+
+    void Run(void *param) override { ++received; }
+    void Run(void *param, bool io_failure, SteamAPICall_t api_call) override { ++received; }
+    int GetCallbackSizeBytes() override { return sizeof(Test_Result); }
+};
+
+int main()
+{
+    std::lock_guard<std::recursive_mutex> lock(global_mutex);
+    SteamCallResults results{};
+    SteamCallBacks callbacks(&results);
+    Test_Callback callback{};
+    callbacks.addCallBack(TEST_CALLBACK, &callback);
+
+    for (int frame = 0; frame < WARMUP_FRAMES + COUNTED_FRAMES; ++frame) {
+        counting_allocations = frame >= WARMUP_FRAMES;
+        for (int i = 0; i < RESULTS_PER_FRAME; ++i) {
+            Test_Result result{};
+            result.data[0] = static_cast<char>(i);
+            callbacks.addCBResult(TEST_CALLBACK, &result, sizeof(result), 0.0);
+        }
+
+        callbacks.runCallBacks();
+        results.runCallResults();
+    }
+    counting_allocations = false;
+
+    std::cout << callback.received << " callbacks run, " << allocations << " allocations in the last " << COUNTED_FRAMES << " frames" << std::endl;
+    bool failed = !callback.received;
+#ifdef EMU_RELEASE_BUILD
+    // the debug logs format their messages on the heap, only release builds are expected not to allocate
+    failed = failed || allocations;
+#endif
+    if (failed) {
+        std::cerr << "Failed!" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Success!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,93 @@
+// two Networking instances in the same process, announcing to each other on localhost
+
+#pragma once
+
+#include "dll/network.h"
+#include "dll/base.h"
+
+#include <iostream>
+#include <thread>
+
+// network.cpp answers source queries through the client, which the tests never create
+class Steam_Client;
+Steam_Client *get_steam_client() { return nullptr; }
+
+constexpr uint32 LOOPBACK_APPID = 480;
+constexpr uint32 LOOPBACK_IP = 0x7F000001;
+
+struct Loopback_Peer {
+    CSteamID id{};
+    Networking *network{};
+    bool connected = false;
+
+    static void user_status_callback(void *object, Common_Message *msg)
+    {
+        auto peer = static_cast<Loopback_Peer *>(object);
+        if (msg->has_low_level()) {
+            peer->connected = msg->low_level().type() == Low_Level::CONNECT;
+        }
+    }
+};
+
+// announce_port is where the other peer listens, see Loopback_Pair below
+inline void loopback_peer_start(Loopback_Peer &peer, uint64 id, uint16 port, uint16 announce_port, bool reliable_udp = false)
+{
+    std::set<IP_PORT> broadcasts{};
+    IP_PORT addr{};
+    addr.ip = LOOPBACK_IP;
+    addr.port = announce_port;
+    broadcasts.insert(addr);
+
+    peer.id = CSteamID((uint64)id);
+    peer.network = new Networking(peer.id, LOOPBACK_APPID, port, &broadcasts, false, false, false, reliable_udp);
+    peer.network->setCallback(CALLBACK_ID_USER_STATUS, peer.id, &Loopback_Peer::user_status_callback, &peer);
+}
+
+inline void loopback_peer_stop(Loopback_Peer &peer)
+{
+    delete peer.network;
+    peer.network = nullptr;
+}
+
+struct Loopback_Pair {
+    Loopback_Peer a{};
+    Loopback_Peer b{};
+
+    Loopback_Pair(uint16 port_a, uint16 port_b, bool reliable_udp = false)
+    {
+        loopback_peer_start(a, 76561197960287931ULL, port_a, port_b, reliable_udp);
+        loopback_peer_start(b, 76561197960287932ULL, port_b, port_a, reliable_udp);
+    }
+
+    ~Loopback_Pair()
+    {
+        loopback_peer_stop(a);
+        loopback_peer_stop(b);
+    }
+
+    void run()
+    {
+        a.network->Run();
+        b.network->Run();
+    }
+
+    // pump both peers until cond() holds, returns false on timeout
+    template<typename Cond>
+    bool run_until(Cond cond, double timeout_seconds)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        while (!cond()) {
+            if (check_timedout(start, timeout_seconds)) return false;
+
+            run();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        return true;
+    }
+
+    bool connect()
+    {
+        return run_until([this]{ return a.connected && b.connected; }, 15.0);
+    }
+};
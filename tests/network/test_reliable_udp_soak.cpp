@@ -0,0 +1,192 @@
+// sends a stream of sequenced reliable messages between two reliable UDP peers
+// whose UDP packets go through a relay that drops and duplicates some of them,
+// the stream starts on TCP and switches to reliable UDP once the peers pinged each other,
+// every message must arrive exactly once and in order, including the ones sent around the switch
+
+#include "loopback.hpp"
+
+#include <cstring>
+#include <random>
+
+constexpr unsigned SOAK_MESSAGES = 4000; // sent once the peers switched to reliable UDP
+constexpr unsigned SOAK_PER_TICK = 16;
+constexpr unsigned SOAK_LARGE_EVERY = 16; // spans several fragments
+constexpr unsigned SOAK_LARGE_SIZE = 4000;
+constexpr unsigned SOAK_SMALL_SIZE = 100;
+constexpr unsigned SOAK_DROP_PERCENT = 15;
+constexpr unsigned SOAK_DUPLICATE_PERCENT = 2;
+
+constexpr uint16 SOAK_PORT_A = 42400;
+constexpr uint16 SOAK_PORT_B = 42500;
+constexpr uint16 SOAK_RELAY_PORT = 42600;
+
+static unsigned next_expected = 0;
+static unsigned out_of_order = 0;
+
+static void networking_callback(void *object, Common_Message *msg)
+{
+    if (!msg->has_network()) return;
+
+    const std::string &data = msg->network().data();
+    uint32 sequence = ~0u;
+    if (data.size() >= sizeof(sequence)) memcpy(&sequence, data.data(), sizeof(sequence));
+
+    if (sequence != next_expected) {
+        if (out_of_order < 10) std::cerr << "expected message " << next_expected << ", got " << sequence << std::endl;
+        ++out_of_order;
+    }
+
+    next_expected = sequence + 1;
+}
+
+// forwards the UDP packets of one peer to the other, both announce to it so they only see its address
+struct Lossy_Relay {
+    sock_t sock = static_cast<sock_t>(~0);
+    std::vector<struct sockaddr_in> peers{};
+    std::mt19937 random{1234};
+    unsigned long long forwarded = 0, dropped = 0, duplicated = 0, reliable_udp = 0;
+
+    bool start(uint16 port)
+    {
+        sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+        struct sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(LOOPBACK_IP);
+        addr.sin_port = htons(port);
+        if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) != 0) return false;
+
+#if defined(STEAM_WIN32)
+        u_long mode = 1;
+        return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+        return fcntl(sock, F_SETFL, O_NONBLOCK, 1) == 0;
+#endif
+    }
+
+    void stop()
+    {
+#if defined(STEAM_WIN32)
+        closesocket(sock);
+#else
+        close(sock);
+#endif
+    }
+
+    void run()
+    {
+        char data[2048];
+        while (true) {
+            struct sockaddr_in from{};
+            socklen_t from_size = sizeof(from);
+            int size = recvfrom(sock, data, sizeof(data), 0, (struct sockaddr *)&from, &from_size);
+            if (size <= 0) break;
+
+            // the first two senders are the peers
+            const struct sockaddr_in *to = nullptr;
+            bool known = false;
+            for (auto &peer : peers) {
+                if (peer.sin_port == from.sin_port) known = true;
+                else to = &peer;
+            }
+
+            if (!known && peers.size() < 2) peers.push_back(from);
+            if (!known || !to) continue;
+
+            unsigned roll = random() % 100;
+            if (roll < SOAK_DROP_PERCENT) {
+                ++dropped;
+                continue;
+            }
+
+            Common_Message msg{};
+            if (msg.ParseFromArray(data, size) && msg.has_reliable_udp()) ++reliable_udp;
+
+            sendto(sock, data, size, 0, (const struct sockaddr *)to, sizeof(*to));
+            ++forwarded;
+            if (roll >= 100 - SOAK_DUPLICATE_PERCENT) {
+                sendto(sock, data, size, 0, (const struct sockaddr *)to, sizeof(*to));
+                ++duplicated;
+            }
+        }
+    }
+};
+
+int main()
+{
+    Loopback_Peer a{}, b{};
+    loopback_peer_start(a, 76561197960287931ULL, SOAK_PORT_A, SOAK_RELAY_PORT, true);
+    loopback_peer_start(b, 76561197960287932ULL, SOAK_PORT_B, SOAK_RELAY_PORT, true);
+    b.network->setCallback(CALLBACK_ID_NETWORKING, b.id, &networking_callback, nullptr);
+
+    Lossy_Relay relay{};
+    if (!relay.start(SOAK_RELAY_PORT)) {
+        std::cerr << "Failed! could not bind the relay" << std::endl;
+        return 1;
+    }
+
+    unsigned sent = 0;
+    auto run_until = [&](auto cond, double timeout_seconds) {
+        auto start = std::chrono::high_resolution_clock::now();
+        while (!cond()) {
+            if (check_timedout(start, timeout_seconds)) return false;
+
+            relay.run();
+            a.network->Run();
+            b.network->Run();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        return true;
+    };
+
+    if (!run_until([&]{ return a.connected && b.connected; }, 15.0)) {
+        std::cerr << "Failed! the peers never connected" << std::endl;
+        return 1;
+    }
+
+    Common_Message msg{};
+    msg.set_source_id(a.id.ConvertToUint64());
+    msg.set_dest_id(b.id.ConvertToUint64());
+    Network_pb *network = msg.mutable_network();
+    network->set_type(Network_pb::DATA);
+
+    // one message per tick until the relay sees reliable UDP packets,
+    // which takes a broadcast or two through the lossy relay, then the rest at full pace
+    unsigned total = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    bool done = run_until([&]{
+        if (relay.reliable_udp && !total) total = sent + SOAK_MESSAGES;
+
+        for (unsigned i = 0; i < SOAK_PER_TICK && (!total || sent < total); ++i) {
+            std::string data(sent % SOAK_LARGE_EVERY ? SOAK_SMALL_SIZE : SOAK_LARGE_SIZE, 'x');
+            memcpy(&data[0], &sent, sizeof(sent));
+            network->set_data(data);
+            if (!a.network->sendTo(&msg, true)) break;
+            ++sent;
+        }
+
+        return total && next_expected == total;
+    }, 60.0);
+    double seconds = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::cout << "soak: " << next_expected << "/" << sent << " messages in " << seconds * 1000.0 << " ms, "
+        << out_of_order << " out of order, relay forwarded " << relay.forwarded << " packets (" << relay.reliable_udp
+        << " reliable UDP), dropped " << relay.dropped << ", duplicated " << relay.duplicated << std::endl;
+
+    loopback_peer_stop(a);
+    loopback_peer_stop(b);
+    relay.stop();
+
+    if (!total) {
+        std::cerr << "Failed! the peers never switched to reliable UDP" << std::endl;
+        return 1;
+    }
+
+    if (!done || out_of_order) {
+        std::cerr << "Failed! the stream did not arrive whole and in order" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Success!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,127 @@
+// floods one peer with small reliable messages over the loopback TCP connection
+// and reports the throughput, the framing of the same stream is also timed
+// against the erase-from-front vector the TCP buffers used before TCP_Buffer
+
+#include "loopback.hpp"
+
+#include <cstring>
+
+constexpr unsigned FLOOD_FRAMES = 10000;
+constexpr unsigned FLOOD_PAYLOAD = 64;
+
+static unsigned received_frames = 0;
+static unsigned long long received_bytes = 0;
+
+static void networking_callback(void *object, Common_Message *msg)
+{
+    if (msg->has_network()) {
+        ++received_frames;
+        received_bytes += msg->network().data().size();
+    }
+}
+
+static double seconds_since(std::chrono::high_resolution_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+// reads every frame of stream back the way unbuffer_tcp() does, with a vector
+// that erases each parsed frame from its front
+static unsigned frame_with_vector(const std::vector<char> &stream)
+{
+    std::vector<char> buffer(stream);
+    unsigned frames = 0;
+    while (buffer.size() >= sizeof(uint32)) {
+        uint32 length;
+        memcpy(&length, buffer.data(), sizeof(length));
+        buffer.erase(buffer.begin(), buffer.begin() + sizeof(length) + length);
+        ++frames;
+    }
+
+    return frames;
+}
+
+// same as above with TCP_Buffer
+static unsigned frame_with_tcp_buffer(const std::vector<char> &stream)
+{
+    TCP_Buffer buffer{};
+    memcpy(buffer.append(stream.size()), stream.data(), stream.size());
+    unsigned frames = 0;
+    while (buffer.size() >= sizeof(uint32)) {
+        uint32 length;
+        memcpy(&length, buffer.data(), sizeof(length));
+        buffer.consume(sizeof(length) + length);
+        ++frames;
+    }
+
+    return frames;
+}
+
+int main()
+{
+    Common_Message msg{};
+    Network_pb *network = new Network_pb();
+    network->set_type(Network_pb::DATA);
+    network->set_data(std::string(FLOOD_PAYLOAD, 'x'));
+    msg.set_allocated_network(network);
+
+    // framing alone
+    std::vector<char> stream{};
+    for (unsigned i = 0; i < FLOOD_FRAMES; ++i) {
+        uint32 size = static_cast<uint32>(msg.ByteSizeLong());
+        size_t offset = stream.size();
+        stream.resize(offset + sizeof(size) + size);
+        memcpy(&stream[offset], &size, sizeof(size));
+        msg.SerializeToArray(&stream[offset + sizeof(size)], size);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    unsigned vector_frames = frame_with_vector(stream);
+    double vector_seconds = seconds_since(start);
+
+    start = std::chrono::high_resolution_clock::now();
+    unsigned tcp_buffer_frames = frame_with_tcp_buffer(stream);
+    double tcp_buffer_seconds = seconds_since(start);
+
+    std::cout << "framing " << FLOOD_FRAMES << " frames (" << stream.size() << " bytes): "
+        << "vector erase " << vector_seconds * 1000.0 << " ms, "
+        << "TCP_Buffer " << tcp_buffer_seconds * 1000.0 << " ms" << std::endl;
+
+    if (vector_frames != FLOOD_FRAMES || tcp_buffer_frames != FLOOD_FRAMES) {
+        std::cerr << "Failed! framing lost frames" << std::endl;
+        return 1;
+    }
+
+    // the same frames through the real sockets
+    Loopback_Pair pair(42100, 42200);
+    pair.b.network->setCallback(CALLBACK_ID_NETWORKING, pair.b.id, &networking_callback, nullptr);
+    if (!pair.connect()) {
+        std::cerr << "Failed! the peers never connected" << std::endl;
+        return 1;
+    }
+
+    msg.set_source_id(pair.a.id.ConvertToUint64());
+    msg.set_dest_id(pair.b.id.ConvertToUint64());
+
+    start = std::chrono::high_resolution_clock::now();
+    for (unsigned i = 0; i < FLOOD_FRAMES; ++i) {
+        if (!pair.a.network->sendTo(&msg, true)) {
+            std::cerr << "Failed! could not send frame " << i << std::endl;
+            return 1;
+        }
+    }
+
+    bool done = pair.run_until([]{ return received_frames == FLOOD_FRAMES; }, 30.0);
+    double flood_seconds = seconds_since(start);
+    std::cout << "flood: " << received_frames << "/" << FLOOD_FRAMES << " frames in " << flood_seconds * 1000.0 << " ms, "
+        << (unsigned long long)(received_frames / flood_seconds) << " frames/s, "
+        << (received_bytes / flood_seconds) / (1024.0 * 1024.0) << " MiB/s of payload" << std::endl;
+
+    if (!done) {
+        std::cerr << "Failed! not every frame arrived" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Success!" << std::endl;
+    return 0;
+}